@@ -0,0 +1,858 @@
+//
+//  mkfont.c
+//  Font compiler for the ESP32 TFT library
+//
+//  Converts TrueType/OpenType (FreeType) or BDF fonts to the library's
+//  fixed width or proportional font format.
+//  Both the C source (<name>.c) and the font file (<name>.fon) are created.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#ifndef MKFONT_NO_FREETYPE
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#endif
+
+#define VERSION "1.0.0"
+
+// 3rd header byte of the proportional font, glyph pixel format
+#define GLYPH_FORMAT_AA2		2		// 2 bits per pixel
+#define GLYPH_FORMAT_AA4		4		// 4 bits per pixel
+#define GLYPH_FORMAT_RLE		0x81	// 1 bit per pixel, run-length coded
+#define GLYPH_FORMAT_UNICODE	0x40	// added to the format in Unicode font
+#define GLYPH_FORMAT_METRICS	0x20	// added to the format if the 4th header byte holds the max character width
+
+#define GLYPH_RUN_CODE_MAX		45
+
+#define FONT_UNICODE_ENTRY		6		// size of the code point table entry
+#define FONT_MAX_GLYPHS			0xFFFF
+#define MAX_RANGES				64
+
+typedef struct {
+	uint32_t	first;
+	uint32_t	last;
+} range_t;
+
+typedef struct {
+	uint32_t	code;
+	int			left;		// bitmap position relative to the pen position
+	int			top;		// bitmap top row above the baseline
+	int			width;
+	int			height;
+	int			advance;	// the distance to move the pen
+	uint8_t		*pixels;	// pixel coverage, 0~255
+} glyph_t;
+
+typedef struct {
+	uint8_t		*data;
+	int			len;
+	int			size;
+} buffer_t;
+
+static glyph_t *s_glyph = NULL;
+static int s_nglyphs = 0;
+static int s_glyphsSize = 0;
+static char s_family[128] = "";
+
+static range_t s_range[MAX_RANGES];
+static int s_nranges = 0;
+
+static int s_size = 16;
+static int s_bpp = 1;
+static int s_rle = 0;
+static int s_unicode = 0;
+static int s_fixed = 0;
+static int s_verbose = 0;
+static int s_bdf = 0;
+static char *s_name = NULL;
+static char *s_outBase = NULL;
+
+// Font metrics
+static int s_ascent = 0;
+static int s_ySize = 0;
+static int s_maxWidth = 0;
+
+
+//-----------------
+static void usage()
+{
+	printf("mkfont " VERSION ", font compiler for the ESP32 TFT library\n\n");
+	printf("Usage: mkfont [options] <font_file>\n\n");
+	printf("  <font_file>  TrueType/OpenType font (.ttf, .otf) or BDF font (.bdf)\n\n");
+	printf("  -s <size>    font size in pixels (em height, point size at 72 dpi), default 16; TrueType fonts only\n");
+	printf("  -r <ranges>  characters to include, comma separated code points or ranges, default 32-126\n");
+	printf("               e.g.: -r 32-126,0xB0,0x410-0x44F\n");
+	printf("  -b <bpp>     bits per pixel, 1 (default), 2 or 4 for anti-aliased font; TrueType fonts only\n");
+	printf("  -c           run-length code the glyphs of 1-bit font if the font becomes smaller\n");
+	printf("  -u           create Unicode font (code point table); used for code points above 254\n");
+	printf("  -f           create fixed width font (1-bit, code points up to 255)\n");
+	printf("  -n <name>    font name, array name is tft_<name>; default is the font file name and size\n");
+	printf("  -o <base>    output file name without extension, default is the font name\n");
+	printf("  -v           print font information\n");
+}
+
+//-------------------------------------------
+static void *xrealloc(void *ptr, size_t size)
+{
+	void *p = realloc(ptr, size);
+	if (p == NULL) {
+		fprintf(stderr, "Memory allocation error\n");
+		exit(1);
+	}
+	return p;
+}
+
+//---------------------------------------------
+static void buf_put(buffer_t *buf, uint8_t val)
+{
+	if (buf->len == buf->size) {
+		buf->size = (buf->size) ? (buf->size * 2) : 4096;
+		buf->data = xrealloc(buf->data, buf->size);
+	}
+	buf->data[buf->len++] = val;
+}
+
+//------------------------------------------------
+static void buf_put24(buffer_t *buf, uint32_t val)
+{
+	buf_put(buf, val & 0xFF);
+	buf_put(buf, (val >> 8) & 0xFF);
+	buf_put(buf, (val >> 16) & 0xFF);
+}
+
+// ==== Character ranges ====
+
+// Parse comma separated code points or ranges 'first-last'
+//--------------------------------------
+static int parse_ranges(const char *str)
+{
+	const char *p = str;
+	char *end;
+
+	while (*p) {
+		if (s_nranges == MAX_RANGES) return 0;
+		uint32_t first = strtoul(p, &end, 0);
+		if (end == p) return 0;
+		uint32_t last = first;
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtoul(p, &end, 0);
+			if (end == p) return 0;
+			p = end;
+		}
+		if ((last < first) || (last > 0x10FFFF)) return 0;
+		s_range[s_nranges].first = first;
+		s_range[s_nranges++].last = last;
+		if (*p == ',') p++;
+		else if (*p) return 0;
+	}
+	return (s_nranges > 0);
+}
+
+//--------------------------------
+static int in_range(uint32_t code)
+{
+	for (int i = 0; i < s_nranges; i++) {
+		if ((code >= s_range[i].first) && (code <= s_range[i].last)) return 1;
+	}
+	return 0;
+}
+
+// Add the glyph of the character 'code'
+// Pixels are copied, 'pixels' holds 'width' x 'height' coverage values
+//----------------------------------------------------------------------------------------------------------------
+static void add_glyph(uint32_t code, int left, int top, int width, int height, int advance, const uint8_t *pixels)
+{
+	for (int i = 0; i < s_nglyphs; i++) {
+		if (s_glyph[i].code == code) return;
+	}
+	if (s_nglyphs == s_glyphsSize) {
+		s_glyphsSize = (s_glyphsSize) ? (s_glyphsSize * 2) : 256;
+		s_glyph = xrealloc(s_glyph, s_glyphsSize * sizeof(glyph_t));
+	}
+	glyph_t *g = &s_glyph[s_nglyphs++];
+	g->code = code;
+	g->left = left;
+	g->top = top;
+	g->width = width;
+	g->height = height;
+	g->advance = advance;
+	g->pixels = NULL;
+	if ((width) && (height)) {
+		g->pixels = xrealloc(NULL, width * height);
+		memcpy(g->pixels, pixels, width * height);
+	}
+}
+
+// ==== BDF font ====
+
+//------------------------------------
+static int load_bdf(const char *fname)
+{
+	char line[1024];
+	int code = -1;
+	int advance = 0;
+	int width = 0, height = 0, xoff = 0, yoff = 0;
+	int row = -1;
+	uint8_t *pixels = NULL;
+
+	FILE *f = fopen(fname, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Error opening font file '%s'\n", fname);
+		return 0;
+	}
+	if ((fgets(line, sizeof(line), f) == NULL) || (strncmp(line, "STARTFONT", 9) != 0)) {
+		fprintf(stderr, "Not a BDF font file\n");
+		fclose(f);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (row >= 0) {
+			// bitmap row, hex digits, MSB is the leftmost pixel
+			if (strncmp(line, "ENDCHAR", 7) == 0) row = height;
+			else if (row < height) {
+				for (int x = 0; x < width; x++) {
+					char hex[2] = {line[x / 4], 0};
+					if (!isxdigit((unsigned char)hex[0])) break;
+					if ((strtol(hex, NULL, 16) >> (3 - (x % 4))) & 1) pixels[(row * width) + x] = 255;
+				}
+				row++;
+			}
+			if (row == height) {
+				if ((code >= 0) && (in_range(code))) add_glyph(code, xoff, yoff + height, width, height, advance, pixels);
+				row = -1;
+				code = -1;
+			}
+		}
+		else if (strncmp(line, "FAMILY_NAME", 11) == 0) {
+			char *p = strchr(line, '"');
+			if (p) {
+				snprintf(s_family, sizeof(s_family), "%s", p+1);
+				p = strchr(s_family, '"');
+				if (p) *p = '\0';
+			}
+		}
+		else if (strncmp(line, "ENCODING", 8) == 0) code = atoi(line+8);
+		else if (strncmp(line, "DWIDTH", 6) == 0) advance = atoi(line+6);
+		else if (strncmp(line, "BBX", 3) == 0) {
+			if ((sscanf(line+3, "%d %d %d %d", &width, &height, &xoff, &yoff) != 4) || (width < 0) || (height < 0)) {
+				fprintf(stderr, "Wrong BDF glyph bounding box\n");
+				fclose(f);
+				return 0;
+			}
+		}
+		else if (strncmp(line, "BITMAP", 6) == 0) {
+			pixels = xrealloc(pixels, (width * height) + 1);
+			memset(pixels, 0, (width * height) + 1);
+			row = 0;
+			if (height == 0) {
+				if ((code >= 0) && (in_range(code))) add_glyph(code, xoff, yoff, 0, 0, advance, pixels);
+				row = -1;
+				code = -1;
+			}
+		}
+	}
+	fclose(f);
+	if (pixels) free(pixels);
+	return 1;
+}
+
+// ==== TrueType font ====
+
+#ifndef MKFONT_NO_FREETYPE
+//-----------------------------------------
+static int load_freetype(const char *fname)
+{
+	FT_Library library;
+	FT_Face face;
+	uint8_t *pixels = NULL;
+	int res = 0;
+
+	if (FT_Init_FreeType(&library)) {
+		fprintf(stderr, "FreeType initialization error\n");
+		return 0;
+	}
+	if (FT_New_Face(library, fname, 0, &face)) {
+		fprintf(stderr, "Error opening font file '%s'\n", fname);
+		goto exit;
+	}
+	if (FT_Set_Pixel_Sizes(face, 0, s_size)) {
+		fprintf(stderr, "Font size %d not supported\n", s_size);
+		goto exit_face;
+	}
+	snprintf(s_family, sizeof(s_family), "%s %s", (face->family_name) ? face->family_name : "",
+			(face->style_name) ? face->style_name : "");
+
+	for (int r = 0; r < s_nranges; r++) {
+		for (uint32_t code = s_range[r].first; code <= s_range[r].last; code++) {
+			FT_UInt index = FT_Get_Char_Index(face, code);
+			if (index == 0) {
+				if (s_verbose) printf("Character 0x%04X not in font\n", code);
+				continue;
+			}
+			if (FT_Load_Glyph(face, index, (s_bpp == 1) ? (FT_LOAD_RENDER | FT_LOAD_TARGET_MONO) : FT_LOAD_RENDER)) {
+				fprintf(stderr, "Error rendering character 0x%04X\n", code);
+				goto exit_face;
+			}
+			FT_GlyphSlot slot = face->glyph;
+			FT_Bitmap *bmp = &slot->bitmap;
+			int width = bmp->width;
+			int height = bmp->rows;
+
+			pixels = xrealloc(pixels, (width * height) + 1);
+			for (int y = 0; y < height; y++) {
+				const uint8_t *src = bmp->buffer + (y * bmp->pitch);
+				for (int x = 0; x < width; x++) {
+					uint8_t v;
+					if (bmp->pixel_mode == FT_PIXEL_MODE_MONO) v = ((src[x / 8] >> (7 - (x % 8))) & 1) ? 255 : 0;
+					else v = (src[x] * 255) / ((bmp->num_grays > 1) ? (bmp->num_grays - 1) : 255);
+					pixels[(y * width) + x] = v;
+				}
+			}
+			add_glyph(code, slot->bitmap_left, slot->bitmap_top, width, height, (slot->advance.x + 32) >> 6, pixels);
+		}
+	}
+	res = 1;
+
+exit_face:
+	FT_Done_Face(face);
+exit:
+	FT_Done_FreeType(library);
+	if (pixels) free(pixels);
+	return res;
+}
+#endif
+
+// ==== Glyph processing ====
+
+//-----------------------------------------------------
+static int compare_glyphs(const void *a, const void *b)
+{
+	const glyph_t *ga = a;
+	const glyph_t *gb = b;
+	return (ga->code > gb->code) - (ga->code < gb->code);
+}
+
+// Quantize the pixel coverage to the font's bits per pixel and
+// crop the glyph bitmap to its visible pixels
+//---------------------------
+static void quantize_glyphs()
+{
+	int max = (1 << s_bpp) - 1;
+
+	for (int i = 0; i < s_nglyphs; i++) {
+		glyph_t *g = &s_glyph[i];
+		int x1 = g->width, y1 = g->height, x2 = -1, y2 = -1;
+
+		for (int y = 0; y < g->height; y++) {
+			for (int x = 0; x < g->width; x++) {
+				uint8_t *p = &g->pixels[(y * g->width) + x];
+				*p = ((*p * max) + 127) / 255;
+				if (*p) {
+					if (x < x1) x1 = x;
+					if (x > x2) x2 = x;
+					if (y < y1) y1 = y;
+					if (y > y2) y2 = y;
+				}
+			}
+		}
+		if (x2 < 0) {
+			// no visible pixels
+			g->width = 0;
+			g->height = 0;
+			g->top = 0;
+			continue;
+		}
+		int width = x2 - x1 + 1;
+		int height = y2 - y1 + 1;
+		if ((width != g->width) || (height != g->height)) {
+			for (int y = 0; y < height; y++) {
+				memmove(g->pixels + (y * width), g->pixels + ((y + y1) * g->width) + x1, width);
+			}
+			g->left += x1;
+			g->top -= y1;
+			g->width = width;
+			g->height = height;
+		}
+	}
+}
+
+// Calculate the font height, baseline and max character width
+//-----------------------
+static int font_metrics()
+{
+	int descent = 0;
+	int visible = 0;
+
+	s_ascent = 0;
+	s_maxWidth = 0;
+	for (int i = 0; i < s_nglyphs; i++) {
+		glyph_t *g = &s_glyph[i];
+		if (g->width) {
+			if ((!visible) || (g->top > s_ascent)) s_ascent = g->top;
+			if ((!visible) || ((g->height - g->top) > descent)) descent = g->height - g->top;
+			visible = 1;
+		}
+	}
+	s_ySize = s_ascent + descent;
+	if (s_ySize <= 0) s_ySize = 1;
+
+	for (int i = 0; i < s_nglyphs; i++) {
+		glyph_t *g = &s_glyph[i];
+		if (g->advance < 0) g->advance = 0;
+		if (g->width > s_maxWidth) s_maxWidth = g->width;
+		if (g->advance > s_maxWidth) s_maxWidth = g->advance;
+		if ((g->width > 255) || (g->height > 255) || (g->advance > 255) || (g->left < -127) || (g->left > 127)) {
+			fprintf(stderr, "Character 0x%04X is too large\n", g->code);
+			return 0;
+		}
+	}
+	if (s_ySize > 255) {
+		fprintf(stderr, "Font height %d is too large\n", s_ySize);
+		return 0;
+	}
+	return 1;
+}
+
+// ==== Font data ====
+
+// Write 'n' low bits of 'val' MSB first at bit position 'pos' of the zeroed buffer 'dst'
+//---------------------------------------------------------------
+static void put_bits(uint8_t *dst, int *pos, uint16_t val, int n)
+{
+	while (n--) {
+		if ((val >> n) & 1) dst[*pos / 8] |= 0x80 >> (*pos % 8);
+		(*pos)++;
+	}
+}
+
+// Code the length of a run of glyph pixels
+// The first run length is coded as is (it can be 0), other run lengths as length-1
+//-------------------------------------------------------------
+static void put_run(uint8_t *dst, int *pos, int len, int first)
+{
+	if (!first) len--;
+	while (len >= GLYPH_RUN_CODE_MAX) {
+		put_bits(dst, pos, 0xE0 | (GLYPH_RUN_CODE_MAX - 14), 8);
+		len -= GLYPH_RUN_CODE_MAX;
+	}
+	if (len < 2) put_bits(dst, pos, len, 2);
+	else if (len < 6) put_bits(dst, pos, 0x08 | (len - 2), 4);
+	else if (len < 14) put_bits(dst, pos, 0x30 | (len - 6), 6);
+	else put_bits(dst, pos, 0xE0 | (len - 14), 8);
+}
+
+// Add glyph pixels, packed MSB first or run-length coded
+//------------------------------------------------------------------
+static void put_glyph_data(buffer_t *buf, const glyph_t *g, int rle)
+{
+	int npixels = g->width * g->height;
+	if (npixels == 0) return;
+
+	// pixel runs take at most 2 bits per pixel
+	uint8_t *data = xrealloc(NULL, (npixels * 2) + 8);
+	memset(data, 0, (npixels * 2) + 8);
+	int pos = 0;
+
+	if (rle) {
+		// alternating runs, starting with background; the last run is also coded
+		int len = 0;
+		int first = 1;
+		uint8_t value = 0;
+		for (int n = 0; n < npixels; n++) {
+			if (g->pixels[n] != value) {
+				put_run(data, &pos, len, first);
+				value = g->pixels[n];
+				len = 0;
+				first = 0;
+			}
+			len++;
+		}
+		if (len) put_run(data, &pos, len, first);
+	}
+	else {
+		for (int n = 0; n < npixels; n++) put_bits(data, &pos, g->pixels[n], s_bpp);
+	}
+
+	for (int n = 0; n < ((pos + 7) / 8); n++) buf_put(buf, data[n]);
+	free(data);
+}
+
+// Create the proportional font
+// 'recptr' receives the offsets of glyph records
+//---------------------------------------------------------------------
+static void make_proportional(buffer_t *buf, int rle, uint32_t *recptr)
+{
+	uint8_t format = (rle) ? GLYPH_FORMAT_RLE : ((s_bpp == 1) ? 0 : s_bpp);
+
+	buf->len = 0;
+	buf_put(buf, 0);
+	buf_put(buf, s_ySize);
+	if (s_unicode) {
+		// glyphs are found in the code point table, the font metrics are precomputed
+		buf_put(buf, format | GLYPH_FORMAT_UNICODE | GLYPH_FORMAT_METRICS);
+		buf_put(buf, s_maxWidth);
+		buf_put(buf, s_nglyphs & 0xFF);
+		buf_put(buf, s_nglyphs >> 8);
+		for (int i = 0; i < (s_nglyphs * FONT_UNICODE_ENTRY); i++) buf_put(buf, 0);
+	}
+	else {
+		buf_put(buf, format);
+		buf_put(buf, 0);
+	}
+
+	for (int i = 0; i < s_nglyphs; i++) {
+		const glyph_t *g = &s_glyph[i];
+		recptr[i] = buf->len;
+		if (s_unicode) {
+			// code point table entry
+			buf->len = 6 + (i * FONT_UNICODE_ENTRY);
+			buf_put24(buf, g->code);
+			buf_put24(buf, recptr[i]);
+			buf->len = recptr[i];
+		}
+		buf_put(buf, (s_unicode) ? 0 : g->code);
+		buf_put(buf, (g->width) ? (s_ascent - g->top) : 0);
+		buf_put(buf, g->width);
+		buf_put(buf, g->height);
+		buf_put(buf, (g->left < 0) ? (0xFF + g->left) : g->left);
+		buf_put(buf, g->advance);
+		put_glyph_data(buf, g, rle);
+	}
+	buf_put(buf, 0xFF);
+}
+
+// Create the fixed width font
+// Characters from the first to the last code are included, missing characters are blank
+//-----------------------------------
+static void make_fixed(buffer_t *buf)
+{
+	uint32_t first = s_glyph[0].code;
+	uint32_t last = s_glyph[s_nglyphs-1].code;
+	int min_left = 0;
+	int x_size = 0;
+
+	for (int i = 0; i < s_nglyphs; i++) {
+		if (s_glyph[i].left < min_left) min_left = s_glyph[i].left;
+	}
+	for (int i = 0; i < s_nglyphs; i++) {
+		const glyph_t *g = &s_glyph[i];
+		if ((g->left - min_left + g->width) > x_size) x_size = g->left - min_left + g->width;
+		if (g->advance > x_size) x_size = g->advance;
+	}
+	if (x_size == 0) x_size = 1;
+	s_maxWidth = x_size;
+	int fz = (x_size + 7) / 8;
+
+	buf->len = 0;
+	buf_put(buf, x_size);
+	buf_put(buf, s_ySize);
+	buf_put(buf, first);
+	buf_put(buf, last - first + 1);
+
+	int i = 0;
+	uint8_t *cell = xrealloc(NULL, fz * s_ySize);
+	for (uint32_t code = first; code <= last; code++) {
+		memset(cell, 0, fz * s_ySize);
+		if (s_glyph[i].code == code) {
+			const glyph_t *g = &s_glyph[i++];
+			for (int y = 0; y < g->height; y++) {
+				for (int x = 0; x < g->width; x++) {
+					if (g->pixels[(y * g->width) + x] == 0) continue;
+					int cx = g->left - min_left + x;
+					int cy = s_ascent - g->top + y;
+					cell[(cy * fz) + (cx / 8)] |= 0x80 >> (cx % 8);
+				}
+			}
+		}
+		for (int n = 0; n < (fz * s_ySize); n++) buf_put(buf, cell[n]);
+	}
+	free(cell);
+}
+
+// ==== Output files ====
+
+// Comment naming the character
+//-------------------------------------------------------------
+static void char_comment(char *str, size_t size, uint32_t code)
+{
+	if ((code > 0x20) && (code < 0x7F)) snprintf(str, size, "// '%c'", code);
+	else if (code == 0x20) snprintf(str, size, "// <space>");
+	else snprintf(str, size, "// U+%04X", code);
+}
+
+//-------------------------------------------------------------------------------------
+static void put_hex_line(FILE *f, const uint8_t *data, int len, int per_line, int last)
+{
+	for (int n = 0; n < len; n++) {
+		fprintf(f, "0x%02X", data[n]);
+		if ((n < (len - 1)) || (!last)) fprintf(f, ",");
+		if ((((n + 1) % per_line) == 0) || (n == (len - 1))) fprintf(f, "\n");
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------
+static int write_source(const char *fname, const buffer_t *buf, const uint32_t *recptr, int rle, const char *src)
+{
+	char comment[32];
+	FILE *f = fopen(fname, "w");
+	if (f == NULL) return 0;
+
+	fprintf(f, "// %s\n", strrchr(fname, '/') ? strrchr(fname, '/') + 1 : fname);
+	fprintf(f, "// Font         : %s\n", s_family);
+	fprintf(f, "// Source       : %s\n", strrchr(src, '/') ? strrchr(src, '/') + 1 : src);
+	if (!s_bdf) fprintf(f, "// Pixel size   : %d\n", s_size);
+	if (s_fixed) {
+		fprintf(f, "// Font type    : fixed width, %dx%d pixels\n", buf->data[0], buf->data[1]);
+	}
+	else {
+		fprintf(f, "// Font type    : proportional, %d bit%s per pixel%s%s\n", s_bpp, (s_bpp > 1) ? "s" : "",
+				(rle) ? ", run-length coded" : "", (s_unicode) ? ", Unicode" : "");
+		fprintf(f, "// Font height  : %d, max width: %d\n", s_ySize, s_maxWidth);
+	}
+	fprintf(f, "// Memory usage : %d bytes\n", buf->len);
+	fprintf(f, "// # characters : %d\n", (s_fixed) ? buf->data[3] : s_nglyphs);
+	fprintf(f, "// Created with mkfont " VERSION "\n\n");
+
+	fprintf(f, "const unsigned char tft_%s[] =\n{\n", s_name);
+	if (s_fixed) {
+		int csize = ((buf->data[0] + 7) / 8) * buf->data[1];
+		put_hex_line(f, buf->data, 4, 4, 0);
+		for (int n = 0; n < buf->data[3]; n++) {
+			const uint8_t *cell = buf->data + 4 + (n * csize);
+			char_comment(comment, sizeof(comment), buf->data[2] + n);
+			for (int i = 0; i < csize; i++) {
+				fprintf(f, "0x%02X%s", cell[i], ((i < (csize - 1)) || (n < (buf->data[3] - 1))) ? "," : "");
+			}
+			fprintf(f, "  %s\n", comment);
+		}
+	}
+	else {
+		int ptr = (s_unicode) ? 6 : 4;
+		put_hex_line(f, buf->data, ptr, ptr, 0);
+		if (s_unicode) {
+			fprintf(f, "\n// Code point table\n");
+			for (int i = 0; i < s_nglyphs; i++) {
+				char_comment(comment, sizeof(comment), s_glyph[i].code);
+				for (int n = 0; n < FONT_UNICODE_ENTRY; n++) fprintf(f, "0x%02X,", buf->data[ptr++]);
+				fprintf(f, "  %s\n", comment);
+			}
+		}
+		for (int i = 0; i < s_nglyphs; i++) {
+			int end = (i < (s_nglyphs - 1)) ? recptr[i+1] : (buf->len - 1);
+			char_comment(comment, sizeof(comment), s_glyph[i].code);
+			fprintf(f, "\n%s\n", comment);
+			put_hex_line(f, buf->data + recptr[i], 6, 6, 0);
+			put_hex_line(f, buf->data + recptr[i] + 6, end - recptr[i] - 6, 24, 0);
+		}
+		fprintf(f, "\n// Terminator\n0xFF\n");
+	}
+	fprintf(f, "};\n");
+
+	int res = (ferror(f) == 0);
+	fclose(f);
+	return res;
+}
+
+//----------------------------------------------------------------
+static int write_font_file(const char *fname, const buffer_t *buf)
+{
+	FILE *f = fopen(fname, "wb");
+	if (f == NULL) return 0;
+	int res = ((fwrite(buf->data, 1, buf->len, f) == buf->len) && (fwrite("RPH_font", 1, 8, f) == 8));
+	if (fclose(f) != 0) res = 0;
+	return res;
+}
+
+// Default font name from the font file name and size
+//---------------------------------------------------
+static char *default_name(const char *fname, int ttf)
+{
+	const char *base = strrchr(fname, '/');
+	base = (base) ? (base + 1) : fname;
+	char *name = xrealloc(NULL, strlen(base) + 16);
+	int len = 0;
+	for (const char *p = base; (*p) && (*p != '.'); p++) {
+		name[len++] = (isalnum((unsigned char)*p)) ? *p : '_';
+	}
+	name[len] = '\0';
+	if (ttf) sprintf(name+len, "%d", s_size);
+	return name;
+}
+
+//=============================
+int main(int argc, char **argv)
+{
+	int opt;
+	buffer_t font = {NULL, 0, 0};
+	buffer_t coded = {NULL, 0, 0};
+	uint32_t *recptr = NULL;
+	int rle = 0;
+
+	while ((opt = getopt(argc, argv, "s:r:b:cufn:o:vh")) != -1) {
+		switch (opt) {
+			case 's':
+				s_size = atoi(optarg);
+				break;
+			case 'r':
+				if (!parse_ranges(optarg)) {
+					fprintf(stderr, "Wrong character range '%s'\n", optarg);
+					return 1;
+				}
+				break;
+			case 'b':
+				s_bpp = atoi(optarg);
+				break;
+			case 'c':
+				s_rle = 1;
+				break;
+			case 'u':
+				s_unicode = 1;
+				break;
+			case 'f':
+				s_fixed = 1;
+				break;
+			case 'n':
+				s_name = optarg;
+				break;
+			case 'o':
+				s_outBase = optarg;
+				break;
+			case 'v':
+				s_verbose = 1;
+				break;
+			default:
+				usage();
+				return (opt == 'h') ? 0 : 1;
+		}
+	}
+	if (optind != (argc - 1)) {
+		usage();
+		return 1;
+	}
+	const char *fname = argv[optind];
+	size_t flen = strlen(fname);
+	s_bdf = ((flen > 4) && (strcasecmp(fname + flen - 4, ".bdf") == 0));
+
+	if ((s_size < 4) || (s_size > 255)) {
+		fprintf(stderr, "Font size must be 4~255\n");
+		return 1;
+	}
+	if ((s_bpp != 1) && (s_bpp != 2) && (s_bpp != 4)) {
+		fprintf(stderr, "Bits per pixel must be 1, 2 or 4\n");
+		return 1;
+	}
+	if ((s_bdf) && (s_bpp != 1)) {
+		fprintf(stderr, "BDF fonts are 1 bit per pixel\n");
+		return 1;
+	}
+	if ((s_rle) && (s_bpp != 1)) {
+		fprintf(stderr, "Only 1-bit fonts can be run-length coded\n");
+		return 1;
+	}
+	if ((s_fixed) && ((s_bpp != 1) || (s_rle) || (s_unicode))) {
+		fprintf(stderr, "Fixed width font is 1-bit, not coded and not Unicode\n");
+		return 1;
+	}
+	if (s_nranges == 0) parse_ranges("32-126");
+
+	// === Load the glyphs ===
+	if (s_bdf) {
+		if (!load_bdf(fname)) return 1;
+	}
+	else {
+#ifdef MKFONT_NO_FREETYPE
+		fprintf(stderr, "mkfont is built without FreeType, only BDF fonts are supported\n");
+		return 1;
+#else
+		if (!load_freetype(fname)) return 1;
+#endif
+	}
+	if (s_nglyphs == 0) {
+		fprintf(stderr, "No characters found\n");
+		return 1;
+	}
+	qsort(s_glyph, s_nglyphs, sizeof(glyph_t), compare_glyphs);
+
+	if (s_glyph[s_nglyphs-1].code > 0xFE) {
+		if (s_fixed) {
+			fprintf(stderr, "Fixed width font can have code points up to 255\n");
+			return 1;
+		}
+		s_unicode = 1;
+	}
+	if (s_nglyphs > FONT_MAX_GLYPHS) {
+		fprintf(stderr, "Too many characters\n");
+		return 1;
+	}
+	if ((s_fixed) && ((s_glyph[s_nglyphs-1].code - s_glyph[0].code) > 254)) {
+		fprintf(stderr, "Fixed width font can have up to 255 characters\n");
+		return 1;
+	}
+
+	quantize_glyphs();
+	if (!font_metrics()) return 1;
+
+	// === Create the font ===
+	if (s_fixed) make_fixed(&font);
+	else {
+		recptr = xrealloc(NULL, s_nglyphs * sizeof(uint32_t));
+		make_proportional(&font, 0, recptr);
+		if (s_rle) {
+			// use run-length coded glyphs if the font becomes smaller
+			uint32_t *rle_recptr = xrealloc(NULL, s_nglyphs * sizeof(uint32_t));
+			make_proportional(&coded, 1, rle_recptr);
+			if (s_verbose) printf("Run-length coded font: %d -> %d bytes\n", font.len, coded.len);
+			if (coded.len < font.len) {
+				buffer_t tmp = font;
+				font = coded;
+				coded = tmp;
+				free(recptr);
+				recptr = rle_recptr;
+				rle = 1;
+			}
+			else free(rle_recptr);
+		}
+	}
+
+	// === Write the output files ===
+	if (s_name == NULL) s_name = default_name(fname, !s_bdf);
+	if (s_outBase == NULL) s_outBase = s_name;
+	char *outname = xrealloc(NULL, strlen(s_outBase) + 8);
+
+	sprintf(outname, "%s.c", s_outBase);
+	if (!write_source(outname, &font, recptr, rle, fname)) {
+		fprintf(stderr, "Error writing '%s'\n", outname);
+		return 1;
+	}
+	sprintf(outname, "%s.fon", s_outBase);
+	if (!write_font_file(outname, &font)) {
+		fprintf(stderr, "Error writing '%s'\n", outname);
+		return 1;
+	}
+
+	if (s_verbose) {
+		printf("%s: %s\n", s_name, s_family);
+		printf("  %s font, %d characters (0x%04X~0x%04X), height: %d, max width: %d, size: %d bytes\n",
+				(s_fixed) ? "Fixed width" : ((s_unicode) ? "Unicode proportional" : "Proportional"),
+				s_nglyphs, s_glyph[0].code, s_glyph[s_nglyphs-1].code, s_ySize, s_maxWidth, font.len);
+	}
+
+	free(outname);
+	if (recptr) free(recptr);
+	if (font.data) free(font.data);
+	if (coded.data) free(coded.data);
+	for (int i = 0; i < s_nglyphs; i++) {
+		if (s_glyph[i].pixels) free(s_glyph[i].pixels);
+	}
+	free(s_glyph);
+	return 0;
+}
@@ -0,0 +1,6 @@
+#
+# Component Makefile
+#
+
+COMPONENT_SRCDIRS := 
+COMPONENT_ADD_INCLUDEDIRS := 
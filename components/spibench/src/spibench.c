@@ -0,0 +1,268 @@
+//
+//  spibench.c
+//  Host benchmark of the direct send color packing of the ESP32 TFT library
+//
+//  Measures the time needed to pack colors into the SPI data buffer,
+//  as done by _direct_send() in components/tft/tftspi.c, with the per color
+//  packing used before and with the packing specialized per transfer.
+//  The SPI registers are emulated in memory, only the packing is measured.
+//  Both packings are checked to give the same SPI data before measuring.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define VERSION "1.0.0"
+
+#define MAX_COLORS		21		// colors fitting the 512 bits SPI data buffer
+
+// RGB to GRAYSCALE constants, as in tftspi.c
+#define GS_FACT_R 0.2989
+#define GS_FACT_G 0.4870
+#define GS_FACT_B 0.2140
+
+typedef struct __attribute__((__packed__)) {
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+} color_t;
+
+// Emulated SPI registers used by the direct send
+typedef struct {
+	volatile uint32_t usr;
+	volatile uint32_t usr_mosi_dbitlen;
+	volatile uint32_t data_buf[16];
+} spi_regs_t;
+
+static spi_regs_t spi_hw;
+static uint8_t gray_scale = 0;
+
+static uint16_t gs_lut_r[256];
+static uint16_t gs_lut_g[256];
+static uint16_t gs_lut_b[256];
+
+//------------------------
+static void _gs_lut_init()
+{
+	for (int i=0; i<256; i++) {
+		gs_lut_r[i] = (uint16_t)(GS_FACT_R * i * 256);
+		gs_lut_g[i] = (uint16_t)(GS_FACT_G * i * 256);
+		gs_lut_b[i] = (uint16_t)(GS_FACT_B * i * 256);
+	}
+}
+
+//------------------------------------
+static color_t color2gs(color_t color)
+{
+	color_t _color;
+	uint32_t gs_clr = (gs_lut_r[color.r] + gs_lut_g[color.g] + gs_lut_b[color.b]) >> 8;
+	if (gs_clr > 255) gs_clr = 255;
+
+	_color.r = gs_clr;
+	_color.g = gs_clr;
+	_color.b = gs_clr;
+
+	return _color;
+}
+
+// Packing used before, 'rep' and gray_scale are tested for each color
+//---------------------------------------------------------------------
+static void _old_direct_send(color_t *color, uint32_t len, uint8_t rep)
+{
+	uint32_t cidx = 0;
+	uint32_t wd = 0;
+	int idx = 0;
+	int bits = 0;
+	int wbits = 0;
+	uint8_t comp[3];
+
+	color_t _color = color[0];
+	if ((rep) && (gray_scale)) _color = color2gs(color[0]);
+
+	while (len) {
+		if (rep == 0) {
+			if (gray_scale) _color = color2gs(color[cidx]);
+			else _color = color[cidx];
+		}
+		comp[0] = _color.r;
+		comp[1] = _color.g;
+		comp[2] = _color.b;
+		for (int i=0; i<3; i++) {
+			wd |= (uint32_t)comp[i] << wbits;
+			wbits += 8;
+			if (wbits == 32) {
+				bits += wbits;
+				wbits = 0;
+				spi_hw.data_buf[idx++] = wd;
+				wd = 0;
+			}
+		}
+		len--;
+		if (rep == 0) cidx++;
+	}
+	if (bits) {
+		while (spi_hw.usr);
+		spi_hw.usr_mosi_dbitlen = bits-1;
+		spi_hw.usr = 0;		// the emulated transfer is finished at once
+	}
+}
+
+// Packing specialized per transfer, the same as _pack_send() in tftspi.c
+//-------------------------------------------------------------------------------------------------------------------------------
+static inline __attribute__((always_inline)) void _pack_send(color_t *color, uint32_t len, const uint8_t rep, const uint8_t gray)
+{
+	uint32_t wd[16];
+	uint8_t *dest = (uint8_t *)wd;
+	int nbytes = len * sizeof(color_t);
+
+	if (rep) {
+		int n = (len > 4) ? 4 : len;
+		for (int i=0; i<n; i++, dest += 3) {
+			dest[0] = color->r;
+			dest[1] = color->g;
+			dest[2] = color->b;
+		}
+		for (int i=3; i<((nbytes + 3) / 4); i++) wd[i] = wd[i-3];
+	}
+	else if (gray) {
+		for (int i=0; i<len; i++, dest += 3) {
+			color_t _color = color2gs(color[i]);
+			dest[0] = _color.r;
+			dest[1] = _color.g;
+			dest[2] = _color.b;
+		}
+	}
+	else memcpy(dest, color, nbytes);
+
+	while (spi_hw.usr);
+	for (int i=0; i<((nbytes + 3) / 4); i++) {
+		spi_hw.data_buf[i] = wd[i];
+	}
+	spi_hw.usr_mosi_dbitlen = (nbytes * 8) - 1;
+	spi_hw.usr = 0;
+}
+
+//-----------------------------------------------------------------
+static void _direct_send(color_t *color, uint32_t len, uint8_t rep)
+{
+	if (rep) {
+		color_t _color = (gray_scale) ? color2gs(color[0]) : color[0];
+		_pack_send(&_color, len, 1, 0);
+	}
+	else if (gray_scale) _pack_send(color, len, 0, 1);
+	else _pack_send(color, len, 0, 0);
+}
+
+//---------------------
+static double _now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// Check that both packings give the same data words for all transfer lengths
+// The old packing did not send a trailing partial word, so only full words are compared
+//--------------------------------
+static int _check(color_t *colors)
+{
+	int bad = 0;
+	uint32_t old_buf[16];
+
+	for (int gray=0; gray<2; gray++) {
+		gray_scale = gray;
+		for (int rep=0; rep<2; rep++) {
+			for (int len=1; len<=MAX_COLORS; len++) {
+				memset((void *)spi_hw.data_buf, 0, sizeof(spi_hw.data_buf));
+				_old_direct_send(colors, len, rep);
+				memcpy(old_buf, (void *)spi_hw.data_buf, sizeof(old_buf));
+				int words = (len * 3) / 4;
+
+				memset((void *)spi_hw.data_buf, 0, sizeof(spi_hw.data_buf));
+				_direct_send(colors, len, rep);
+				if (memcmp(old_buf, (void *)spi_hw.data_buf, words * 4) != 0) {
+					fprintf(stderr, "Data differs: gray=%d rep=%d len=%d\n", gray, rep, len);
+					bad++;
+				}
+				if (spi_hw.usr_mosi_dbitlen != (len * 24) - 1) {
+					fprintf(stderr, "Wrong bit count: gray=%d rep=%d len=%d\n", gray, rep, len);
+					bad++;
+				}
+			}
+		}
+	}
+	gray_scale = 0;
+	return bad;
+}
+
+//---------------------------
+static void usage(char *name)
+{
+	printf("spibench v%s, direct send color packing benchmark\n\n", VERSION);
+	printf("Usage: %s [-n transfers] [-l colors]\n", name);
+	printf("  -n  number of transfers measured in each mode (default 1000000)\n");
+	printf("  -l  colors in each transfer, 1 ~ %d (default 20)\n", MAX_COLORS);
+}
+
+//==============================
+int main(int argc, char *argv[])
+{
+	int transfers = 1000000;
+	int len = 20;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:l:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				transfers = atoi(optarg);
+				break;
+			case 'l':
+				len = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+		}
+	}
+	if ((transfers <= 0) || (len < 1) || (len > MAX_COLORS)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	_gs_lut_init();
+	color_t colors[MAX_COLORS];
+	for (int i=0; i<MAX_COLORS; i++) {
+		colors[i].r = i * 11;
+		colors[i].g = i * 7 + 3;
+		colors[i].b = 255 - i * 5;
+	}
+
+	if (_check(colors)) {
+		fprintf(stderr, "Packing check failed\n");
+		return 2;
+	}
+
+	static const char *modes[3] = { "color", "repeated color", "gray scale" };
+	printf("%d transfers of %d colors\n", transfers, len);
+	printf("%-16s %10s %10s\n", "mode", "old ns/px", "new ns/px");
+	for (int mode=0; mode<3; mode++) {
+		uint8_t rep = (mode == 1);
+		gray_scale = (mode == 2);
+
+		double t0 = _now_ns();
+		for (int i=0; i<transfers; i++) _old_direct_send(colors, len, rep);
+		double t1 = _now_ns();
+		for (int i=0; i<transfers; i++) _direct_send(colors, len, rep);
+		double t2 = _now_ns();
+
+		double pixels = (double)transfers * len;
+		printf("%-16s %10.2f %10.2f\n", modes[mode], (t1 - t0) / pixels, (t2 - t1) / pixels);
+	}
+	gray_scale = 0;
+
+	return 0;
+}
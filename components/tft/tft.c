@@ -11,6 +11,7 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_system.h"
 #include "tft.h"
 #include "time.h"
@@ -22,6 +23,8 @@
 
 #define DEG_TO_RAD 0.01745329252
 #define RAD_TO_DEG 57.295779513
+// Blend two color components, 'alpha' 0~256
+#define BLEND_COMP(src, dst, alpha) ((uint8_t)((((src) * (alpha)) + ((dst) * (256 - (alpha)))) >> 8))
 #define deg_to_rad 0.01745329252 + 3.14159265359
 #define swap(a, b) { int16_t t = a; a = b; b = t; }
 #define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
@@ -68,60 +71,161 @@ const color_t TFT_PINK        = { 252, 192, 202 };
 // ==============================================================
 // ==== Set default values of global variables ==================
 uint8_t orientation = LANDSCAPE;// screen orientation
-uint16_t font_rotate = 0;		// font rotation
-uint8_t	font_transparent = 0;
-uint8_t	font_forceFixed = 0;
-uint8_t	text_wrap = 0;			// character wrapping to new line
-color_t	_fg = {  0, 255,   0};
-color_t _bg = {  0,   0,   0};
 uint8_t image_debug = 0;
 
-float _angleOffset = DEFAULT_ANGLE_OFFSET;
-
-int	TFT_X = 0;
-int	TFT_Y = 0;
-
 uint32_t tp_calx = 7472920;
 uint32_t tp_caly = 122224794;
 
-dispWin_t dispWin = {
-  .x1 = 0,
-  .y1 = 0,
-  .x2 = DEFAULT_TFT_DISPLAY_WIDTH,
-  .y2 = DEFAULT_TFT_DISPLAY_HEIGHT,
-};
-
-Font cfont = {
-	.font = tft_DefaultFont,
-	.x_size = 0,
-	.y_size = 0x0B,
+// Default drawing context
+static tft_ctx_t tft_ctx_default = {
+	.rotate = 0,				// font rotation
+	.transparent = 0,
+	.force_fixed = 0,
+	.buffered_char = 1,
+	.transparent_rb = 0,
+	.line_space = 0,
+	.wrap = 0,					// character wrapping to new line
+	.utf8 = 0,
+	.fg = {  0, 255,   0},
+	.bg = {  0,   0,   0},
+	.win = {
+		.x1 = 0,
+		.y1 = 0,
+		.x2 = DEFAULT_TFT_DISPLAY_WIDTH,
+		.y2 = DEFAULT_TFT_DISPLAY_HEIGHT,
+	},
+	.angle_offset = DEFAULT_ANGLE_OFFSET,
+	.font = {
+		.font = tft_DefaultFont,
+		.x_size = 0,
+		.y_size = 0x0B,
+		.offset = 0,
+		.numchars = 95,
+		.bitmap = 1,
+		.bpp = 1,
+		.rle = 0,
+		.paged = 0,
+		.unicode = 0,
+	},
+	.x = 0,
+	.y = 0,
 	.offset = 0,
-	.numchars = 95,
-	.bitmap = 1,
+	.aa_bpp = 0,
+	.glyph_data = NULL,
+	.glyph_data_size = 0,
 };
 
-uint8_t font_buffered_char = 1;
-uint8_t font_line_space = 0;
+// Drawing context used by each core
+tft_ctx_t *tft_ctx[portNUM_PROCESSORS] = { [0 ... portNUM_PROCESSORS-1] = &tft_ctx_default };
 // ==============================================================
 
+#define dispWinTemp	(TFT_CTX->win_temp)
+#define TFT_OFFSET	(TFT_CTX->offset)
+#define fontChar	(TFT_CTX->prop_char)
+#define dispWinFb	(TFT_CTX->win_fb)		// clip window saved while drawing to frame buffer
+#define fb_is_canvas (TFT_CTX->fb_canvas)	// active frame buffer is the user's canvas
 
-typedef struct {
-      uint8_t charCode;
-      int adjYOffset;
-      int width;
-      int height;
-      int xOffset;
-      int xDelta;
-      uint16_t dataPtr;
-} propFont;
-
-static dispWin_t dispWinTemp;
-
-static uint8_t *userfont = NULL;
-static int TFT_OFFSET = 0;
-static propFont	fontChar;
 static float _arcAngleMax = DEFAULT_ARC_ANGLE_MAX;
 
+// Glyph index of the proportional font, built once for each used font
+// The least recently used index is rebuilt for a new font when all slots are used;
+// slots are never freed, the font referencing a slot is checked when the index is used
+#define FONT_INDEX_CACHE_SIZE	12
+
+typedef struct fontIndex_s {
+	uint8_t		*font;			// font the index is built for, NULL if the slot is free or being rebuilt
+	uint8_t		building;		// index is being built outside the critical section
+	uint32_t	last_used;		// LRU stamp
+	uint16_t	numchars;
+	uint32_t	size;
+	uint8_t		max_x_size;
+	uint8_t		y_size;
+	uint32_t	offset[256];	// offset of each character's glyph data, 0 if not in the font
+} fontIndex;
+
+static fontIndex *font_index[FONT_INDEX_CACHE_SIZE] = { NULL };
+static uint32_t font_index_clock = 0;
+static portMUX_TYPE font_index_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Rendered glyph cache, character cells already expanded to display colors
+// Entries are kept in the LRU list, the most recently used one first, and found by font and character in the hash table
+// An entry is pinned while its pixels are copied outside the critical section; an entry removed while pinned
+// is freed when it is unpinned
+#define GLYPH_CACHE_HASH_SIZE	64
+
+typedef struct glyphCacheEntry {
+	struct glyphCacheEntry	*prev;	// more recently used entry
+	struct glyphCacheEntry	*next;	// less recently used entry
+	struct glyphCacheEntry	*hnext;	// next entry in the hash table bucket
+	uint8_t		*font;			// font the glyph is rendered from
+	uint32_t	c;				// character code
+	uint8_t		force_fixed;	// 'font_forceFixed' the glyph is rendered with
+	color_t		fg;
+	color_t		bg;
+	uint16_t	width;			// character cell width
+	uint16_t	height;			// character cell height
+	uint32_t	size;			// size of the entry in bytes
+	uint16_t	pins;			// number of copies in progress
+	uint8_t		removed;		// removed from cache while pinned, freed by the last unpin
+	color_t		*pixels;		// width * height pixels
+} glyphCacheEntry;
+
+static glyphCacheEntry *glyph_cache_hash[GLYPH_CACHE_HASH_SIZE] = { NULL };
+static glyphCacheEntry *glyph_cache_first = NULL;
+static glyphCacheEntry *glyph_cache_last = NULL;
+static uint32_t glyph_cache_budget = GLYPH_CACHE_SIZE;
+static uint32_t glyph_cache_used = 0;
+static uint32_t glyph_cache_hits = 0;
+static uint32_t glyph_cache_misses = 0;
+static portMUX_TYPE glyph_cache_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Proportional font file opened by load_file_font()
+// Only the font header, code point table and glyph records without glyph data are loaded to memory,
+// glyph data is read from the file
+typedef struct {
+	FILE				*fhndl;
+	SemaphoreHandle_t	mutex;			// file access from both cores
+	uint32_t			nglyphs;		// number of glyph records
+	uint32_t			*offset;		// file offset of each glyph record's data
+	uint16_t			*size;			// glyph data size of each glyph record
+} fontFile;
+
+// Font loaded from file with TFT_setFont(), referenced by the drawing contexts which loaded it
+// or were created from them; it is freed with its font file when the last reference is released
+typedef struct userFont_s {
+	uint8_t		*font;			// fixed width font, or the header and glyph records of the proportional font
+	fontFile	*ff;			// open file of the proportional font, NULL if the whole font is in memory
+	uint32_t	refs;			// number of contexts referencing the font
+} userFont;
+
+static portMUX_TYPE user_font_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Glyph data read from the font file
+// Entries are kept in the LRU list, the most recently used one first, and found by font file and glyph in the hash table
+// As in the glyph cache, an entry is pinned while its data is copied outside the critical section
+#define FONT_PAGE_HASH_SIZE		32
+
+typedef struct fontPageEntry {
+	struct fontPageEntry	*prev;	// more recently used entry
+	struct fontPageEntry	*next;	// less recently used entry
+	struct fontPageEntry	*hnext;	// next entry in the hash table bucket
+	fontFile	*ff;			// font file the glyph data is read from
+	uint32_t	glyph;			// glyph record number
+	uint32_t	size;			// size of the entry in bytes
+	uint16_t	pins;			// number of copies in progress
+	uint8_t		removed;		// removed from cache while pinned, freed by the last unpin
+	uint8_t		*data;			// glyph data
+} fontPageEntry;
+
+static fontPageEntry *font_page_hash[FONT_PAGE_HASH_SIZE] = { NULL };
+static fontPageEntry *font_page_first = NULL;
+static fontPageEntry *font_page_last = NULL;
+static uint32_t font_page_budget = FONT_PAGE_CACHE_SIZE;
+static uint32_t font_page_used = 0;
+static uint32_t font_page_fetches = 0;
+static uint32_t font_page_misses = 0;
+static portMUX_TYPE font_page_mux = portMUX_INITIALIZER_UNLOCKED;
+
 
 // =========================================================================
 // ** All drawings are clipped to 'dispWin' **
@@ -146,10 +250,39 @@ int TFT_compare_colors(color_t c1, color_t c2)
 //------------------------------------------------------------------------
 static void _drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel) {
 
-	if ((x < dispWin.x1) || (y < dispWin.y1) || (x > dispWin.x2) || (y > dispWin.y2)) return;
+	dispWin_t *win = &dispWin;
+	if ((x < win->x1) || (y < win->y1) || (x > win->x2) || (y > win->y2)) return;
 	drawPixel(x, y, color, sel);
 }
 
+// Draw the pixel clipped to the context's window, on display or in frame buffer 'fb'
+// Used in pixel loops; the caller gets the task's context and drawing target once
+// Display must be selected
+//-------------------------------------------------------------------------------------
+static inline void _ctxPixel(tft_ctx_t *ctx, tft_fb_t *fb, int x, int y, color_t color)
+{
+	if ((x < ctx->win.x1) || (y < ctx->win.y1) || (x > ctx->win.x2) || (y > ctx->win.y2)) return;
+	if (fb) fb_drawPixel(fb, x, y, color);
+	else drawPixel(x, y, color, 0);
+}
+
+// Draw the horizontal span clipped to the context's window, on display or in frame buffer 'fb'
+// Display must be selected
+//-------------------------------------------------------------------------------------------
+static inline void _ctxSpan(tft_ctx_t *ctx, tft_fb_t *fb, int x, int y, int w, color_t color)
+{
+	if ((y < ctx->win.y1) || (y > ctx->win.y2)) return;
+	if (x < ctx->win.x1) {
+		w -= (ctx->win.x1 - x);
+		x = ctx->win.x1;
+	}
+	if ((x + w) > (ctx->win.x2+1)) w = ctx->win.x2 - x + 1;
+	if (w <= 0) return;
+
+	if (fb) fb_drawSpan(fb, x, y, w, color);
+	else drawSpan(x, y, w, color);
+}
+
 //====================================================================
 void TFT_drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel) {
 
@@ -193,6 +326,13 @@ static void _drawFastHLine(int16_t x, int16_t y, int16_t w, color_t color) {
 	TFT_pushColorRep(x, y, x+w-1, y, color, (uint32_t)w);
 }
 
+// Draw the horizontal span of 'w' pixels clipped to the clip window
+// ** Device must already be selected **
+//-------------------------------------------------------------
+static void _drawSpan(int x, int y, int w, color_t color) {
+	_ctxSpan(TFT_CTX, tft_fb, x, y, w, color);
+}
+
 //======================================================================
 void TFT_drawFastVLine(int16_t x, int16_t y, int16_t h, color_t color) {
 	_drawFastVLine(x+dispWin.x1, y+dispWin.y1, h, color);
@@ -300,9 +440,22 @@ void TFT_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, color_t color) {
 	_fillRect(x+dispWin.x1, y+dispWin.y1, w, h, color);
 }
 
+// Width and height of the current drawing area, display or frame buffer
+//-------------------------
+static int _target_width()
+{
+	return (tft_fb) ? tft_fb->width : _width;
+}
+
+//--------------------------
+static int _target_height()
+{
+	return (tft_fb) ? tft_fb->height : _height;
+}
+
 //==================================
 void TFT_fillScreen(color_t color) {
-	TFT_pushColorRep(0, 0, _width-1, _height-1, color, (uint32_t)(_height*_width));
+	TFT_pushColorRep(0, 0, _target_width()-1, _target_height()-1, color, (uint32_t)(_target_height()*_target_width()));
 }
 
 //==================================
@@ -337,6 +490,8 @@ static void drawCircleHelper(int16_t x0, int16_t y0, int16_t r, uint8_t cornerna
 	int16_t ddF_y = -2 * r;
 	int16_t x = 0;
 	int16_t y = r;
+	tft_ctx_t *ctx = TFT_CTX;
+	tft_fb_t *fb = tft_fb;
 
 	disp_select();
 	while (x < y) {
@@ -349,20 +504,20 @@ static void drawCircleHelper(int16_t x0, int16_t y0, int16_t r, uint8_t cornerna
 		ddF_x += 2;
 		f += ddF_x;
 		if (cornername & 0x4) {
-			_drawPixel(x0 + x, y0 + y, color, 0);
-			_drawPixel(x0 + y, y0 + x, color, 0);
+			_ctxPixel(ctx, fb, x0 + x, y0 + y, color);
+			_ctxPixel(ctx, fb, x0 + y, y0 + x, color);
 		}
 		if (cornername & 0x2) {
-			_drawPixel(x0 + x, y0 - y, color, 0);
-			_drawPixel(x0 + y, y0 - x, color, 0);
+			_ctxPixel(ctx, fb, x0 + x, y0 - y, color);
+			_ctxPixel(ctx, fb, x0 + y, y0 - x, color);
 		}
 		if (cornername & 0x8) {
-			_drawPixel(x0 - y, y0 + x, color, 0);
-			_drawPixel(x0 - x, y0 + y, color, 0);
+			_ctxPixel(ctx, fb, x0 - y, y0 + x, color);
+			_ctxPixel(ctx, fb, x0 - x, y0 + y, color);
 		}
 		if (cornername & 0x1) {
-			_drawPixel(x0 - y, y0 - x, color, 0);
-			_drawPixel(x0 - x, y0 - y, color, 0);
+			_ctxPixel(ctx, fb, x0 - y, y0 - x, color);
+			_ctxPixel(ctx, fb, x0 - x, y0 - y, color);
 		}
 	}
 	disp_deselect();
@@ -589,12 +744,14 @@ void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color) {
 	int ddF_y = -2 * radius;
 	int x1 = 0;
 	int y1 = radius;
+	tft_ctx_t *ctx = TFT_CTX;
+	tft_fb_t *fb = tft_fb;
 
 	disp_select();
-	_drawPixel(x, y + radius, color, 0);
-	_drawPixel(x, y - radius, color, 0);
-	_drawPixel(x + radius, y, color, 0);
-	_drawPixel(x - radius, y, color, 0);
+	_ctxPixel(ctx, fb, x, y + radius, color);
+	_ctxPixel(ctx, fb, x, y - radius, color);
+	_ctxPixel(ctx, fb, x + radius, y, color);
+	_ctxPixel(ctx, fb, x - radius, y, color);
 	while(x1 < y1) {
 		if (f >= 0) {
 			y1--;
@@ -604,14 +761,14 @@ void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color) {
 		x1++;
 		ddF_x += 2;
 		f += ddF_x;
-		_drawPixel(x + x1, y + y1, color, 0);
-		_drawPixel(x - x1, y + y1, color, 0);
-		_drawPixel(x + x1, y - y1, color, 0);
-		_drawPixel(x - x1, y - y1, color, 0);
-		_drawPixel(x + y1, y + x1, color, 0);
-		_drawPixel(x - y1, y + x1, color, 0);
-		_drawPixel(x + y1, y - x1, color, 0);
-		_drawPixel(x - y1, y - x1, color, 0);
+		_ctxPixel(ctx, fb, x + x1, y + y1, color);
+		_ctxPixel(ctx, fb, x - x1, y + y1, color);
+		_ctxPixel(ctx, fb, x + x1, y - y1, color);
+		_ctxPixel(ctx, fb, x - x1, y - y1, color);
+		_ctxPixel(ctx, fb, x + y1, y + x1, color);
+		_ctxPixel(ctx, fb, x - y1, y + x1, color);
+		_ctxPixel(ctx, fb, x + y1, y - x1, color);
+		_ctxPixel(ctx, fb, x - y1, y - x1, color);
 	}
   disp_deselect();
 }
@@ -625,19 +782,18 @@ void TFT_fillCircle(int16_t x, int16_t y, int radius, color_t color) {
 	fillCircleHelper(x, y, radius, 3, 0, color);
 }
 
-//----------------------------------------------------------------------------------------------------------------
-static void _draw_ellipse_section(uint16_t x, uint16_t y, uint16_t x0, uint16_t y0, color_t color, uint8_t option)
+// Display must be selected
+//----------------------------------------------------------------------------------------------------------------------------------------------
+static void _draw_ellipse_section(tft_ctx_t *ctx, tft_fb_t *fb, uint16_t x, uint16_t y, uint16_t x0, uint16_t y0, color_t color, uint8_t option)
 {
-	disp_select();
     // upper right
-    if ( option & TFT_ELLIPSE_UPPER_RIGHT ) _drawPixel(x0 + x, y0 - y, color, 0);
+    if ( option & TFT_ELLIPSE_UPPER_RIGHT ) _ctxPixel(ctx, fb, x0 + x, y0 - y, color);
     // upper left
-    if ( option & TFT_ELLIPSE_UPPER_LEFT ) _drawPixel(x0 - x, y0 - y, color, 0);
+    if ( option & TFT_ELLIPSE_UPPER_LEFT ) _ctxPixel(ctx, fb, x0 - x, y0 - y, color);
     // lower right
-    if ( option & TFT_ELLIPSE_LOWER_RIGHT ) _drawPixel(x0 + x, y0 + y, color, 0);
+    if ( option & TFT_ELLIPSE_LOWER_RIGHT ) _ctxPixel(ctx, fb, x0 + x, y0 + y, color);
     // lower left
-    if ( option & TFT_ELLIPSE_LOWER_LEFT ) _drawPixel(x0 - x, y0 + y, color, 0);
-	disp_deselect();
+    if ( option & TFT_ELLIPSE_LOWER_LEFT ) _ctxPixel(ctx, fb, x0 - x, y0 + y, color);
 }
 
 //=====================================================================================================
@@ -675,12 +831,16 @@ void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 
 	err = 0;
 
+	tft_ctx_t *ctx = TFT_CTX;
+	tft_fb_t *fb = tft_fb;
+	disp_select();
+
 	stopx = ryry2;
 	stopx *= rx;
 	stopy = 0;
 
 	while( stopx >= stopy ) {
-		_draw_ellipse_section(x, y, x0, y0, color, option);
+		_draw_ellipse_section(ctx, fb, x, y, x0, y0, color, option);
 		y++;
 		stopy += rxrx2;
 		err += ychg;
@@ -713,7 +873,7 @@ void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 	stopy *= ry;
 
 	while( stopx <= stopy ) {
-		_draw_ellipse_section(x, y, x0, y0, color, option);
+		_draw_ellipse_section(ctx, fb, x, y, x0, y0, color, option);
 		x++;
 		stopx += ryry2;
 		err += xchg;
@@ -725,6 +885,7 @@ void TFT_drawEllipse(uint16_t x0, uint16_t y0, uint16_t rx, uint16_t ry, color_t
 			ychg += rxrx2;
 		}
 	}
+	disp_deselect();
 }
 
 //-----------------------------------------------------------------------------------------------------------------------
@@ -842,6 +1003,8 @@ static void _fillArcOffsetted(uint16_t cx, uint16_t cy, uint16_t radius, uint16_
 
 	int ir2 = (radius - thickness) * (radius - thickness);
 	int or2 = radius * radius;
+	tft_ctx_t *ctx = TFT_CTX;
+	tft_fb_t *fb = tft_fb;
 
 	disp_select();
 	for (int x = -radius; x <= radius; x++) {
@@ -866,7 +1029,7 @@ static void _fillArcOffsetted(uint16_t cx, uint16_t cy, uint16_t radius, uint16_
 				(y == 0 && start == 0 && x > 0)
 				)
 				)
-				_drawPixel(cx+x, cy+y, color, 0);
+				_ctxPixel(ctx, fb, cx+x, cy+y, color);
 		}
 	}
 	disp_deselect();
@@ -1017,806 +1180,2074 @@ void TFT_drawStar(int cx, int cy, int diameter, color_t color, bool fill, float
 
 // ================ Font and string functions ==================================
 
+// Remove the font's glyph index from cache, the slot is reused for another font
+//----------------------------------------
+static void removeFontIndex(uint8_t *font)
+{
+	portENTER_CRITICAL(&font_index_mux);
+	for (int i=0; i<FONT_INDEX_CACHE_SIZE; i++) {
+		if ((font_index[i]) && (font_index[i]->font == font)) {
+			font_index[i]->font = NULL;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&font_index_mux);
+}
+
+// Get the glyph data offset of character 'c' from the current font's index
+// Returns the offset, 0 if the character is not in the font or -1 if the index was reused for another font
 //--------------------------------------------------------
-static int load_file_font(const char * fontfile, int info)
+static int32_t _fontIndexOffset(fontIndex *fi, uint32_t c)
 {
-	int err = 0;
-	char err_msg[256] = {'\0'};
+	int32_t offset;
 
-	if (userfont != NULL) {
-		free(userfont);
-		userfont = NULL;
-	}
+	portENTER_CRITICAL(&font_index_mux);
+	offset = (fi->font == cfont.font) ? (int32_t)fi->offset[c] : -1;
+	portEXIT_CRITICAL(&font_index_mux);
+	return offset;
+}
 
-    struct stat sb;
+// ==== Rendered glyph cache ====
+// Cache functions must be called with 'glyph_cache_mux' taken
 
-    // Open the file
-    FILE *fhndl = fopen(fontfile, "r");
-    if (!fhndl) {
-    	sprintf(err_msg, "Error opening font file '%s'", fontfile);
-		err = 1;
-		goto exit;
-    }
+// Hash table bucket of the character of the font
+//-------------------------------------------------------------------
+static glyphCacheEntry **_glyphCacheBucket(uint8_t *font, uint32_t c)
+{
+	uint32_t h = ((uint32_t)font >> 2) ^ (c * 31);
+	return &glyph_cache_hash[(h ^ (h >> 6)) % GLYPH_CACHE_HASH_SIZE];
+}
 
-	// Get file size
-    if (stat(fontfile, &sb) != 0) {
-    	sprintf(err_msg, "Error getting font file size");
-		err = 2;
-		goto exit;
-    }
-	int fsize = sb.st_size;
-	if (fsize < 30) {
-		sprintf(err_msg, "Error getting font file size");
-		err = 3;
-		goto exit;
+// Remove the entry from the LRU list and the hash table
+//-----------------------------------------------
+static void _glyphCacheUnlink(glyphCacheEntry *e)
+{
+	if (e->prev) e->prev->next = e->next;
+	else glyph_cache_first = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else glyph_cache_last = e->prev;
+	glyph_cache_used -= e->size;
+
+	glyphCacheEntry **he = _glyphCacheBucket(e->font, e->c);
+	while (*he) {
+		if (*he == e) {
+			*he = e->hnext;
+			break;
+		}
+		he = &(*he)->hnext;
 	}
+}
 
-	userfont = malloc(fsize+4);
-	if (userfont == NULL) {
-		sprintf(err_msg, "Font memory allocation error");
-		fclose(fhndl);
-		err = 4;
-		goto exit;
-	}
+// Insert the entry at the head of the LRU list, add it to the hash table
+//-----------------------------------------------
+static void _glyphCacheInsert(glyphCacheEntry *e)
+{
+	e->prev = NULL;
+	e->next = glyph_cache_first;
+	if (glyph_cache_first) glyph_cache_first->prev = e;
+	else glyph_cache_last = e;
+	glyph_cache_first = e;
+	glyph_cache_used += e->size;
+
+	glyphCacheEntry **he = _glyphCacheBucket(e->font, e->c);
+	e->hnext = *he;
+	*he = e;
+}
 
-	int read = fread(userfont, 1, fsize, fhndl);
+// Move the entry to the head of the LRU list
+//----------------------------------------------
+static void _glyphCacheTouch(glyphCacheEntry *e)
+{
+	if (e == glyph_cache_first) return;
+	e->prev->next = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else glyph_cache_last = e->prev;
+	e->prev = NULL;
+	e->next = glyph_cache_first;
+	glyph_cache_first->prev = e;
+	glyph_cache_first = e;
+}
 
-	fclose(fhndl);
+// Remove the entry from cache and add it to the 'removed' list, a pinned entry is freed by its last unpin
+//--------------------------------------------------------------------------
+static void _glyphCacheRemove(glyphCacheEntry *e, glyphCacheEntry **removed)
+{
+	_glyphCacheUnlink(e);
+	if (e->pins) {
+		e->removed = 1;
+		return;
+	}
+	e->next = *removed;
+	*removed = e;
+}
 
-	if (read != fsize) {
-		sprintf(err_msg, "Font read error");
-		err = 5;
-		goto exit;
+// Remove least recently used entries until the cache fits into 'budget' bytes
+// Returns the list of removed entries, which must be freed outside the critical section
+//-------------------------------------------------------
+static glyphCacheEntry *_glyphCacheTrim(uint32_t budget)
+{
+	glyphCacheEntry *removed = NULL;
+	while ((glyph_cache_last) && (glyph_cache_used > budget)) {
+		_glyphCacheRemove(glyph_cache_last, &removed);
 	}
+	return removed;
+}
 
-	userfont[read] = 0;
-	if (strstr((char *)(userfont+read-8), "RPH_font") == NULL) {
-		sprintf(err_msg, "Font ID not found");
-		err = 6;
-		goto exit;
+//-----------------------------------------------------
+static void _glyphCacheFreeList(glyphCacheEntry *list)
+{
+	while (list) {
+		glyphCacheEntry *e = list;
+		list = list->next;
+		free(e);
 	}
+}
 
-	// Check size
-	int size = 0;
-	int numchar = 0;
-	int width = userfont[0];
-	int height = userfont[1];
-	uint8_t first = 255;
-	uint8_t last = 0;
-	//int offst = 0;
-	int pminwidth = 255;
-	int pmaxwidth = 0;
+// Remove all cached glyphs of the font
+//-----------------------------------------
+static void removeFontGlyphs(uint8_t *font)
+{
+	glyphCacheEntry *removed = NULL;
+
+	portENTER_CRITICAL(&glyph_cache_mux);
+	glyphCacheEntry *e = glyph_cache_first;
+	while (e) {
+		glyphCacheEntry *next = e->next;
+		if (e->font == font) _glyphCacheRemove(e, &removed);
+		e = next;
+	}
+	portEXIT_CRITICAL(&glyph_cache_mux);
 
-	if (width != 0) {
-		// Fixed font
-		numchar = userfont[3];
-		first = userfont[2];
-		last = first + numchar - 1;
-		size = ((width * height * numchar) / 8) + 4;
+	_glyphCacheFreeList(removed);
+}
+
+// Find the entry holding character 'c' rendered with the current font and colors
+//----------------------------------------------------------------------
+static glyphCacheEntry *_glyphCacheFind(uint32_t c, uint8_t force_fixed)
+{
+	for (glyphCacheEntry *e = *_glyphCacheBucket(cfont.font, c); e != NULL; e = e->hnext) {
+		if ((e->c == c) && (e->font == cfont.font) && (e->force_fixed == force_fixed) &&
+				(memcmp(&e->fg, &_fg, sizeof(color_t)) == 0) && (memcmp(&e->bg, &_bg, sizeof(color_t)) == 0)) return e;
 	}
-	else {
-		// Proportional font
-		size = 4; // point at first char data
-		uint8_t charCode;
-		int charwidth;
+	return NULL;
+}
 
-		do {
-		    charCode = userfont[size];
-		    charwidth = userfont[size+2];
+// Copy the cached character cell (width x cfont.y_size) to 'dst' with 'stride' pixels per row
+// The entry is pinned in the critical section and copied outside it
+// Returns 1 if the character was found in cache, 0 if not
+//------------------------------------------------------------------------
+static int getCachedGlyph(uint32_t c, int width, color_t *dst, int stride)
+{
+	if (glyph_cache_budget == 0) return 0;
 
-		    if (charCode != 0xFF) {
-		    	numchar++;
-		    	if (charwidth != 0) size += ((((charwidth * userfont[size+3])-1) / 8) + 7);
-		    	else size += 6;
+	uint8_t force_fixed = (cfont.x_size == 0) ? font_forceFixed : 0;
 
-		    	if (info) {
-	    			if (charwidth > pmaxwidth) pmaxwidth = charwidth;
-	    			if (charwidth < pminwidth) pminwidth = charwidth;
-	    			if (charCode < first) first = charCode;
-	    			if (charCode > last) last = charCode;
-	    		}
-		    }
-		    else size++;
-		  } while ((size < (read-8)) && (charCode != 0xFF));
+	portENTER_CRITICAL(&glyph_cache_mux);
+	glyphCacheEntry *e = _glyphCacheFind(c, force_fixed);
+	if ((e) && ((e->width != width) || (e->height != cfont.y_size))) e = NULL;
+	if (e) {
+		_glyphCacheTouch(e);
+		e->pins++;
+		glyph_cache_hits++;
 	}
+	else glyph_cache_misses++;
+	portEXIT_CRITICAL(&glyph_cache_mux);
 
-	if (size != (read-8)) {
-		sprintf(err_msg, "Font size error: found %d expected %d)", size, (read-8));
-		err = 7;
-		goto exit;
+	if (e == NULL) return 0;
+
+	for (int r=0; r<e->height; r++) {
+		memcpy(dst + (r * stride), e->pixels + (r * e->width), e->width * sizeof(color_t));
 	}
 
-	if (info) {
-		if (width != 0) {
-			printf("Fixed width font:\r\n  size: %d  width: %d  height: %d  characters: %d (%d~%d)\n",
-					size, width, height, numchar, first, last);
-		}
-		else {
-			printf("Proportional font:\r\n  size: %d  width: %d~%d  height: %d  characters: %d (%d~%d)\n",
-					size, pminwidth, pmaxwidth, height, numchar, first, last);
-		}
+	portENTER_CRITICAL(&glyph_cache_mux);
+	e->pins--;
+	uint8_t free_entry = ((e->removed) && (e->pins == 0));
+	portEXIT_CRITICAL(&glyph_cache_mux);
+
+	if (free_entry) free(e);
+	return 1;
+}
+
+// Add the rendered character cell (width x cfont.y_size) from 'src' with 'stride' pixels per row to cache
+// Entries are only copied, so they are allocated from the normal heap, not from DMA capable memory
+//-------------------------------------------------------------------------
+static void putCachedGlyph(uint32_t c, int width, color_t *src, int stride)
+{
+	uint32_t size = sizeof(glyphCacheEntry) + (width * cfont.y_size * sizeof(color_t));
+	if (size > glyph_cache_budget) return;
+
+	glyphCacheEntry *e = malloc(size);
+	if (e == NULL) return;
+
+	e->font = cfont.font;
+	e->c = c;
+	e->force_fixed = (cfont.x_size == 0) ? font_forceFixed : 0;
+	e->fg = _fg;
+	e->bg = _bg;
+	e->width = width;
+	e->height = cfont.y_size;
+	e->size = size;
+	e->pins = 0;
+	e->removed = 0;
+	e->pixels = (color_t *)(e + 1);
+	for (int r=0; r<e->height; r++) {
+		memcpy(e->pixels + (r * e->width), src + (r * stride), e->width * sizeof(color_t));
 	}
 
-exit:
-	if (err) {
-		if (userfont) {
-			free(userfont);
-			userfont = NULL;
-		}
-		if (info) printf("Error: %d [%s]\r\n", err, err_msg);
+	glyphCacheEntry *removed = NULL;
+	portENTER_CRITICAL(&glyph_cache_mux);
+	// the same glyph could be added meanwhile by the task on the other core
+	glyphCacheEntry *ce = _glyphCacheFind(c, e->force_fixed);
+	if (ce) _glyphCacheRemove(ce, &removed);
+	if (size <= glyph_cache_budget) {
+		_glyphCacheInsert(e);
+		e = NULL;
+		glyphCacheEntry *trimmed = _glyphCacheTrim(glyph_cache_budget);
+		if (removed) removed->next = trimmed;
+		else removed = trimmed;
 	}
-	return err;
+	portEXIT_CRITICAL(&glyph_cache_mux);
+
+	if (e) free(e);
+	_glyphCacheFreeList(removed);
 }
 
-//------------------------------------------------
-int compile_font_file(char *fontfile, uint8_t dbg)
+//=======================================
+void TFT_setGlyphCacheSize(uint32_t size)
 {
-	int err = 0;
-	char err_msg[128] = {'\0'};
-	char outfile[128] = {'\0'};
-	size_t len;
-    struct stat sb;
-    FILE *ffd = NULL;
-    FILE *ffd_out = NULL;
-    char *sourcebuf = NULL;
+	portENTER_CRITICAL(&glyph_cache_mux);
+	glyph_cache_budget = size;
+	glyphCacheEntry *removed = _glyphCacheTrim(size);
+	portEXIT_CRITICAL(&glyph_cache_mux);
 
-    len = strlen(fontfile);
+	_glyphCacheFreeList(removed);
+}
 
-	// check here that filename end with ".c".
-	if ((len < 3) || (len > 125) || (strcmp(fontfile + len - 2, ".c") != 0)) {
-		sprintf(err_msg, "not a .c file");
-		err = 1;
-		goto exit;
+//=========================================================================
+void TFT_getGlyphCacheStats(uint32_t *hits, uint32_t *misses, uint32_t *used)
+{
+	portENTER_CRITICAL(&glyph_cache_mux);
+	if (hits) *hits = glyph_cache_hits;
+	if (misses) *misses = glyph_cache_misses;
+	if (used) *used = glyph_cache_used;
+	portEXIT_CRITICAL(&glyph_cache_mux);
+}
+
+// ==== File font glyph data cache ====
+// Cache functions must be called with 'font_page_mux' taken
+
+// Hash table bucket of the glyph record of the font file
+//------------------------------------------------------------------
+static fontPageEntry **_fontPageBucket(fontFile *ff, uint32_t glyph)
+{
+	uint32_t h = ((uint32_t)ff >> 2) ^ (glyph * 31);
+	return &font_page_hash[(h ^ (h >> 5)) % FONT_PAGE_HASH_SIZE];
+}
+
+// Remove the entry from the LRU list and the hash table
+//-------------------------------------------
+static void _fontPageUnlink(fontPageEntry *e)
+{
+	if (e->prev) e->prev->next = e->next;
+	else font_page_first = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else font_page_last = e->prev;
+	font_page_used -= e->size;
+
+	fontPageEntry **he = _fontPageBucket(e->ff, e->glyph);
+	while (*he) {
+		if (*he == e) {
+			*he = e->hnext;
+			break;
+		}
+		he = &(*he)->hnext;
 	}
+}
 
-	sprintf(outfile, "%s", fontfile);
-	sprintf(outfile+strlen(outfile)-1, "fon");
+// Insert the entry at the head of the LRU list, add it to the hash table
+//-------------------------------------------
+static void _fontPageInsert(fontPageEntry *e)
+{
+	e->prev = NULL;
+	e->next = font_page_first;
+	if (font_page_first) font_page_first->prev = e;
+	else font_page_last = e;
+	font_page_first = e;
+	font_page_used += e->size;
+
+	fontPageEntry **he = _fontPageBucket(e->ff, e->glyph);
+	e->hnext = *he;
+	*he = e;
+}
 
-	// Open the source file
-    if (stat(fontfile, &sb) != 0) {
-    	sprintf(err_msg, "Error opening source file '%s'", fontfile);
-    	err = 2;
-		goto exit;
-    }
-    // Open the file
-    ffd = fopen(fontfile, "rb");
-    if (!ffd) {
-    	sprintf(err_msg, "Error opening source file '%s'", fontfile);
-    	err = 3;
-		goto exit;
-    }
+// Move the entry to the head of the LRU list
+//------------------------------------------
+static void _fontPageTouch(fontPageEntry *e)
+{
+	if (e == font_page_first) return;
+	e->prev->next = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else font_page_last = e->prev;
+	e->prev = NULL;
+	e->next = font_page_first;
+	font_page_first->prev = e;
+	font_page_first = e;
+}
 
-	// Open the font file
-    ffd_out= fopen(outfile, "wb");
-	if (!ffd_out) {
-		sprintf(err_msg, "error opening destination file");
-		err = 4;
-		goto exit;
+// Remove the entry from cache and add it to the 'removed' list, a pinned entry is freed by its last unpin
+//--------------------------------------------------------------------
+static void _fontPageRemove(fontPageEntry *e, fontPageEntry **removed)
+{
+	_fontPageUnlink(e);
+	if (e->pins) {
+		e->removed = 1;
+		return;
 	}
+	e->next = *removed;
+	*removed = e;
+}
 
-	// Get file size
-	int fsize = sb.st_size;
-	if (fsize <= 0) {
-		sprintf(err_msg, "source file size error");
-		err = 5;
-		goto exit;
+// Find the entry holding glyph record 'glyph' of the font file
+//---------------------------------------------------------------
+static fontPageEntry *_fontPageFind(fontFile *ff, uint32_t glyph)
+{
+	for (fontPageEntry *e = *_fontPageBucket(ff, glyph); e != NULL; e = e->hnext) {
+		if ((e->ff == ff) && (e->glyph == glyph)) return e;
 	}
+	return NULL;
+}
 
-	sourcebuf = malloc(fsize+4);
-	if (sourcebuf == NULL) {
-		sprintf(err_msg, "memory allocation error");
-		err = 6;
-		goto exit;
+// Remove least recently used entries until the cache fits into 'budget' bytes
+// Returns the list of removed entries, which must be freed outside the critical section
+//-----------------------------------------------------
+static fontPageEntry *_fontPageTrim(uint32_t budget)
+{
+	fontPageEntry *removed = NULL;
+	while ((font_page_last) && (font_page_used > budget)) {
+		_fontPageRemove(font_page_last, &removed);
 	}
-	char *fbuf = sourcebuf;
+	return removed;
+}
 
-	int rdsize = fread(fbuf, 1, fsize, ffd);
-	fclose(ffd);
-	ffd = NULL;
+//---------------------------------------------------
+static void _fontPageFreeList(fontPageEntry *list)
+{
+	while (list) {
+		fontPageEntry *e = list;
+		list = list->next;
+		free(e);
+	}
+}
 
-	if (rdsize != fsize) {
-		sprintf(err_msg, "error reading from source file");
-		err = 7;
-		goto exit;
+// Close the font file and remove its cached glyph data
+//-----------------------------------------
+static void closeFontFile(fontFile *ff)
+{
+	fontPageEntry *removed = NULL;
+
+	portENTER_CRITICAL(&font_page_mux);
+	fontPageEntry *e = font_page_first;
+	while (e) {
+		fontPageEntry *next = e->next;
+		if (e->ff == ff) _fontPageRemove(e, &removed);
+		e = next;
 	}
+	portEXIT_CRITICAL(&font_page_mux);
 
-	*(fbuf+rdsize) = '\0';
+	_fontPageFreeList(removed);
 
-	fbuf = strchr(fbuf, '{');			// beginning of font data
-	char *fend = strstr(fbuf, "};");	// end of font data
+	if (ff->fhndl) fclose(ff->fhndl);
+	if (ff->mutex) vSemaphoreDelete(ff->mutex);
+	if (ff->offset) free(ff->offset);
+	if (ff->size) free(ff->size);
+	free(ff);
+}
 
-	if ((fbuf == NULL) || (fend == NULL) || ((fend-fbuf) < 22)) {
-		sprintf(err_msg, "wrong source file format");
-		err = 8;
-		goto exit;
+// Copy the cached data of glyph record 'glyph' to 'dst'
+// The entry is pinned in the critical section and copied outside it
+// Returns 1 if the glyph data was found in cache, 0 if not
+//--------------------------------------------------------------------
+static int getFontPage(fontFile *ff, uint32_t glyph, uint8_t *dst)
+{
+	portENTER_CRITICAL(&font_page_mux);
+	font_page_fetches++;
+	fontPageEntry *e = _fontPageFind(ff, glyph);
+	if (e) {
+		_fontPageTouch(e);
+		e->pins++;
 	}
+	else font_page_misses++;
+	portEXIT_CRITICAL(&font_page_mux);
 
-	fbuf++;
-	*fend = '\0';
-	char hexstr[5] = {'\0'};
-	int lastline = 0;
+	if (e == NULL) return 0;
 
-	fbuf = strstr(fbuf, "0x");
-	int size = 0;
-	char *nextline;
-	char *numptr;
+	memcpy(dst, e->data, e->size - sizeof(fontPageEntry));
 
-	int bptr = 0;
+	portENTER_CRITICAL(&font_page_mux);
+	e->pins--;
+	uint8_t free_entry = ((e->removed) && (e->pins == 0));
+	portEXIT_CRITICAL(&font_page_mux);
 
-	while ((fbuf != NULL) && (fbuf < fend) && (lastline == 0)) {
-		nextline = strchr(fbuf, '\n'); // beginning of the next line
-		if (nextline == NULL) {
-			nextline = fend-1;
-			lastline++;
-		}
-		else nextline++;
+	if (free_entry) free(e);
+	return 1;
+}
 
-		while (fbuf < nextline) {
-			numptr = strstr(fbuf, "0x");
-			if ((numptr == NULL) || ((fbuf+4) > nextline)) numptr = strstr(fbuf, "0X");
-			if ((numptr != NULL) && ((numptr+4) <= nextline)) {
-				fbuf = numptr;
-				if (bptr >= 128) {
-					// buffer full, write to file
-                    if (fwrite(outfile, 1, 128, ffd_out) != 128) goto error;
-					bptr = 0;
-					size += 128;
-				}
-				memcpy(hexstr, fbuf, 4);
-				hexstr[4] = 0;
-				outfile[bptr++] = (uint8_t)strtol(hexstr, NULL, 0);
-				fbuf += 4;
-			}
-			else fbuf = nextline;
-		}
-		fbuf = nextline;
+// Add the data of glyph record 'glyph' from 'src' to cache
+//--------------------------------------------------------------------
+static void putFontPage(fontFile *ff, uint32_t glyph, uint8_t *src)
+{
+	uint32_t size = sizeof(fontPageEntry) + ff->size[glyph];
+	if (size > font_page_budget) return;
+
+	fontPageEntry *e = malloc(size);
+	if (e == NULL) return;
+
+	e->ff = ff;
+	e->glyph = glyph;
+	e->size = size;
+	e->pins = 0;
+	e->removed = 0;
+	e->data = (uint8_t *)(e + 1);
+	memcpy(e->data, src, ff->size[glyph]);
+
+	fontPageEntry *removed = NULL;
+	portENTER_CRITICAL(&font_page_mux);
+	// the same glyph could be added meanwhile by the task on the other core
+	fontPageEntry *ce = _fontPageFind(ff, glyph);
+	if (ce) _fontPageRemove(ce, &removed);
+	if (size <= font_page_budget) {
+		_fontPageInsert(e);
+		e = NULL;
+		fontPageEntry *trimmed = _fontPageTrim(font_page_budget);
+		if (removed) removed->next = trimmed;
+		else removed = trimmed;
 	}
+	portEXIT_CRITICAL(&font_page_mux);
 
-	if (bptr > 0) {
-		size += bptr;
-        if (fwrite(outfile, 1, bptr, ffd_out) != bptr) goto error;
-	}
+	if (e) free(e);
+	_fontPageFreeList(removed);
+}
 
-	// write font ID
-	sprintf(outfile, "RPH_font");
-    if (fwrite(outfile, 1, 8, ffd_out) != 8) goto error;
+//=========================================
+void TFT_setFontPageCacheSize(uint32_t size)
+{
+	portENTER_CRITICAL(&font_page_mux);
+	font_page_budget = size;
+	fontPageEntry *removed = _fontPageTrim(size);
+	portEXIT_CRITICAL(&font_page_mux);
 
-    fclose(ffd_out);
-    ffd_out = NULL;
+	_fontPageFreeList(removed);
+}
 
-	// === Test compiled font ===
-	sprintf(outfile, "%s", fontfile);
-	sprintf(outfile+strlen(outfile)-1, "fon");
+//===========================================================================
+void TFT_getFontPageCacheStats(uint32_t *fetches, uint32_t *misses, uint32_t *used)
+{
+	portENTER_CRITICAL(&font_page_mux);
+	if (fetches) *fetches = font_page_fetches;
+	if (misses) *misses = font_page_misses;
+	if (used) *used = font_page_used;
+	portEXIT_CRITICAL(&font_page_mux);
+}
 
-	uint8_t *uf = userfont; // save userfont pointer
-	userfont = NULL;
-	if (load_file_font(outfile, 1) != 0) {
-		sprintf(err_msg, "Error compiling file!");
-		err = 10;
-	}
-	else {
-		free(userfont);
-		sprintf(err_msg, "File compiled successfully.");
-	}
-	userfont = uf; // restore userfont
+// ==== Glyph pixels ====
+// Proportional font glyph pixels are packed MSB first, 'cfont.bpp' bits per pixel.
+// In anti-aliased fonts (2 or 4 bits per pixel) the pixel value is the glyph coverage,
+// 0 is background, the maximal value (3 or 15) is foreground
+//
+// In run-length coded fonts (1 bit per pixel only) glyph pixels are coded as the lengths
+// of alternating background and foreground runs, starting with background.
+// Runs continue across the glyph rows, the last run is also coded.
+// The first run length is coded as is (it can be 0), other run lengths as length-1.
+// Codes are read MSB first:
+//   0x        0~1
+//   10xx      2~5
+//   110xxx    6~13
+//   111xxxxx  14~45
+// Code 45 is followed by the next code of the same run, the run length is the sum of codes
+
+// 3rd header byte of the proportional font, glyph pixel format
+#define GLYPH_FORMAT_AA2	2		// 2 bits per pixel
+#define GLYPH_FORMAT_AA4	4		// 4 bits per pixel
+#define GLYPH_FORMAT_RLE	0x81	// 1 bit per pixel, run-length coded
+#define GLYPH_FORMAT_UNICODE	0x40	// added to the format in Unicode font
+#define GLYPH_FORMAT_METRICS	0x20	// added to the format in Unicode font with precomputed metrics
+
+#define GLYPH_RUN_CODE_MAX	45
 
-	goto exit;
+typedef struct {
+	const uint8_t	*data;		// next glyph data byte
+	uint8_t		bits;		// current data byte
+	uint8_t		nbits;		// bits not read from the current byte
+	uint8_t		value;		// pixel value of the current run
+	uint8_t		first;		// the first run is not read yet
+	uint16_t	run;		// pixels left in the current run
+	uint8_t		bpp;		// bits per pixel of the glyph's font
+	uint8_t		rle;		// glyph is run-length coded
+} glyphReader;
+
+// Set the glyph pixel format from the 3rd proportional font header byte
+// Other values than defined formats are 1 bit per pixel
+//------------------------------------------------------------------------------------
+static void _glyphFormat(uint8_t format, uint8_t *bpp, uint8_t *rle, uint8_t *unicode)
+{
+	uint8_t base = format & ~(GLYPH_FORMAT_UNICODE | GLYPH_FORMAT_METRICS);
+	*unicode = ((format & GLYPH_FORMAT_UNICODE) && ((base == 0) || (base == GLYPH_FORMAT_AA2) ||
+				(base == GLYPH_FORMAT_AA4) || (base == GLYPH_FORMAT_RLE)));
+	if (!*unicode) base = format;
+	*bpp = ((base == GLYPH_FORMAT_AA2) || (base == GLYPH_FORMAT_AA4)) ? base : 1;
+	*rle = (base == GLYPH_FORMAT_RLE);
+}
 
-error:
-	sprintf(err_msg, "error writing to destination file");
-	err = 9;
+// ==== Unicode fonts ====
+// The header of the Unicode proportional font is followed by the number of glyphs (2 bytes)
+// and the table of glyphs sorted by code point. Each table entry holds the code point (3 bytes)
+// and the offset of the glyph record from the font start (3 bytes); numbers are little endian.
+// Glyph records follow the table, their character code byte is 0; the last record is followed by 0xFF
+// With GLYPH_FORMAT_METRICS in the format, the 4th header byte holds the maximal character width
+// and the 2nd header byte the font height; the font is used without scanning its glyphs
 
-exit:
-	if (sourcebuf) free(sourcebuf);
-	if (ffd) fclose(ffd);
-	if (ffd_out) fclose(ffd_out);
+#define FONT_UNICODE_TABLE	6		// offset of the code point table
+#define FONT_UNICODE_ENTRY	6		// size of the code point table entry
 
-	if (dbg) printf("%s\r\n", err_msg);
+//----------------------------------------------
+static inline uint32_t _get24(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16);
+}
 
-	return err;
+//-------------------------------------------------
+static inline void _put24(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xFF;
+	p[1] = (val >> 8) & 0xFF;
+	p[2] = (val >> 16) & 0xFF;
 }
 
+// Number of glyphs in the Unicode font
+//--------------------------------------------------
+static uint32_t _fontGlyphCount(const uint8_t *font)
+{
+	return font[4] | (font[5] << 8);
+}
 
-// -----------------------------------------------------------------------------------------
-// Individual Proportional Font Character Format:
-// -----------------------------------------------------------------------------------------
-// Character Code
-// yOffset				(start Y of visible pixels)
-// Width				(width of the visible pixels)
-// Height				(height of the visible pixels)
-// xOffset				(start X of visible pixels)
-// xDelta				(the distance to move the cursor. Effective width of the character.)
-// Data[n]
-// -----------------------------------------------------------------------------------------
+// Offset of the first glyph record of the proportional font
+//-------------------------------------------------------------------
+static uint32_t _fontFirstGlyph(const uint8_t *font, uint8_t unicode)
+{
+	if (!unicode) return 4;
+	return FONT_UNICODE_TABLE + (_fontGlyphCount(font) * FONT_UNICODE_ENTRY);
+}
 
-//---------------------------------------------------------------------------------------------
-// Character drawing rectangle is (0, 0) (xDelta-1, cfont.y_size-1)
-// Character visible pixels rectangle is (xOffset, yOffset) (xOffset+Width-1, yOffset+Height-1)
-//---------------------------------------------------------------------------------------------
+// Find the code point 'c' in the current Unicode font
+// Returns the offset of its glyph record, 0 if not found
+//--------------------------------------
+static uint32_t _fontFindGlyph(uint32_t c)
+{
+	const uint8_t *table = cfont.font + FONT_UNICODE_TABLE;
+	uint32_t lo = 0;
+	uint32_t hi = _fontGlyphCount(cfont.font);
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		const uint8_t *entry = table + (mid * FONT_UNICODE_ENTRY);
+		uint32_t code = _get24(entry);
+		if (code == c) return _get24(entry + 3);
+		if (code < c) lo = mid + 1;
+		else hi = mid;
+	}
+	return 0;
+}
 
-//----------------------------------
-void getFontCharacters(uint8_t *buf)
+//-------------------------------------------------------------------------------------------------
+static inline void _glyphReaderInit(glyphReader *gr, const uint8_t *data, uint8_t bpp, uint8_t rle)
 {
-    if (cfont.bitmap == 2) {
-    	//For 7 segment font only characters 0,1,2,3,4,5,6,7,8,9, . , - , : , / are available.
-		for (uint8_t n=0; n < 11; n++) {
-			buf[n] = n + 0x30;
-		}
-		buf[11] = '.';
-		buf[12] = '-';
-		buf[13] = '/';
-		buf[14] = '\0';
-    	return;
-    }
+	gr->data = data;
+	gr->bpp = bpp;
+	gr->rle = rle;
+	gr->nbits = 0;
+	gr->value = 1;	// the first run is background
+	gr->first = 1;
+	gr->run = 0;
+}
 
-    if (cfont.x_size > 0) {
-		for (uint8_t n=0; n < cfont.numchars; n++) {
-			buf[n] = cfont.offset + n;
+// Read 'n' bits of the glyph data
+//---------------------------------------------------
+static uint8_t _glyphBits(glyphReader *gr, int n)
+{
+	uint8_t val = 0;
+	while (n--) {
+		if (gr->nbits == 0) {
+			gr->bits = *gr->data++;
+			gr->nbits = 8;
 		}
-		buf[cfont.numchars] = '\0';
-		return;
+		gr->nbits--;
+		val = (val << 1) | ((gr->bits >> gr->nbits) & 1);
 	}
+	return val;
+}
 
-	uint16_t tempPtr = 4; // point at first char data
-	uint8_t cc, cw, ch, n;
+// Read the next run length code of the run-length coded glyph
+//--------------------------------------------------
+static uint8_t _glyphRunCode(glyphReader *gr)
+{
+	if (_glyphBits(gr, 1) == 0) return _glyphBits(gr, 1);
+	if (_glyphBits(gr, 1) == 0) return 2 + _glyphBits(gr, 2);
+	if (_glyphBits(gr, 1) == 0) return 6 + _glyphBits(gr, 3);
+	return 14 + _glyphBits(gr, 5);
+}
 
-	n = 0;
-    cc = cfont.font[tempPtr++];
-    while (cc != 0xFF)  {
-    	cfont.numchars++;
-        tempPtr++;
-        cw = cfont.font[tempPtr++];
-        ch = cfont.font[tempPtr++];
-        tempPtr++;
-        tempPtr++;
-		if (cw != 0) {
-			// packed bits
-			tempPtr += (((cw * ch)-1) / 8) + 1;
-		}
-		buf[n++] = cc;
-	    cc = cfont.font[tempPtr++];
-	}
-	buf[n] = '\0';
+// Read the next run length of the run-length coded glyph
+//--------------------------------------------------
+static int _glyphRunLength(glyphReader *gr)
+{
+	int len = (gr->first) ? 0 : 1;
+	uint8_t code;
+
+	gr->first = 0;
+	do {
+		code = _glyphRunCode(gr);
+		len += code;
+	} while (code == GLYPH_RUN_CODE_MAX);
+	return len;
 }
 
-// Set max width & height of the proportional font
-//-----------------------------
-static void getMaxWidthHeight()
+// Size in bytes of the run-length coded glyph data of 'npixels' pixels at 'data'
+// If 'end' is not NULL, data is not read beyond it and 0xFFFF is returned if the glyph does not end before it
+//----------------------------------------------------------------------------------
+static uint16_t _glyphRLESize(const uint8_t *data, int npixels, const uint8_t *end)
 {
-	uint16_t tempPtr = 4; // point at first char data
-	uint8_t cc, cw, ch, cd, cy;
+	glyphReader gr;
+	_glyphReaderInit(&gr, data, 1, 1);
+	while (npixels > 0) {
+		if ((end) && (gr.data >= end)) return 0xFFFF;
+		npixels -= _glyphRunLength(&gr);
+	}
+	return gr.data - data;
+}
 
-	cfont.numchars = 0;
-	cfont.max_x_size = 0;
+// Size in bytes of the glyph data at 'data'
+//--------------------------------------------------------------------------------------------------
+static uint16_t _glyphDataSize(const uint8_t *data, int width, int height, uint8_t bpp, uint8_t rle)
+{
+	if (width == 0) return 0;
+	if (rle) return _glyphRLESize(data, width * height, NULL);
+	return (((width * height * bpp) - 1) / 8) + 1;
+}
 
-    cc = cfont.font[tempPtr++];
-    while (cc != 0xFF)  {
-    	cfont.numchars++;
-        cy = cfont.font[tempPtr++];
-        cw = cfont.font[tempPtr++];
-        ch = cfont.font[tempPtr++];
-        tempPtr++;
-        cd = cfont.font[tempPtr++];
-        cy += ch;
-		if (cw > cfont.max_x_size) cfont.max_x_size = cw;
-		if (cd > cfont.max_x_size) cfont.max_x_size = cd;
-		if (ch > cfont.y_size) cfont.y_size = ch;
-		if (cy > cfont.y_size) cfont.y_size = cy;
-		if (cw != 0) {
-			// packed bits
-			tempPtr += (((cw * ch)-1) / 8) + 1;
+// Start the next run of glyph pixels
+//--------------------------------------------------
+static inline void _glyphNextRun(glyphReader *gr)
+{
+	if (gr->rle) {
+		gr->value ^= 1;
+		gr->run = _glyphRunLength(gr);
+	}
+	else {
+		if (gr->nbits == 0) {
+			gr->bits = *gr->data++;
+			gr->nbits = 8;
 		}
-	    cc = cfont.font[tempPtr++];
+		gr->nbits -= gr->bpp;
+		gr->value = (gr->bits >> gr->nbits) & ((1 << gr->bpp) - 1);
+		gr->run = 1;
 	}
-    cfont.size = tempPtr;
 }
 
-// Return the Glyph data for an individual character in the proportional font
-//------------------------------------
-static uint8_t getCharPtr(uint8_t c) {
-  uint16_t tempPtr = 4; // point at first char data
+// Read the next glyph pixel value
+//------------------------------------------------------
+static inline uint8_t _glyphPixel(glyphReader *gr)
+{
+	while (gr->run == 0) _glyphNextRun(gr);
+	gr->run--;
+	return gr->value;
+}
 
-  do {
-	fontChar.charCode = cfont.font[tempPtr++];
-    if (fontChar.charCode == 0xFF) return 0;
+// Read the run of up to 'max' glyph pixels with the same value
+// Returns the run length, the pixel value is returned in 'value'
+//-------------------------------------------------------------------
+static int _glyphRun(glyphReader *gr, int max, uint8_t *value)
+{
+	int n = 0;
+
+	while (gr->run == 0) _glyphNextRun(gr);
+	*value = gr->value;
+	while (n < max) {
+		if (gr->run == 0) {
+			_glyphNextRun(gr);
+			if (gr->value != *value) break;
+		}
+		int len = ((max - n) < gr->run) ? (max - n) : gr->run;
+		n += len;
+		gr->run -= len;
+	}
+	return n;
+}
 
-    fontChar.adjYOffset = cfont.font[tempPtr++];
-    fontChar.width = cfont.font[tempPtr++];
-    fontChar.height = cfont.font[tempPtr++];
-    fontChar.xOffset = cfont.font[tempPtr++];
-    fontChar.xOffset = fontChar.xOffset < 0x80 ? fontChar.xOffset : -(0xFF - fontChar.xOffset);
-    fontChar.xDelta = cfont.font[tempPtr++];
+// Size in bytes of the glyph data at offset 'ptr' of the current font
+// Glyph data of the paged file font is not in memory
+//-----------------------------------------------------------------
+static uint16_t _fontGlyphSize(uint32_t ptr, int width, int height)
+{
+	if (cfont.paged) return 0;
+	return _glyphDataSize(cfont.font+ptr, width, height, cfont.bpp, cfont.rle);
+}
 
-    if (c != fontChar.charCode && fontChar.charCode != 0xFF) {
-      if (fontChar.width != 0) {
-        // packed bits
-        tempPtr += (((fontChar.width * fontChar.height)-1) / 8) + 1;
-      }
-    }
-  } while ((c != fontChar.charCode) && (fontChar.charCode != 0xFF));
+// Read the data of glyph record 'glyph' from the font file to 'dst'
+//----------------------------------------------------------------------
+static int _readFontFile(fontFile *ff, uint32_t glyph, uint8_t *dst)
+{
+	int res;
 
-  fontChar.dataPtr = tempPtr;
-  if (c == fontChar.charCode) {
-    if (font_forceFixed > 0) {
-      // fix width & offset for forced fixed width
-      fontChar.xDelta = cfont.max_x_size;
-      fontChar.xOffset = (fontChar.xDelta - fontChar.width) / 2;
-    }
-  }
-  else return 0;
+	xSemaphoreTake(ff->mutex, portMAX_DELAY);
+	res = ((fseek(ff->fhndl, ff->offset[glyph], SEEK_SET) == 0) &&
+		   (fread(dst, 1, ff->size[glyph], ff->fhndl) == ff->size[glyph]));
+	xSemaphoreGive(ff->mutex);
 
-  return 1;
+	return res;
 }
 
-/*
-//-----------------------
-static void _testFont() {
-  if (cfont.x_size) {
-	  printf("FONT TEST: fixed font\r\n");
-	  return;
-  }
-  uint16_t tempPtr = 4; // point at first char data
-  uint8_t c = 0x20;
-  for (c=0x20; c <0xFF; c++) {
-	fontChar.charCode = cfont.font[tempPtr++];
-    if (fontChar.charCode == 0xFF) break;
-    if (fontChar.charCode != c) {
-    	printf("FONT TEST: last sequential char: %d, expected %d\r\n", fontChar.charCode, c);
-    	break;
-    }
-    c = fontChar.charCode;
-    fontChar.adjYOffset = cfont.font[tempPtr++];
-    fontChar.width = cfont.font[tempPtr++];
-    fontChar.height = cfont.font[tempPtr++];
-    fontChar.xOffset = cfont.font[tempPtr++];
-    fontChar.xOffset = fontChar.xOffset < 0x80 ? fontChar.xOffset : -(0xFF - fontChar.xOffset);
-    fontChar.xDelta = cfont.font[tempPtr++];
+// Return the glyph data of the character in 'fontChar'
+// Glyph data of the paged file font is taken from cache or read from the file to the context's buffer;
+// if it can not be read, glyph height is set to 0 and nothing is drawn
+//-------------------------------
+static const uint8_t *_glyphData()
+{
+	static const uint8_t no_data[1] = {0};
 
-    if (fontChar.charCode != 0xFF) {
-      if (fontChar.width != 0) {
-        // packed bits
-        tempPtr += (((fontChar.width * fontChar.height)-1) / 8) + 1;
-      }
-    }
-  }
-  printf("FONT TEST: W=%d  H=%d last char: %d [%c]; length: %d\r\n", cfont.max_x_size, cfont.y_size, c, c, tempPtr);
+	if (!cfont.paged) return cfont.font + fontChar.dataPtr;
+
+	// glyph records without data are 6 bytes long in memory
+	tft_ctx_t *ctx = TFT_CTX;
+	fontFile *ff = (ctx->user_font) ? ctx->user_font->ff : NULL;
+	uint32_t glyph = (fontChar.dataPtr - _fontFirstGlyph(cfont.font, cfont.unicode) - 6) / 6;
+	if ((ff == NULL) || (glyph >= ff->nglyphs) || (ff->size[glyph] == 0)) goto error;
+
+	if (ff->size[glyph] > ctx->glyph_data_size) {
+		uint8_t *buf = realloc(ctx->glyph_data, ff->size[glyph]);
+		if (buf == NULL) goto error;
+		ctx->glyph_data = buf;
+		ctx->glyph_data_size = ff->size[glyph];
+	}
+	if (!getFontPage(ff, glyph, ctx->glyph_data)) {
+		if (!_readFontFile(ff, glyph, ctx->glyph_data)) goto error;
+		putFontPage(ff, glyph, ctx->glyph_data);
+	}
+	return ctx->glyph_data;
+
+error:
+	fontChar.height = 0;
+	return no_data;
 }
-*/
 
-//===================================================
-void TFT_setFont(uint8_t font, const char *font_file)
+// Return the colors of the glyph pixel values blended from _bg to _fg
+// The table is calculated only when the colors or font bits per pixel are changed
+//---------------------------------------
+static color_t *_glyphLUT(tft_ctx_t *ctx)
 {
-  cfont.font = NULL;
+	if ((ctx->aa_bpp != ctx->font.bpp) || (memcmp(&ctx->aa_fg, &ctx->fg, sizeof(color_t)) != 0) ||
+			(memcmp(&ctx->aa_bg, &ctx->bg, sizeof(color_t)) != 0)) {
+		int max_level = (1 << ctx->font.bpp) - 1;
+		for (int v=0; v<=max_level; v++) {
+			int a = (v * 256) / max_level;	// 0~256
+			ctx->aa_lut[v].r = BLEND_COMP(ctx->fg.r, ctx->bg.r, a);
+			ctx->aa_lut[v].g = BLEND_COMP(ctx->fg.g, ctx->bg.g, a);
+			ctx->aa_lut[v].b = BLEND_COMP(ctx->fg.b, ctx->bg.b, a);
+		}
+		ctx->aa_fg = ctx->fg;
+		ctx->aa_bg = ctx->bg;
+		ctx->aa_bpp = ctx->font.bpp;
+	}
+	return ctx->aa_lut;
+}
 
-  if (font == FONT_7SEG) {
-    cfont.bitmap = 2;
-    cfont.x_size = 24;
-    cfont.y_size = 6;
-    cfont.offset = 0;
-    cfont.color  = _fg;
-  }
-  else {
-	  if (font == USER_FONT) {
-		  if (load_file_font(font_file, 0) != 0) cfont.font = tft_DefaultFont;
-		  else cfont.font = userfont;
-	  }
-	  else if (font == DEJAVU18_FONT) cfont.font = tft_Dejavu18;
-	  else if (font == DEJAVU24_FONT) cfont.font = tft_Dejavu24;
-	  else if (font == UBUNTU16_FONT) cfont.font = tft_Ubuntu16;
-	  else if (font == COMIC24_FONT) cfont.font = tft_Comic24;
-	  else if (font == MINYA24_FONT) cfont.font = tft_minya24;
-	  else if (font == TOONEY32_FONT) cfont.font = tft_tooney32;
-	  else if (font == SMALL_FONT) cfont.font = tft_SmallFont;
-	  else if (font == DEF_SMALL_FONT) cfont.font = tft_def_small;
-	  else cfont.font = tft_DefaultFont;
+// Blend the glyph pixel value 'v' in foreground color over the background color
+//---------------------------------------------------------------------
+static color_t _glyphBlend(const tft_ctx_t *ctx, uint8_t v, color_t bg)
+{
+	int max_level = (1 << ctx->font.bpp) - 1;
+	if (v >= max_level) return ctx->fg;
+	int a = (v * 256) / max_level;
+	color_t color;
+	color.r = BLEND_COMP(ctx->fg.r, bg.r, a);
+	color.g = BLEND_COMP(ctx->fg.g, bg.g, a);
+	color.b = BLEND_COMP(ctx->fg.b, bg.b, a);
+	return color;
+}
 
-	  cfont.bitmap = 1;
-	  cfont.x_size = cfont.font[0];
-	  cfont.y_size = cfont.font[1];
-	  if (cfont.x_size > 0) {
-		  cfont.offset = cfont.font[2];
-		  cfont.numchars = cfont.font[3];
-		  cfont.size = cfont.x_size * cfont.y_size * cfont.numchars;
-	  }
-	  else {
-		  cfont.offset = 4;
-		  getMaxWidthHeight();
-	  }
-	  //_testFont();
-  }
+// Glyph pixels with unknown background are drawn if at least half covered
+#define GLYPH_PIXEL_VISIBLE(ctx, v) (((v) * 2) > ((1 << (ctx)->font.bpp) - 1))
+
+// Add the context's reference to the font loaded from file
+//---------------------------------------------
+static userFont *_userFontAcquire(userFont *uf)
+{
+	if (uf == NULL) return NULL;
+	portENTER_CRITICAL(&user_font_mux);
+	uf->refs++;
+	portEXIT_CRITICAL(&user_font_mux);
+	return uf;
 }
 
-// -----------------------------------------------------------------------------------------
-// Individual Proportional Font Character Format:
-// -----------------------------------------------------------------------------------------
-// Character Code
-// yOffset				(start Y of visible pixels)
-// Width				(width of the visible pixels)
-// Height				(height of the visible pixels)
-// xOffset				(start X of visible pixels)
-// xDelta				(the distance to move the cursor. Effective width of the character.)
-// Data[n]
-// -----------------------------------------------------------------------------------------
-//---------------------------------------------------------------------------------------------
-// Character drawing rectangle is (0, 0) (xDelta-1, cfont.y_size-1)
-// Character visible pixels rectangle is (xOffset, yOffset) (xOffset+Width-1, yOffset+Height-1)
-//---------------------------------------------------------------------------------------------
+// Release the context's reference to the font loaded from file
+// The font, its cached glyphs and index are freed and the font file is closed with the last reference
+//----------------------------------------
+static void _userFontRelease(userFont *uf)
+{
+	if (uf == NULL) return;
+	portENTER_CRITICAL(&user_font_mux);
+	uint32_t refs = --uf->refs;
+	portEXIT_CRITICAL(&user_font_mux);
+	if (refs) return;
+
+	removeFontIndex(uf->font);
+	removeFontGlyphs(uf->font);
+	if (uf->ff) closeFontFile(uf->ff);
+	free(uf->font);
+	free(uf);
+}
 
-// print non-rotated proportional character
-// character is already in fontChar
-//----------------------------------------------
-static int printProportionalChar(int x, int y) {
-	uint8_t ch = 0;
-	int i, j, char_width;
+// Load the font from file
+// Fixed width font is loaded to memory. Only the header and glyph metrics of the proportional font
+// are loaded, the file is kept open and glyph data is read from it when the character is drawn
+// The loaded font is returned in 'loaded' with one reference
+//---------------------------------------------------------------------------
+static int load_file_font(const char * fontfile, int info, userFont **loaded)
+{
+	int err = 0;
+	char err_msg[256] = {'\0'};
+	uint8_t *gbuf = NULL;
+	uint8_t *font = NULL;
+	fontFile *ff = NULL;
 
-	char_width = ((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta);
+	*loaded = NULL;
 
-	if ((font_buffered_char) && (!font_transparent)) {
-		int len, bufPos;
+    struct stat sb;
 
-		// === buffer Glyph data for faster sending ===
-		len = char_width * cfont.y_size;
-		color_t *color_line = heap_caps_malloc(len*3, MALLOC_CAP_DMA);
-		if (color_line) {
-			// fill with background color
-			for (int n = 0; n < len; n++) {
-				color_line[n] = _bg;
-			}
-			// set character pixels to foreground color
-			uint8_t mask = 0x80;
-			for (j=0; j < fontChar.height; j++) {
-				for (i=0; i < fontChar.width; i++) {
-					if (((i + (j*fontChar.width)) % 8) == 0) {
-						mask = 0x80;
-						ch = cfont.font[fontChar.dataPtr++];
-					}
-					if ((ch & mask) != 0) {
-						// visible pixel
-						bufPos = ((j + fontChar.adjYOffset) * char_width) + (fontChar.xOffset + i);  // bufY + bufX
-						color_line[bufPos] = _fg;
-						/*
-						bufY = (j + fontChar.adjYOffset) * char_width;
-						bufX = fontChar.xOffset + i;
-						if ((bufX < 0) || (bufX > char_width)) {
-							printf("[%c] X ERR: %d\r\n", fontChar.charCode, bufX);
-						}
-						bufPos = bufY + bufX;
-						if ((bufPos < len) && (bufPos > 0)) color_line[bufPos] = _fg;
-						else printf("[%c] ERR: %d > %d  W=%d  H=%d  bufX=%d  bufY=%d  X=%d  Y=%d\r\n",
-								fontChar.charCode, bufPos, len, char_width, cfont.y_size, bufX, bufY, fontChar.xOffset + i, j + fontChar.adjYOffset);
-						*/
-					}
-					mask >>= 1;
-				}
-			}
-			// send to display in one transaction
-			disp_select();
-			send_data(x, y, x+char_width-1, y+cfont.y_size-1, len, color_line);
-			disp_deselect();
-			free(color_line);
+    // Open the file
+    FILE *fhndl = fopen(fontfile, "r");
+    if (!fhndl) {
+    	sprintf(err_msg, "Error opening font file '%s'", fontfile);
+		err = 1;
+		goto exit;
+    }
 
-			return char_width;
-		}
+	// Get file size
+    if (stat(fontfile, &sb) != 0) {
+    	sprintf(err_msg, "Error getting font file size");
+		err = 2;
+		goto exit;
+    }
+	int fsize = sb.st_size;
+	if (fsize < 30) {
+		sprintf(err_msg, "Error getting font file size");
+		err = 3;
+		goto exit;
 	}
+	int dsize = fsize-8;	// font data size, without font ID
 
-	int cx, cy;
+	uint8_t hdr[8];
+	if ((fseek(fhndl, dsize, SEEK_SET) != 0) || (fread(hdr, 1, 8, fhndl) != 8)) {
+		sprintf(err_msg, "Font read error");
+		err = 5;
+		goto exit;
+	}
+	if (memcmp(hdr, "RPH_font", 8) != 0) {
+		sprintf(err_msg, "Font ID not found");
+		err = 6;
+		goto exit;
+	}
+	if ((fseek(fhndl, 0, SEEK_SET) != 0) || (fread(hdr, 1, 4, fhndl) != 4)) {
+		sprintf(err_msg, "Font read error");
+		err = 5;
+		goto exit;
+	}
 
-	if (!font_transparent) _fillRect(x, y, char_width+1, cfont.y_size, _bg);
+	// Check size
+	int size = 0;
+	int numchar = 0;
+	int width = hdr[0];
+	int height = hdr[1];
+	int first = 0x10FFFF;
+	int last = 0;
+	//int offst = 0;
+	int pminwidth = 255;
+	int pmaxwidth = 0;
+	int uptr = 0;
 
-	// draw Glyph
-	uint8_t mask = 0x80;
-	disp_select();
-	for (j=0; j < fontChar.height; j++) {
-		for (i=0; i < fontChar.width; i++) {
-			if (((i + (j*fontChar.width)) % 8) == 0) {
-				mask = 0x80;
-				ch = cfont.font[fontChar.dataPtr++];
-			}
+	if (width != 0) {
+		// Fixed font
+		font = malloc(fsize+4);
+		if (font == NULL) {
+			sprintf(err_msg, "Font memory allocation error");
+			err = 4;
+			goto exit;
+		}
+		memcpy(font, hdr, 4);
+		if (fread(font+4, 1, dsize-4, fhndl) != (dsize-4)) {
+			sprintf(err_msg, "Font read error");
+			err = 5;
+			goto exit;
+		}
 
-			if ((ch & mask) !=0) {
-				cx = (uint16_t)(x+fontChar.xOffset+i);
-				cy = (uint16_t)(y+j+fontChar.adjYOffset);
-				_drawPixel(cx, cy, _fg, 0);
+		numchar = font[3];
+		first = font[2];
+		last = first + numchar - 1;
+		size = (((width + 7) / 8) * height * numchar) + 4;
+	}
+	else {
+		// Proportional font, glyph records without glyph data are loaded to 'font'
+		uint8_t bpp, rle, unicode;
+		_glyphFormat(hdr[2], &bpp, &rle, &unicode);
+		uint8_t charCode = 0;
+		uint8_t *rec;
+		int charwidth, glyphsize;
+		uint32_t nglyphs = 256;
+		uptr = 4;
+
+		if (unicode) {
+			// number of glyphs
+			if (fread(hdr+4, 1, 2, fhndl) != 2) {
+				sprintf(err_msg, "Font read error");
+				err = 5;
+				goto exit;
 			}
-			mask >>= 1;
+			nglyphs = _fontGlyphCount(hdr);
+			uptr = _fontFirstGlyph(hdr, unicode);
 		}
-	}
-	disp_deselect();
-
-	return char_width;
-}
 
-// non-rotated fixed width character
-//----------------------------------------------
-static void printChar(uint8_t c, int x, int y) {
-	uint8_t i, j, ch, fz, mask;
-	uint16_t k, temp, cx, cy, len;
+		ff = calloc(1, sizeof(fontFile));
+		font = malloc(uptr + (nglyphs*6) + 1);
+		if (ff) {
+			ff->offset = malloc((nglyphs+1) * sizeof(uint32_t));
+			ff->size = malloc((nglyphs+1) * sizeof(uint16_t));
+		}
+		// the size of the run-length coded glyph is found by reading its runs, which take at most 2 bits per pixel
+		if (rle) gbuf = malloc(((255*255) / 4) + 2);
+		if ((ff == NULL) || (font == NULL) || (ff->offset == NULL) ||
+				(ff->size == NULL) || ((rle) && (gbuf == NULL))) {
+			sprintf(err_msg, "Font memory allocation error");
+			err = 4;
+			goto exit;
+		}
+		memcpy(font, hdr, (unicode) ? FONT_UNICODE_TABLE : 4);
+		if ((unicode) && (fread(font+FONT_UNICODE_TABLE, 1, uptr-FONT_UNICODE_TABLE, fhndl) != (uptr-FONT_UNICODE_TABLE))) {
+			sprintf(err_msg, "Font read error");
+			err = 5;
+			goto exit;
+		}
 
-	// fz = bytes per char row
-	fz = cfont.x_size/8;
-	if (cfont.x_size % 8) fz++;
+		size = uptr; // point at first char data
+		do {
+			rec = font + uptr;
+			if (fread(rec, 1, 1, fhndl) != 1) break;
+			charCode = rec[0];
+
+			if (charCode != 0xFF) {
+				if ((numchar == nglyphs) || (fread(rec+1, 1, 5, fhndl) != 5)) break;
+				charwidth = rec[2];
+				size += 6;
+
+				if (rle) {
+					int len = ((((charwidth * rec[3]) + 7) / 8) * 2) + 2;
+					if (len > (dsize - size)) len = dsize - size;
+					len = fread(gbuf, 1, len, fhndl);
+					glyphsize = (charwidth) ? _glyphRLESize(gbuf, charwidth * rec[3], gbuf+len) : 0;
+				}
+				else glyphsize = _glyphDataSize(NULL, charwidth, rec[3], bpp, rle);
 
-	// get character position in buffer
-	temp = ((c-cfont.offset)*((fz)*cfont.y_size))+4;
+				ff->offset[numchar] = size;
+				ff->size[numchar] = glyphsize;
+				numchar++;
+				size += glyphsize;
+				uptr += 6;
+				if (fseek(fhndl, size, SEEK_SET) != 0) break;
 
-	if ((font_buffered_char) && (!font_transparent)) {
-		// === buffer Glyph data for faster sending ===
-		len = cfont.x_size * cfont.y_size;
-		color_t *color_line = heap_caps_malloc(len*3, MALLOC_CAP_DMA);
-		if (color_line) {
-			// fill with background color
-			for (int n = 0; n < len; n++) {
-				color_line[n] = _bg;
+		    	if (info) {
+	    			if (charwidth > pmaxwidth) pmaxwidth = charwidth;
+	    			if (charwidth < pminwidth) pminwidth = charwidth;
+	    			if ((!unicode) && (charCode < first)) first = charCode;
+	    			if ((!unicode) && (charCode > last)) last = charCode;
+	    		}
 			}
-			// set character pixels to foreground color
-			for (j=0; j<cfont.y_size; j++) {
-				for (k=0; k < fz; k++) {
-					ch = cfont.font[temp+k];
-					mask=0x80;
-					for (i=0; i<8; i++) {
-						if ((ch & mask) !=0) color_line[(j*cfont.x_size) + (i+(k*8))] = _fg;
-						mask >>= 1;
+			else {
+				size++;
+				uptr++;
+			}
+		} while ((size < dsize) && (charCode != 0xFF));
+
+		if ((size == dsize) && (charCode == 0xFF)) {
+			ff->nglyphs = numchar;
+			if (unicode) {
+				// code point table entries point to glyph records in file, set them to the records in memory
+				uint32_t prev = 0;
+				for (uint32_t n = 0; n < nglyphs; n++) {
+					uint8_t *entry = font + FONT_UNICODE_TABLE + (n * FONT_UNICODE_ENTRY);
+					uint32_t code = _get24(entry);
+					uint32_t data = _get24(entry+3) + 6;
+					uint32_t lo = 0;
+					uint32_t hi = numchar;
+					while (lo < hi) {
+						uint32_t mid = (lo + hi) / 2;
+						if (ff->offset[mid] < data) lo = mid + 1;
+						else hi = mid;
+					}
+					if (((n > 0) && (code <= prev)) || (lo == numchar) || (ff->offset[lo] != data)) {
+						sprintf(err_msg, "Font code point table error");
+						err = 9;
+						goto exit;
 					}
+					_put24(entry+3, _fontFirstGlyph(font, unicode) + (lo * 6));
+					prev = code;
+					if (n == 0) first = code;
+					last = code;
 				}
-				temp += (fz);
 			}
-			// send to display in one transaction
-			disp_select();
-			send_data(x, y, x+cfont.x_size-1, y+cfont.y_size-1, len, color_line);
-			disp_deselect();
-			free(color_line);
-
-			return;
-		}
-	}
-
-	if (!font_transparent) _fillRect(x, y, cfont.x_size, cfont.y_size, _bg);
 
-	disp_select();
-	for (j=0; j<cfont.y_size; j++) {
-		for (k=0; k < fz; k++) {
-			ch = cfont.font[temp+k];
-			mask=0x80;
-			for (i=0; i<8; i++) {
-				if ((ch & mask) !=0) {
-					cx = (uint16_t)(x+i+(k*8));
-					cy = (uint16_t)(y+j);
-					_drawPixel(cx, cy, _fg, 0);
-				}
-				mask >>= 1;
+			// glyph data is read from the open font file
+			ff->mutex = xSemaphoreCreateMutex();
+			if (ff->mutex == NULL) {
+				sprintf(err_msg, "Font file mutex error");
+				err = 8;
+				goto exit;
 			}
+			ff->fhndl = fhndl;
+			fhndl = NULL;
+			uint8_t *uf = realloc(font, uptr);
+			if (uf) font = uf;
 		}
-		temp += (fz);
 	}
-	disp_deselect();
-}
-
-// print rotated proportional character
-// character is already in fontChar
-//---------------------------------------------------
-static int rotatePropChar(int x, int y, int offset) {
-  uint8_t ch = 0;
-  double radian = font_rotate * DEG_TO_RAD;
-  float cos_radian = cos(radian);
-  float sin_radian = sin(radian);
-
-  uint8_t mask = 0x80;
-  disp_select();
-  for (int j=0; j < fontChar.height; j++) {
-    for (int i=0; i < fontChar.width; i++) {
-      if (((i + (j*fontChar.width)) % 8) == 0) {
-        mask = 0x80;
-        ch = cfont.font[fontChar.dataPtr++];
-      }
 
-      int newX = (int)(x + (((offset + i) * cos_radian) - ((j+fontChar.adjYOffset)*sin_radian)));
-      int newY = (int)(y + (((j+fontChar.adjYOffset) * cos_radian) + ((offset + i) * sin_radian)));
+	if (size != dsize) {
+		sprintf(err_msg, "Font size error: found %d expected %d)", size, dsize);
+		err = 7;
+		goto exit;
+	}
 
-      if ((ch & mask) != 0) _drawPixel(newX,newY,_fg, 0);
-      else if (!font_transparent) _drawPixel(newX,newY,_bg, 0);
+	*loaded = malloc(sizeof(userFont));
+	if (*loaded == NULL) {
+		sprintf(err_msg, "Font memory allocation error");
+		err = 4;
+		goto exit;
+	}
+	(*loaded)->font = font;
+	(*loaded)->ff = ff;
+	(*loaded)->refs = 1;
 
-      mask >>= 1;
-    }
-  }
-  disp_deselect();
+	if (info) {
+		if (width != 0) {
+			printf("Fixed width font:\r\n  size: %d  width: %d  height: %d  characters: %d (%d~%d)\n",
+					size, width, height, numchar, first, last);
+		}
+		else {
+			printf("Proportional font:\r\n  size: %d  width: %d~%d  height: %d  characters: %d (%d~%d)  in memory: %d\n",
+					size, pminwidth, pmaxwidth, height, numchar, first, last, uptr);
+		}
+	}
 
-  return fontChar.xDelta+1;
+exit:
+	if (fhndl) fclose(fhndl);
+	if (gbuf) free(gbuf);
+	if (err) {
+		if (font) {
+			free(font);
+			font = NULL;
+		}
+		if (ff) {
+			closeFontFile(ff);
+			ff = NULL;
+		}
+		if (info) printf("Error: %d [%s]\r\n", err, err_msg);
+	}
+	return err;
 }
 
-// rotated fixed width character
-//--------------------------------------------------------
-static void rotateChar(uint8_t c, int x, int y, int pos) {
-  uint8_t i,j,ch,fz,mask;
-  uint16_t temp;
-  int newx,newy;
-  double radian = font_rotate*0.0175;
-  float cos_radian = cos(radian);
-  float sin_radian = sin(radian);
-  int zz;
-
-  if( cfont.x_size < 8 ) fz = cfont.x_size;
-  else fz = cfont.x_size/8;
-  temp=((c-cfont.offset)*((fz)*cfont.y_size))+4;
-
-  disp_select();
-  for (j=0; j<cfont.y_size; j++) {
-    for (zz=0; zz<(fz); zz++) {
-      ch = cfont.font[temp+zz];
-      mask = 0x80;
-      for (i=0; i<8; i++) {
-        newx=(int)(x+(((i+(zz*8)+(pos*cfont.x_size))*cos_radian)-((j)*sin_radian)));
-        newy=(int)(y+(((j)*cos_radian)+((i+(zz*8)+(pos*cfont.x_size))*sin_radian)));
-
-        if ((ch & mask) != 0) _drawPixel(newx,newy,_fg, 0);
-        else if (!font_transparent) _drawPixel(newx,newy,_bg, 0);
-        mask >>= 1;
-      }
-    }
-    temp+=(fz);
-  }
-  disp_deselect();
-  // calculate x,y for the next char
-  TFT_X = (int)(x + ((pos+1) * cfont.x_size * cos_radian));
-  TFT_Y = (int)(y + ((pos+1) * cfont.x_size * sin_radian));
+// Write 'n' low bits of 'val' MSB first at bit position 'pos' of the zeroed buffer 'dst'
+//---------------------------------------------------------------------
+static void _putGlyphBits(uint8_t *dst, int *pos, uint16_t val, int n)
+{
+	while (n--) {
+		if ((val >> n) & 1) dst[*pos / 8] |= 0x80 >> (*pos % 8);
+		(*pos)++;
+	}
 }
 
-//----------------------
-static int _7seg_width()
+// Write the run length codes of the glyph run
+//--------------------------------------------------------------------
+static void _putGlyphRun(uint8_t *dst, int *pos, int len, int first)
 {
-	return (2 * (2 * cfont.y_size + 1)) + cfont.x_size;
+	if (!first) len--;
+	while (len >= GLYPH_RUN_CODE_MAX) {
+		_putGlyphBits(dst, pos, 0xE0 | (GLYPH_RUN_CODE_MAX - 14), 8);
+		len -= GLYPH_RUN_CODE_MAX;
+	}
+	if (len < 2) _putGlyphBits(dst, pos, len, 2);
+	else if (len < 6) _putGlyphBits(dst, pos, 0x08 | (len - 2), 4);
+	else if (len < 14) _putGlyphBits(dst, pos, 0x30 | (len - 6), 6);
+	else _putGlyphBits(dst, pos, 0xE0 | (len - 14), 8);
 }
 
-//-----------------------
-static int _7seg_height()
+// Set the record offsets in the code point table of the coded Unicode font 'dst'
+// 'src_rec' holds the offsets of 'nrec' records in the source font, 'dst_rec' their offsets in 'dst'
+// Returns 0 if a table entry does not point to the glyph record
+//--------------------------------------------------------------------------------------------
+static int _remapFontTable(uint8_t *dst, const uint32_t *src_rec, const uint32_t *dst_rec, uint32_t nrec)
 {
-	return (3 * (2 * cfont.y_size + 1)) + (2 * cfont.x_size);
+	uint32_t nglyphs = _fontGlyphCount(dst);
+	for (uint32_t n = 0; n < nglyphs; n++) {
+		uint8_t *entry = dst + FONT_UNICODE_TABLE + (n * FONT_UNICODE_ENTRY);
+		uint32_t recptr = _get24(entry+3);
+		uint32_t lo = 0;
+		uint32_t hi = nrec;
+		while (lo < hi) {
+			uint32_t mid = (lo + hi) / 2;
+			if (src_rec[mid] < recptr) lo = mid + 1;
+			else hi = mid;
+		}
+		if ((lo == nrec) || (src_rec[lo] != recptr)) return 0;
+		_put24(entry+3, dst_rec[lo]);
+	}
+	return 1;
 }
 
-// Returns the string width in pixels.
-// Useful for positions strings on the screen.
-//===============================
-int TFT_getStringWidth(char* str)
+// Run-length code the glyphs of the 1 bit per pixel proportional font 'src' of 'size' bytes to 'dst'
+// Glyph run codes take at most 2 bits per pixel, 'dst' must have at least (size * 2) bytes
+// Returns the size of the coded font, 0 if the font can not be coded or is not smaller
+//-----------------------------------------------------------------
+static int _encodeFontRLE(const uint8_t *src, int size, uint8_t *dst)
 {
-    int strWidth = 0;
+	uint8_t bpp, rle, unicode;
+	if ((size < 7) || (src[0] != 0)) return 0;
+	_glyphFormat(src[2], &bpp, &rle, &unicode);
+	if ((bpp != 1) || (rle)) return 0;
+
+	int sptr = _fontFirstGlyph(src, unicode);
+	int dptr = sptr;
+	if (sptr >= size) return 0;
+
+	// record offsets of the Unicode font, to set them in the code point table
+	uint32_t nrec = 0;
+	uint32_t *src_rec = NULL;
+	uint32_t *dst_rec = NULL;
+	int res = 0;
+	if (unicode) {
+		src_rec = malloc(_fontGlyphCount(src) * sizeof(uint32_t) * 2);
+		if (src_rec == NULL) return 0;
+		dst_rec = src_rec + _fontGlyphCount(src);
+	}
 
-	if (cfont.bitmap == 2) strWidth = ((_7seg_width()+2) * strlen(str)) - 2;	// 7-segment font
-	else if (cfont.x_size != 0) strWidth = strlen(str) * cfont.x_size;			// fixed width font
-	else {
-		// calculate the width of the string of proportional characters
-		char* tempStrptr = str;
-		while (*tempStrptr != 0) {
-			if (getCharPtr(*tempStrptr++)) {
-				strWidth += (((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta) + 1);
+	memset(dst, 0, size * 2);
+	memcpy(dst, src, sptr);
+	dst[2] = (unicode) ? (GLYPH_FORMAT_RLE | (src[2] & (GLYPH_FORMAT_UNICODE | GLYPH_FORMAT_METRICS))) : GLYPH_FORMAT_RLE;
+
+	while ((sptr < size) && (src[sptr] != 0xFF)) {
+		if ((sptr + 6) > size) goto exit;
+		int width = src[sptr+2];
+		int npixels = width * src[sptr+3];
+		int datasize = (width) ? (((npixels - 1) / 8) + 1) : 0;
+		if ((sptr + 6 + datasize) > size) goto exit;
+		if (unicode) {
+			if (nrec == _fontGlyphCount(src)) goto exit;
+			src_rec[nrec] = sptr;
+			dst_rec[nrec++] = dptr;
+		}
+		memcpy(dst+dptr, src+sptr, 6);
+		sptr += 6;
+		dptr += 6;
+
+		// pixel runs, alternating from background; the last run is also coded
+		int pos = 0;
+		int len = 0;
+		int first = 1;
+		uint8_t value = 0;
+		for (int n = 0; n < npixels; n++) {
+			uint8_t pixel = (src[sptr + (n / 8)] >> (7 - (n % 8))) & 1;
+			if (pixel != value) {
+				_putGlyphRun(dst+dptr, &pos, len, first);
+				value = pixel;
+				len = 0;
+				first = 0;
 			}
+			len++;
 		}
-		strWidth--;
+		if (len) _putGlyphRun(dst+dptr, &pos, len, first);
+		sptr += datasize;
+		dptr += (pos + 7) / 8;
 	}
-	return strWidth;
+	if (sptr >= size) goto exit;
+	if ((unicode) && (!_remapFontTable(dst, src_rec, dst_rec, nrec))) goto exit;
+
+	// end of font and anything after it
+	memcpy(dst+dptr, src+sptr, size - sptr);
+	dptr += size - sptr;
+	if (dptr < size) res = dptr;
+
+exit:
+	if (src_rec) free(src_rec);
+	return res;
 }
 
-//===============================================
-void TFT_clearStringRect(int x, int y, char *str)
+//--------------------------------------------------
+int compile_font_file(char *fontfile, uint8_t flags)
 {
-	int w = TFT_getStringWidth(str);
-	int h = TFT_getfontheight();
-	TFT_fillRect(x+dispWin.x1, y+dispWin.y1, w, h, _bg);
-}
+	int err = 0;
+	char err_msg[128] = {'\0'};
+	char outfile[128] = {'\0'};
+	size_t len;
+    struct stat sb;
+    FILE *ffd = NULL;
+    FILE *ffd_out = NULL;
+    char *sourcebuf = NULL;
+    uint8_t *rlebuf = NULL;
 
-//==============================================================================
-/**
- * bit-encoded bar position of all digits' bcd segments
- *
- *           6
- * 		  +-----+
- * 		3 |  .	| 2
- * 		  +--5--+
- * 		1 |  .	| 0
- * 		  +--.--+
- * 		     4
- */
-static const uint16_t font_bcd[] = {
-  0x200, // 0010 0000 0000  // -
-  0x080, // 0000 1000 0000  // .
+    len = strlen(fontfile);
+
+	// check here that filename end with ".c".
+	if ((len < 3) || (len > 125) || (strcmp(fontfile + len - 2, ".c") != 0)) {
+		sprintf(err_msg, "not a .c file");
+		err = 1;
+		goto exit;
+	}
+
+	sprintf(outfile, "%s", fontfile);
+	sprintf(outfile+strlen(outfile)-1, "fon");
+
+	// Open the source file
+    if (stat(fontfile, &sb) != 0) {
+    	sprintf(err_msg, "Error opening source file '%s'", fontfile);
+    	err = 2;
+		goto exit;
+    }
+    // Open the file
+    ffd = fopen(fontfile, "rb");
+    if (!ffd) {
+    	sprintf(err_msg, "Error opening source file '%s'", fontfile);
+    	err = 3;
+		goto exit;
+    }
+
+	// Open the font file
+    ffd_out= fopen(outfile, "wb");
+	if (!ffd_out) {
+		sprintf(err_msg, "error opening destination file");
+		err = 4;
+		goto exit;
+	}
+
+	// Get file size
+	int fsize = sb.st_size;
+	if (fsize <= 0) {
+		sprintf(err_msg, "source file size error");
+		err = 5;
+		goto exit;
+	}
+
+	sourcebuf = malloc(fsize+4);
+	if (sourcebuf == NULL) {
+		sprintf(err_msg, "memory allocation error");
+		err = 6;
+		goto exit;
+	}
+	char *fbuf = sourcebuf;
+
+	int rdsize = fread(fbuf, 1, fsize, ffd);
+	fclose(ffd);
+	ffd = NULL;
+
+	if (rdsize != fsize) {
+		sprintf(err_msg, "error reading from source file");
+		err = 7;
+		goto exit;
+	}
+
+	*(fbuf+rdsize) = '\0';
+
+	fbuf = strchr(fbuf, '{');			// beginning of font data
+	char *fend = strstr(fbuf, "};");	// end of font data
+
+	if ((fbuf == NULL) || (fend == NULL) || ((fend-fbuf) < 22)) {
+		sprintf(err_msg, "wrong source file format");
+		err = 8;
+		goto exit;
+	}
+
+	fbuf++;
+	*fend = '\0';
+	char hexstr[5] = {'\0'};
+	int lastline = 0;
+
+	fbuf = strstr(fbuf, "0x");
+	int size = 0;
+	char *nextline;
+	char *numptr;
+
+	// font data bytes are stored to the beginning of the source buffer, behind the parsed text
+	uint8_t *fontdata = (uint8_t *)sourcebuf;
+
+	while ((fbuf != NULL) && (fbuf < fend) && (lastline == 0)) {
+		nextline = strchr(fbuf, '\n'); // beginning of the next line
+		if (nextline == NULL) {
+			nextline = fend-1;
+			lastline++;
+		}
+		else nextline++;
+
+		while (fbuf < nextline) {
+			numptr = strstr(fbuf, "0x");
+			if ((numptr == NULL) || ((fbuf+4) > nextline)) numptr = strstr(fbuf, "0X");
+			if ((numptr != NULL) && ((numptr+4) <= nextline)) {
+				fbuf = numptr;
+				memcpy(hexstr, fbuf, 4);
+				hexstr[4] = 0;
+				fontdata[size++] = (uint8_t)strtol(hexstr, NULL, 0);
+				fbuf += 4;
+			}
+			else fbuf = nextline;
+		}
+		fbuf = nextline;
+	}
+
+	if (flags & COMPILE_FONT_RLE) {
+		// run-length code the glyphs if the font becomes smaller
+		rlebuf = malloc(size * 2);
+		int rle_size = (rlebuf) ? _encodeFontRLE(fontdata, size, rlebuf) : 0;
+		if (flags & COMPILE_FONT_DEBUG) {
+			if (rle_size) printf("Run-length coded font: %d -> %d bytes\r\n", size, rle_size);
+			else printf("Font not run-length coded\r\n");
+		}
+		if (rle_size) {
+			fontdata = rlebuf;
+			size = rle_size;
+		}
+	}
+
+    if (fwrite(fontdata, 1, size, ffd_out) != size) goto error;
+
+	// write font ID
+	sprintf(outfile, "RPH_font");
+    if (fwrite(outfile, 1, 8, ffd_out) != 8) goto error;
+
+    fclose(ffd_out);
+    ffd_out = NULL;
+
+	// === Test compiled font ===
+	sprintf(outfile, "%s", fontfile);
+	sprintf(outfile+strlen(outfile)-1, "fon");
+
+	userFont *uf = NULL;
+	if (load_file_font(outfile, flags & COMPILE_FONT_DEBUG, &uf) != 0) {
+		sprintf(err_msg, "Error compiling file!");
+		err = 10;
+	}
+	else {
+		_userFontRelease(uf);
+		sprintf(err_msg, "File compiled successfully.");
+	}
+
+	goto exit;
+
+error:
+	sprintf(err_msg, "error writing to destination file");
+	err = 9;
+
+exit:
+	if (sourcebuf) free(sourcebuf);
+	if (rlebuf) free(rlebuf);
+	if (ffd) fclose(ffd);
+	if (ffd_out) fclose(ffd_out);
+
+	if (flags & COMPILE_FONT_DEBUG) printf("%s\r\n", err_msg);
+
+	return err;
+}
+
+
+// -----------------------------------------------------------------------------------------
+// Individual Proportional Font Character Format:
+// -----------------------------------------------------------------------------------------
+// Character Code
+// yOffset				(start Y of visible pixels)
+// Width				(width of the visible pixels)
+// Height				(height of the visible pixels)
+// xOffset				(start X of visible pixels)
+// xDelta				(the distance to move the cursor. Effective width of the character.)
+// Data[n]
+// -----------------------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------------------------
+// Character drawing rectangle is (0, 0) (xDelta-1, cfont.y_size-1)
+// Character visible pixels rectangle is (xOffset, yOffset) (xOffset+Width-1, yOffset+Height-1)
+//---------------------------------------------------------------------------------------------
+
+//----------------------------------
+void getFontCharacters(uint8_t *buf)
+{
+    if (cfont.bitmap == 2) {
+    	//For 7 segment font only characters 0,1,2,3,4,5,6,7,8,9, . , - , : , / are available.
+		for (uint8_t n=0; n < 11; n++) {
+			buf[n] = n + 0x30;
+		}
+		buf[11] = '.';
+		buf[12] = '-';
+		buf[13] = '/';
+		buf[14] = '\0';
+    	return;
+    }
+
+    if (cfont.x_size > 0) {
+		for (uint8_t n=0; n < cfont.numchars; n++) {
+			buf[n] = cfont.offset + n;
+		}
+		buf[cfont.numchars] = '\0';
+		return;
+	}
+
+	if (cfont.unicode) {
+		// characters with 8-bit codes from the code point table
+		uint32_t nglyphs = _fontGlyphCount(cfont.font);
+		uint8_t n = 0;
+		for (uint32_t i=0; i < nglyphs; i++) {
+			uint32_t code = _get24(cfont.font + FONT_UNICODE_TABLE + (i * FONT_UNICODE_ENTRY));
+			if (code > 0xFF) break;
+			if (code > 0) buf[n++] = code;
+		}
+		buf[n] = '\0';
+		return;
+	}
+
+	uint32_t tempPtr = 4; // point at first char data
+	uint8_t cc, cw, ch, n;
+
+	n = 0;
+    cc = cfont.font[tempPtr++];
+    while (cc != 0xFF)  {
+    	cfont.numchars++;
+        tempPtr++;
+        cw = cfont.font[tempPtr++];
+        ch = cfont.font[tempPtr++];
+        tempPtr++;
+        tempPtr++;
+		// packed glyph pixels
+		tempPtr += _fontGlyphSize(tempPtr, cw, ch);
+		buf[n++] = cc;
+	    cc = cfont.font[tempPtr++];
+	}
+	buf[n] = '\0';
+}
+
+// Set max width & height of the proportional font
+// If 'offset' is not NULL, glyph data offset of each character is saved to it
+//---------------------------------------------
+static void getMaxWidthHeight(uint32_t *offset)
+{
+	uint32_t tempPtr = _fontFirstGlyph(cfont.font, cfont.unicode); // point at first char data
+	uint8_t cc, cw, ch, cd, cy;
+
+	cfont.numchars = 0;
+	cfont.max_x_size = 0;
+
+    cc = cfont.font[tempPtr++];
+    while (cc != 0xFF)  {
+    	if ((offset) && (offset[cc] == 0)) offset[cc] = tempPtr-1;
+    	cfont.numchars++;
+        cy = cfont.font[tempPtr++];
+        cw = cfont.font[tempPtr++];
+        ch = cfont.font[tempPtr++];
+        tempPtr++;
+        cd = cfont.font[tempPtr++];
+        cy += ch;
+		if (cw > cfont.max_x_size) cfont.max_x_size = cw;
+		if (cd > cfont.max_x_size) cfont.max_x_size = cd;
+		if (ch > cfont.y_size) cfont.y_size = ch;
+		if (cy > cfont.y_size) cfont.y_size = cy;
+		// packed glyph pixels
+		tempPtr += _fontGlyphSize(tempPtr, cw, ch);
+	    cc = cfont.font[tempPtr++];
+	}
+    cfont.size = tempPtr;
+}
+
+// Set the metrics and glyph index of the current proportional font
+// The index is taken from cache or built and added to cache
+// Unicode font with precomputed metrics needs no index
+//--------------------------
+static void setFontIndex()
+{
+	int i;
+	fontIndex *fi = NULL;
+
+	cfont.index = NULL;
+
+	if ((cfont.unicode) && (cfont.font[2] & GLYPH_FORMAT_METRICS) && (cfont.font[3])) {
+		// precomputed metrics, glyphs are found in the code point table
+		cfont.numchars = _fontGlyphCount(cfont.font);
+		cfont.max_x_size = cfont.font[3];
+		cfont.size = 0;
+		return;
+	}
+
+	portENTER_CRITICAL(&font_index_mux);
+	for (i=0; i<FONT_INDEX_CACHE_SIZE; i++) {
+		if ((font_index[i]) && (font_index[i]->font == cfont.font)) {
+			fi = font_index[i];
+			fi->last_used = ++font_index_clock;
+			cfont.numchars = fi->numchars;
+			cfont.size = fi->size;
+			cfont.max_x_size = fi->max_x_size;
+			cfont.y_size = fi->y_size;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&font_index_mux);
+
+	if (fi == NULL) {
+		// ** Not in cache, build the index
+		fontIndex *new_fi = calloc(1, sizeof(fontIndex));
+		getMaxWidthHeight(((new_fi) && (!cfont.unicode)) ? new_fi->offset : NULL);
+		if (new_fi == NULL) return;
+
+		new_fi->numchars = cfont.numchars;
+		new_fi->size = cfont.size;
+		new_fi->max_x_size = cfont.max_x_size;
+		new_fi->y_size = cfont.y_size;
+
+		// use an empty slot, else rebuild a removed or the least recently used index
+		fontIndex *slot = NULL;
+		int empty = -1;
+		portENTER_CRITICAL(&font_index_mux);
+		for (i=0; i<FONT_INDEX_CACHE_SIZE; i++) {
+			if ((font_index[i]) && (font_index[i]->font == cfont.font)) {
+				// added in the meantime
+				fi = font_index[i];
+				break;
+			}
+			if (font_index[i] == NULL) {
+				if (empty < 0) empty = i;
+			}
+			else if (!font_index[i]->building) {
+				if ((slot == NULL) || ((slot->font) && ((font_index[i]->font == NULL) || (font_index[i]->last_used < slot->last_used)))) {
+					slot = font_index[i];
+				}
+			}
+		}
+		new_fi->last_used = ++font_index_clock;
+		if (fi) slot = NULL;
+		else if (empty >= 0) {
+			new_fi->font = cfont.font;
+			font_index[empty] = new_fi;
+			fi = new_fi;
+			new_fi = NULL;
+			slot = NULL;
+		}
+		else if (slot) {
+			// readers do not use the slot while its font is NULL
+			slot->font = NULL;
+			slot->building = 1;
+		}
+		portEXIT_CRITICAL(&font_index_mux);
+
+		if (slot) {
+			memcpy(slot->offset, new_fi->offset, sizeof(slot->offset));
+			portENTER_CRITICAL(&font_index_mux);
+			slot->numchars = new_fi->numchars;
+			slot->size = new_fi->size;
+			slot->max_x_size = new_fi->max_x_size;
+			slot->y_size = new_fi->y_size;
+			slot->last_used = new_fi->last_used;
+			slot->font = cfont.font;
+			slot->building = 0;
+			portEXIT_CRITICAL(&font_index_mux);
+			fi = slot;
+		}
+		if (new_fi) free(new_fi);
+		if (fi == NULL) return;		// all slots are being rebuilt, no index
+	}
+
+	// glyphs of the Unicode font are found in its code point table
+	cfont.index = (cfont.unicode) ? NULL : fi;
+}
+
+// Return the Glyph data for an individual character in the proportional font
+//-------------------------------------
+static uint8_t getCharPtr(uint32_t c) {
+  uint32_t tempPtr = 4; // point at first char data
+
+  if (cfont.unicode) {
+	// glyph record offset is taken from the code point table, the record's code byte is 0
+	tempPtr = _fontFindGlyph(c);
+	if (tempPtr == 0) return 0;
+	tempPtr++;
+    fontChar.adjYOffset = cfont.font[tempPtr++];
+    fontChar.width = cfont.font[tempPtr++];
+    fontChar.height = cfont.font[tempPtr++];
+    fontChar.xOffset = cfont.font[tempPtr++];
+    fontChar.xOffset = fontChar.xOffset < 0x80 ? fontChar.xOffset : -(0xFF - fontChar.xOffset);
+    fontChar.xDelta = cfont.font[tempPtr++];
+    fontChar.charCode = c;
+    fontChar.dataPtr = tempPtr;
+    if (font_forceFixed > 0) {
+      // fix width & offset for forced fixed width
+      fontChar.xDelta = cfont.max_x_size;
+      fontChar.xOffset = (fontChar.xDelta - fontChar.width) / 2;
+    }
+    return 1;
+  }
+  if (c > 0xFF) return 0;
+
+  if (cfont.index) {
+	// glyph data offset is taken from the font index
+	int32_t offset = _fontIndexOffset(cfont.index, c);
+	if (offset == 0) return 0;
+	if (offset > 0) tempPtr = offset;
+	else cfont.index = NULL;	// index slot reused for another font, the font is scanned
+  }
+
+  do {
+	fontChar.charCode = cfont.font[tempPtr++];
+    if (fontChar.charCode == 0xFF) return 0;
+
+    fontChar.adjYOffset = cfont.font[tempPtr++];
+    fontChar.width = cfont.font[tempPtr++];
+    fontChar.height = cfont.font[tempPtr++];
+    fontChar.xOffset = cfont.font[tempPtr++];
+    fontChar.xOffset = fontChar.xOffset < 0x80 ? fontChar.xOffset : -(0xFF - fontChar.xOffset);
+    fontChar.xDelta = cfont.font[tempPtr++];
+
+    if (c != fontChar.charCode && fontChar.charCode != 0xFF) {
+      // packed glyph pixels
+      tempPtr += _fontGlyphSize(tempPtr, fontChar.width, fontChar.height);
+    }
+  } while ((c != fontChar.charCode) && (fontChar.charCode != 0xFF));
+
+  fontChar.dataPtr = tempPtr;
+  if (c == fontChar.charCode) {
+    if (font_forceFixed > 0) {
+      // fix width & offset for forced fixed width
+      fontChar.xDelta = cfont.max_x_size;
+      fontChar.xOffset = (fontChar.xDelta - fontChar.width) / 2;
+    }
+  }
+  else return 0;
+
+  return 1;
+}
+
+/*
+//-----------------------
+static void _testFont() {
+  if (cfont.x_size) {
+	  printf("FONT TEST: fixed font\r\n");
+	  return;
+  }
+  uint16_t tempPtr = 4; // point at first char data
+  uint8_t c = 0x20;
+  for (c=0x20; c <0xFF; c++) {
+	fontChar.charCode = cfont.font[tempPtr++];
+    if (fontChar.charCode == 0xFF) break;
+    if (fontChar.charCode != c) {
+    	printf("FONT TEST: last sequential char: %d, expected %d\r\n", fontChar.charCode, c);
+    	break;
+    }
+    c = fontChar.charCode;
+    fontChar.adjYOffset = cfont.font[tempPtr++];
+    fontChar.width = cfont.font[tempPtr++];
+    fontChar.height = cfont.font[tempPtr++];
+    fontChar.xOffset = cfont.font[tempPtr++];
+    fontChar.xOffset = fontChar.xOffset < 0x80 ? fontChar.xOffset : -(0xFF - fontChar.xOffset);
+    fontChar.xDelta = cfont.font[tempPtr++];
+
+    if (fontChar.charCode != 0xFF) {
+      if (fontChar.width != 0) {
+        // packed bits
+        tempPtr += (((fontChar.width * fontChar.height)-1) / 8) + 1;
+      }
+    }
+  }
+  printf("FONT TEST: W=%d  H=%d last char: %d [%c]; length: %d\r\n", cfont.max_x_size, cfont.y_size, c, c, tempPtr);
+}
+*/
+
+//===================================================
+void TFT_setFont(uint8_t font, const char *font_file)
+{
+  cfont.font = NULL;
+  cfont.index = NULL;
+
+  if (font == FONT_7SEG) {
+    cfont.bitmap = 2;
+    cfont.x_size = 24;
+    cfont.y_size = 6;
+    cfont.offset = 0;
+    cfont.color  = _fg;
+  }
+  else {
+	  if (font == USER_FONT) {
+		  tft_ctx_t *ctx = TFT_CTX;
+		  if (font_file != NULL) {
+			  // the new font replaces the font the context loaded before
+			  userFont *uf;
+			  load_file_font(font_file, 0, &uf);
+			  _userFontRelease(ctx->user_font);
+			  ctx->user_font = uf;
+		  }
+		  // without the file name, the font file already loaded by the context is selected
+		  cfont.font = (ctx->user_font) ? ctx->user_font->font : tft_DefaultFont;
+	  }
+	  else if (font == DEJAVU18_FONT) cfont.font = tft_Dejavu18;
+	  else if (font == DEJAVU24_FONT) cfont.font = tft_Dejavu24;
+	  else if (font == UBUNTU16_FONT) cfont.font = tft_Ubuntu16;
+	  else if (font == COMIC24_FONT) cfont.font = tft_Comic24;
+	  else if (font == MINYA24_FONT) cfont.font = tft_minya24;
+	  else if (font == TOONEY32_FONT) cfont.font = tft_tooney32;
+	  else if (font == SMALL_FONT) cfont.font = tft_SmallFont;
+	  else if (font == DEF_SMALL_FONT) cfont.font = tft_def_small;
+	  else cfont.font = tft_DefaultFont;
+
+	  cfont.bitmap = 1;
+	  cfont.bpp = 1;
+	  cfont.rle = 0;
+	  cfont.unicode = 0;
+	  cfont.paged = ((TFT_CTX->user_font) && (cfont.font == TFT_CTX->user_font->font) && (TFT_CTX->user_font->ff));
+	  cfont.x_size = cfont.font[0];
+	  cfont.y_size = cfont.font[1];
+	  if (cfont.x_size > 0) {
+		  cfont.offset = cfont.font[2];
+		  cfont.numchars = cfont.font[3];
+		  cfont.size = cfont.x_size * cfont.y_size * cfont.numchars;
+	  }
+	  else {
+		  cfont.offset = 4;
+		  // 3rd header byte of the proportional font is glyph pixel format, 0 in 1-bit fonts
+		  _glyphFormat(cfont.font[2], &cfont.bpp, &cfont.rle, &cfont.unicode);
+		  setFontIndex();
+	  }
+	  //_testFont();
+  }
+}
+
+// -----------------------------------------------------------------------------------------
+// Individual Proportional Font Character Format:
+// -----------------------------------------------------------------------------------------
+// Character Code
+// yOffset				(start Y of visible pixels)
+// Width				(width of the visible pixels)
+// Height				(height of the visible pixels)
+// xOffset				(start X of visible pixels)
+// xDelta				(the distance to move the cursor. Effective width of the character.)
+// Data[n]
+// -----------------------------------------------------------------------------------------
+//---------------------------------------------------------------------------------------------
+// Character drawing rectangle is (0, 0) (xDelta-1, cfont.y_size-1)
+// Character visible pixels rectangle is (xOffset, yOffset) (xOffset+Width-1, yOffset+Height-1)
+//---------------------------------------------------------------------------------------------
+
+// print non-rotated proportional character
+// character is already in fontChar
+//----------------------------------------------
+static int printProportionalChar(int x, int y) {
+	tft_ctx_t *ctx = TFT_CTX;
+	tft_fb_t *fb = tft_fb;
+	int i, j, char_width;
+
+	char_width = ((ctx->prop_char.width > ctx->prop_char.xDelta) ? ctx->prop_char.width : ctx->prop_char.xDelta);
+
+	if ((ctx->buffered_char) && (!ctx->transparent)) {
+		int len, bufPos;
+
+		// === buffer Glyph data for faster sending ===
+		len = char_width * ctx->font.y_size;
+		color_t *color_line = heap_caps_malloc(len*3, MALLOC_CAP_DMA);
+		if (color_line) {
+			// fill with background color
+			for (int n = 0; n < len; n++) {
+				color_line[n] = ctx->bg;
+			}
+			// set character pixels to foreground color, or blended color in anti-aliased font
+			color_t *lut = _glyphLUT(ctx);
+			glyphReader gr;
+			_glyphReaderInit(&gr, _glyphData(), ctx->font.bpp, ctx->font.rle);
+			for (j=0; j < ctx->prop_char.height; j++) {
+				bufPos = ((j + ctx->prop_char.adjYOffset) * char_width) + ctx->prop_char.xOffset;  // bufY + bufX
+				for (i=0; i < ctx->prop_char.width; ) {
+					uint8_t v;
+					int run = _glyphRun(&gr, ctx->prop_char.width - i, &v);
+					if (v != 0) {
+						// visible pixels
+						for (int n = 0; n < run; n++) {
+							color_line[bufPos + i + n] = lut[v];
+						}
+					}
+					i += run;
+				}
+			}
+			// send to display in one transaction
+			disp_select();
+			send_data(x, y, x+char_width-1, y+ctx->font.y_size-1, len, color_line);
+			disp_deselect();
+			free(color_line);
+
+			return char_width;
+		}
+	}
+
+	int cy, run;
+
+	if (!ctx->transparent) _fillRect(x, y, char_width+1, ctx->font.y_size, ctx->bg);
+
+	// draw Glyph, each run of visible pixels of the same value in the glyph row is drawn as one span
+	color_t *lut = _glyphLUT(ctx);
+	uint8_t max_level = (1 << ctx->font.bpp) - 1;
+	uint8_t v;
+	glyphReader gr;
+	_glyphReaderInit(&gr, _glyphData(), ctx->font.bpp, ctx->font.rle);
+	disp_select();
+	for (j=0; j < ctx->prop_char.height; j++) {
+		cy = y+j+ctx->prop_char.adjYOffset;
+		for (i=0; i < ctx->prop_char.width; i += run) {
+			run = _glyphRun(&gr, ctx->prop_char.width - i, &v);
+			// with unknown background anti-aliased pixels are drawn in foreground color or not drawn
+			if (ctx->transparent) v = (GLYPH_PIXEL_VISIBLE(ctx, v)) ? max_level : 0;
+			if (v != 0) _ctxSpan(ctx, fb, x+ctx->prop_char.xOffset+i, cy, run, lut[v]);
+		}
+	}
+	disp_deselect();
+
+	return char_width;
+}
+
+// non-rotated fixed width character
+//----------------------------------------------
+static void printChar(uint8_t c, int x, int y) {
+	tft_ctx_t *ctx = TFT_CTX;
+	tft_fb_t *fb = tft_fb;
+	uint8_t i, j, ch, fz, mask;
+	uint16_t k, temp, len;
+
+	// fz = bytes per char row
+	fz = ctx->font.x_size/8;
+	if (ctx->font.x_size % 8) fz++;
+
+	// get character position in buffer
+	temp = ((c-ctx->font.offset)*((fz)*ctx->font.y_size))+4;
+
+	if ((ctx->buffered_char) && (!ctx->transparent)) {
+		// === buffer Glyph data for faster sending ===
+		len = ctx->font.x_size * ctx->font.y_size;
+		color_t *color_line = heap_caps_malloc(len*3, MALLOC_CAP_DMA);
+		if (color_line) {
+			// fill with background color
+			for (int n = 0; n < len; n++) {
+				color_line[n] = ctx->bg;
+			}
+			// set character pixels to foreground color
+			for (j=0; j<ctx->font.y_size; j++) {
+				for (k=0; k < fz; k++) {
+					ch = ctx->font.font[temp+k];
+					mask=0x80;
+					for (i=0; i<8; i++) {
+						if ((ch & mask) !=0) color_line[(j*ctx->font.x_size) + (i+(k*8))] = ctx->fg;
+						mask >>= 1;
+					}
+				}
+				temp += (fz);
+			}
+			// send to display in one transaction
+			disp_select();
+			send_data(x, y, x+ctx->font.x_size-1, y+ctx->font.y_size-1, len, color_line);
+			disp_deselect();
+			free(color_line);
+
+			return;
+		}
+	}
+
+	if (!ctx->transparent) _fillRect(x, y, ctx->font.x_size, ctx->font.y_size, ctx->bg);
+
+	// draw Glyph, each run of visible pixels in the glyph row is drawn as one span
+	int run;
+	disp_select();
+	for (j=0; j<ctx->font.y_size; j++) {
+		run = 0;
+		for (k=0; k < fz; k++) {
+			ch = ctx->font.font[temp+k];
+			mask=0x80;
+			for (i=0; i<8; i++) {
+				if ((ch & mask) !=0) run++;
+				else if (run) {
+					_ctxSpan(ctx, fb, x+i+(k*8)-run, y+j, run, ctx->fg);
+					run = 0;
+				}
+				mask >>= 1;
+			}
+		}
+		if (run) _ctxSpan(ctx, fb, x+(fz*8)-run, y+j, run, ctx->fg);
+		temp += (fz);
+	}
+	disp_deselect();
+}
+
+// print rotated proportional character
+// character is already in fontChar
+//---------------------------------------------------
+static int rotatePropChar(int x, int y, int offset) {
+  tft_ctx_t *ctx = TFT_CTX;
+  tft_fb_t *fb = tft_fb;
+  double radian = ctx->rotate * DEG_TO_RAD;
+  float cos_radian = cos(radian);
+  float sin_radian = sin(radian);
+
+  color_t *lut = _glyphLUT(ctx);
+  glyphReader gr;
+  _glyphReaderInit(&gr, _glyphData(), ctx->font.bpp, ctx->font.rle);
+  disp_select();
+  for (int j=0; j < ctx->prop_char.height; j++) {
+    for (int i=0; i < ctx->prop_char.width; i++) {
+      uint8_t v = _glyphPixel(&gr);
+
+      int newX = (int)(x + (((offset + i) * cos_radian) - ((j+ctx->prop_char.adjYOffset)*sin_radian)));
+      int newY = (int)(y + (((j+ctx->prop_char.adjYOffset) * cos_radian) + ((offset + i) * sin_radian)));
+
+      if (!ctx->transparent) _ctxPixel(ctx, fb, newX,newY,lut[v]);
+      else if (GLYPH_PIXEL_VISIBLE(ctx, v)) _ctxPixel(ctx, fb, newX,newY,ctx->fg);
+    }
+  }
+  disp_deselect();
+
+  return ctx->prop_char.xDelta+1;
+}
+
+// rotated fixed width character
+//--------------------------------------------------------
+static void rotateChar(uint8_t c, int x, int y, int pos) {
+  tft_ctx_t *ctx = TFT_CTX;
+  tft_fb_t *fb = tft_fb;
+  uint8_t i,j,ch,fz,mask;
+  uint16_t temp;
+  int newx,newy;
+  double radian = ctx->rotate*0.0175;
+  float cos_radian = cos(radian);
+  float sin_radian = sin(radian);
+  int zz;
+
+  if( ctx->font.x_size < 8 ) fz = ctx->font.x_size;
+  else fz = ctx->font.x_size/8;
+  temp=((c-ctx->font.offset)*((fz)*ctx->font.y_size))+4;
+
+  disp_select();
+  for (j=0; j<ctx->font.y_size; j++) {
+    for (zz=0; zz<(fz); zz++) {
+      ch = ctx->font.font[temp+zz];
+      mask = 0x80;
+      for (i=0; i<8; i++) {
+        newx=(int)(x+(((i+(zz*8)+(pos*ctx->font.x_size))*cos_radian)-((j)*sin_radian)));
+        newy=(int)(y+(((j)*cos_radian)+((i+(zz*8)+(pos*ctx->font.x_size))*sin_radian)));
+
+        if ((ch & mask) != 0) _ctxPixel(ctx, fb, newx,newy,ctx->fg);
+        else if (!ctx->transparent) _ctxPixel(ctx, fb, newx,newy,ctx->bg);
+        mask >>= 1;
+      }
+    }
+    temp+=(fz);
+  }
+  disp_deselect();
+  // calculate x,y for the next char
+  ctx->x = (int)(x + ((pos+1) * ctx->font.x_size * cos_radian));
+  ctx->y = (int)(y + ((pos+1) * ctx->font.x_size * sin_radian));
+}
+
+//----------------------
+static int _7seg_width()
+{
+	return (2 * (2 * cfont.y_size + 1)) + cfont.x_size;
+}
+
+//-----------------------
+static int _7seg_height()
+{
+	return (3 * (2 * cfont.y_size + 1)) + (2 * cfont.x_size);
+}
+
+// Return the next character of the string and advance the string pointer
+// If 'text_utf8' is set, UTF-8 sequence is decoded to the code point; invalid bytes are returned as they are
+//--------------------------------------
+static uint32_t _nextChar(const char **str)
+{
+	const uint8_t *s = (const uint8_t *)*str;
+	uint32_t c = *s++;
+
+	if ((text_utf8) && (c >= 0xC0) && (c < 0xF8)) {
+		int n = (c >= 0xF0) ? 3 : ((c >= 0xE0) ? 2 : 1);	// continuation bytes
+		uint32_t code = c & (0x3F >> n);
+		int i;
+		for (i=0; i<n; i++) {
+			if ((s[i] & 0xC0) != 0x80) break;
+			code = (code << 6) | (s[i] & 0x3F);
+		}
+		if (i == n) {
+			c = code;
+			s += n;
+		}
+	}
+	*str = (const char *)s;
+	return c;
+}
+
+// Number of characters in the string
+//-----------------------------------
+static int _strChars(const char *str)
+{
+	int n = 0;
+	while (*str != 0) {
+		_nextChar(&str);
+		n++;
+	}
+	return n;
+}
+
+// Returns the string width in pixels.
+// Useful for positions strings on the screen.
+//===============================
+int TFT_getStringWidth(char* str)
+{
+    int strWidth = 0;
+
+	if (cfont.bitmap == 2) strWidth = ((_7seg_width()+2) * _strChars(str)) - 2;	// 7-segment font
+	else if (cfont.x_size != 0) strWidth = _strChars(str) * cfont.x_size;			// fixed width font
+	else {
+		// calculate the width of the string of proportional characters
+		const char* tempStrptr = str;
+		while (*tempStrptr != 0) {
+			if (getCharPtr(_nextChar(&tempStrptr))) {
+				strWidth += (((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta) + 1);
+			}
+		}
+		strWidth--;
+	}
+	return strWidth;
+}
+
+//===============================================
+void TFT_clearStringRect(int x, int y, char *str)
+{
+	int w = TFT_getStringWidth(str);
+	int h = TFT_getfontheight();
+	TFT_fillRect(x+dispWin.x1, y+dispWin.y1, w, h, _bg);
+}
+
+//==============================================================================
+/**
+ * bit-encoded bar position of all digits' bcd segments
+ *
+ *           6
+ * 		  +-----+
+ * 		3 |  .	| 2
+ * 		  +--5--+
+ * 		1 |  .	| 0
+ * 		  +--.--+
+ * 		     4
+ */
+static const uint16_t font_bcd[] = {
+  0x200, // 0010 0000 0000  // -
+  0x080, // 0000 1000 0000  // .
   0x06C, // 0100 0110 1100  // /, degree
   0x05f, // 0000 0101 1111, // 0
   0x005, // 0000 0000 0101, // 1
@@ -1831,415 +3262,2626 @@ static const uint16_t font_bcd[] = {
   0x900  // 1001 0000 0000  // :
 };
 
-//-----------------------------------------------------------------------------------------------
-static void barVert(int16_t x, int16_t y, int16_t w, int16_t l, color_t color, color_t outline) {
-  _fillTriangle(x+1, y+2*w, x+w, y+w+1, x+2*w-1, y+2*w, color);
-  _fillTriangle(x+1, y+2*w+l+1, x+w, y+3*w+l, x+2*w-1, y+2*w+l+1, color);
-  _fillRect(x, y+2*w+1, 2*w+1, l, color);
-  if (cfont.offset) {
-    _drawTriangle(x+1, y+2*w, x+w, y+w+1, x+2*w-1, y+2*w, outline);
-    _drawTriangle(x+1, y+2*w+l+1, x+w, y+3*w+l, x+2*w-1, y+2*w+l+1, outline);
-    _drawRect(x, y+2*w+1, 2*w+1, l, outline);
+//-----------------------------------------------------------------------------------------------
+static void barVert(int16_t x, int16_t y, int16_t w, int16_t l, color_t color, color_t outline) {
+  _fillTriangle(x+1, y+2*w, x+w, y+w+1, x+2*w-1, y+2*w, color);
+  _fillTriangle(x+1, y+2*w+l+1, x+w, y+3*w+l, x+2*w-1, y+2*w+l+1, color);
+  _fillRect(x, y+2*w+1, 2*w+1, l, color);
+  if (cfont.offset) {
+    _drawTriangle(x+1, y+2*w, x+w, y+w+1, x+2*w-1, y+2*w, outline);
+    _drawTriangle(x+1, y+2*w+l+1, x+w, y+3*w+l, x+2*w-1, y+2*w+l+1, outline);
+    _drawRect(x, y+2*w+1, 2*w+1, l, outline);
+  }
+}
+
+//----------------------------------------------------------------------------------------------
+static void barHor(int16_t x, int16_t y, int16_t w, int16_t l, color_t color, color_t outline) {
+  _fillTriangle(x+2*w, y+2*w-1, x+w+1, y+w, x+2*w, y+1, color);
+  _fillTriangle(x+2*w+l+1, y+2*w-1, x+3*w+l, y+w, x+2*w+l+1, y+1, color);
+  _fillRect(x+2*w+1, y, l, 2*w+1, color);
+  if (cfont.offset) {
+    _drawTriangle(x+2*w, y+2*w-1, x+w+1, y+w, x+2*w, y+1, outline);
+    _drawTriangle(x+2*w+l+1, y+2*w-1, x+3*w+l, y+w, x+2*w+l+1, y+1, outline);
+    _drawRect(x+2*w+1, y, l, 2*w+1, outline);
+  }
+}
+
+//--------------------------------------------------------------------------------------------
+static void _draw7seg(int16_t x, int16_t y, int8_t num, int16_t w, int16_t l, color_t color) {
+  /* TODO: clipping */
+  if (num < 0x2D || num > 0x3A) return;
+
+  int16_t c = font_bcd[num-0x2D];
+  int16_t d = 2*w+l+1;
+
+  // === Clear unused segments ===
+  if (!(c & 0x001)) barVert(x+d, y+d, w, l, _bg, _bg);
+  if (!(c & 0x002)) barVert(x,   y+d, w, l, _bg, _bg);
+  if (!(c & 0x004)) barVert(x+d, y, w, l, _bg, _bg);
+  if (!(c & 0x008)) barVert(x,   y, w, l, _bg, _bg);
+  if (!(c & 0x010)) barHor(x, y+2*d, w, l, _bg, _bg);
+  if (!(c & 0x020)) barHor(x, y+d, w, l, _bg, _bg);
+  if (!(c & 0x040)) barHor(x, y, w, l, _bg, _bg);
+
+  if (!(c & 0x080)) {
+    // low point
+    _fillRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, _bg);
+    if (cfont.offset) _drawRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, _bg);
+  }
+  if (!(c & 0x100)) {
+    // down middle point
+    _fillRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, _bg);
+    if (cfont.offset) _drawRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, _bg);
+  }
+  if (!(c & 0x800)) {
+	// up middle point
+    _fillRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, _bg);
+    if (cfont.offset) _drawRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, _bg);
+  }
+  if (!(c & 0x200)) {
+    // middle, minus
+    _fillRect(x+2*w+1, y+d, l, 2*w+1, _bg);
+    if (cfont.offset) _drawRect(x+2*w+1, y+d, l, 2*w+1, _bg);
+  }
+
+  // === Draw used segments ===
+  if (c & 0x001) barVert(x+d, y+d, w, l, color, cfont.color);	// down right
+  if (c & 0x002) barVert(x,   y+d, w, l, color, cfont.color);	// down left
+  if (c & 0x004) barVert(x+d, y, w, l, color, cfont.color);		// up right
+  if (c & 0x008) barVert(x,   y, w, l, color, cfont.color);		// up left
+  if (c & 0x010) barHor(x, y+2*d, w, l, color, cfont.color);	// down
+  if (c & 0x020) barHor(x, y+d, w, l, color, cfont.color);		// middle
+  if (c & 0x040) barHor(x, y, w, l, color, cfont.color);		// up
+
+  if (c & 0x080) {
+    // low point
+    _fillRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, color);
+    if (cfont.offset) _drawRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, cfont.color);
+  }
+  if (c & 0x100) {
+    // down middle point
+    _fillRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, color);
+    if (cfont.offset) _drawRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, cfont.color);
+  }
+  if (c & 0x800) {
+	// up middle point
+    _fillRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, color);
+    if (cfont.offset) _drawRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, cfont.color);
+  }
+  if (c & 0x200) {
+    // middle, minus
+    _fillRect(x+2*w+1, y+d, l, 2*w+1, color);
+    if (cfont.offset) _drawRect(x+2*w+1, y+d, l, 2*w+1, cfont.color);
+  }
+}
+//==============================================================================
+
+// ==== Text line buffer =======================================================
+// With 'font_buffered_char' set, characters of the text line are composed
+// in the line buffer and the line is sent to display in one transaction
+
+typedef struct {
+	tft_fb_t	fb;			// line buffer, fb.x, fb.y is the display position of the line
+	int			used;		// number of used buffer columns
+	int			dirty;		// columns below this one may hold pixels of the previous characters
+} textLine;
+
+// Send the composed text line to the drawing target and free the buffer
+//-----------------------------------------
+static void _flushTextLine(textLine *line)
+{
+	tft_fb_t *lfb = &line->fb;
+	if (lfb->buf == NULL) return;
+
+	if (line->used > 0) {
+		if (line->used < lfb->width) {
+			// remove unused columns
+			for (int r=1; r<lfb->height; r++) {
+				memmove(lfb->buf + (r * line->used), lfb->buf + (r * lfb->width), line->used * sizeof(color_t));
+			}
+			lfb->width = line->used;
+		}
+		if (tft_fb) send_data(lfb->x, lfb->y, lfb->x + lfb->width - 1, lfb->y + lfb->height - 1, lfb->width * lfb->height, lfb->buf);
+		else fb_send(lfb, lfb->x, lfb->y, 1);
+	}
+	free(lfb->buf);
+	lfb->buf = NULL;
+}
+
+// Read the background of the transparent text line from the drawing target
+// Returns 0 on success
+//---------------------------------------------
+static int _readTextLineBackground(tft_fb_t *lfb)
+{
+	int buf_size = (disp_spi->host->max_transfer_sz < TFT_FB_LINEBUF_SIZE) ? disp_spi->host->max_transfer_sz : TFT_FB_LINEBUF_SIZE;
+	int band_lines = buf_size / (lfb->width * sizeof(color_t));
+	if (band_lines < 1) band_lines = 1;
+	if (band_lines > lfb->height) band_lines = lfb->height;
+
+	uint8_t *rbuf = malloc((band_lines * lfb->width * sizeof(color_t)) + 1);
+	if (rbuf == NULL) return -1;
+
+	int err = 0;
+	for (int by = 0; by < lfb->height; by += band_lines) {
+		int nlines = ((by + band_lines) > lfb->height) ? (lfb->height - by) : band_lines;
+		int len = nlines * lfb->width;
+		if (read_data(lfb->x, lfb->y + by, lfb->x + lfb->width - 1, lfb->y + by + nlines - 1, len, rbuf, 1) != ESP_OK) {
+			err = -2;
+			break;
+		}
+		memcpy(lfb->buf + (by * lfb->width), rbuf + 1, len * sizeof(color_t));
+	}
+	free(rbuf);
+	return err;
+}
+
+// Start the new text line buffer of 'height' lines at display position x,y
+// The buffer is at most 'max_width' pixels wide, up to the clip window end if 0
+// For transparent text the buffer holds the background read from the drawing target
+// Returns 0 if the buffer cannot be allocated
+//-------------------------------------------------------------------------------------------------
+static int _startTextLine(textLine *line, int x, int y, int height, int min_width, int max_width)
+{
+	tft_fb_t *lfb = &line->fb;
+	int width = dispWin.x2 - x + 1;
+	if ((max_width > 0) && (width > max_width)) width = max_width;
+	int buf_width = TEXT_LINE_BUF_SIZE / (height * sizeof(color_t));
+	if (width > buf_width) width = buf_width;
+	if (width < min_width) return 0;
+
+	lfb->buf = heap_caps_malloc(width * height * sizeof(color_t), MALLOC_CAP_DMA);
+	if (lfb->buf == NULL) return 0;
+
+	lfb->width = width;
+	lfb->height = height;
+	lfb->x = x;
+	lfb->y = y;
+	lfb->org_x = 0;
+	lfb->org_y = 0;
+	lfb->scale = 1;
+	lfb->dma = 1;
+	line->used = 0;
+	line->dirty = 0;
+
+	if (font_transparent) {
+		if (_readTextLineBackground(lfb) != 0) {
+			free(lfb->buf);
+			lfb->buf = NULL;
+			return 0;
+		}
+		return 1;
+	}
+
+	// fill with background color
+	for (int n = 0; n < (width * height); n++) {
+		lfb->buf[n] = _bg;
+	}
+	return 1;
+}
+
+// Draw the 7-segment character at display position x,y to the text line buffer
+// Segments are drawn as usual, with the line buffer as the drawing target;
+// pixels outside the buffer are not drawn
+//--------------------------------------------------------------------
+static void _buffer7segChar(textLine *line, uint8_t ch, int x, int y)
+{
+	tft_fb_t *lfb = &line->fb;
+	tft_fb_t *prev_fb = tft_fb;
+
+	lfb->org_x = lfb->x;
+	lfb->org_y = lfb->y;
+	tft_fb = lfb;
+	_draw7seg(x, y, ch, cfont.y_size, cfont.x_size, _fg);
+	tft_fb = prev_fb;
+
+	if ((x - lfb->x + _7seg_width()) > line->used) line->used = x - lfb->x + _7seg_width();
+}
+
+// Draw the 7-segment character too large for the text line buffer
+// The character is composed and sent in horizontal bands
+//------------------------------------------------------
+static void _draw7segBands(uint8_t ch, int x, int y)
+{
+	textLine band;
+	int width = _7seg_width();
+	int height = _7seg_height();
+	int band_height = TEXT_LINE_BUF_SIZE / (width * sizeof(color_t));
+
+	for (int by = 0; by < height; by += band_height) {
+		int h = ((by + band_height) > height) ? (height - by) : band_height;
+		if ((band_height < 1) || (!_startTextLine(&band, x, y + by, h, width, width))) {
+			_draw7seg(x, y, ch, cfont.y_size, cfont.x_size, _fg);
+			return;
+		}
+		_buffer7segChar(&band, ch, x, y);
+		_flushTextLine(&band);
+	}
+}
+
+// Render the proportional character (already in 'fontChar') to the text line buffer
+// at display position x; the character cell and the gap after it are in background color
+// Characters whose glyph fits into the character cell are taken from, or added to the glyph cache
+//-------------------------------------------------------
+static void _bufferProportionalChar(textLine *line, int x)
+{
+	tft_ctx_t *ctx = TFT_CTX;
+	tft_fb_t *lfb = &line->fb;
+	int col = x - lfb->x;
+	int char_width = ((ctx->prop_char.width > ctx->prop_char.xDelta) ? ctx->prop_char.width : ctx->prop_char.xDelta);
+	color_t *cell = lfb->buf + col;
+
+	// transparent characters and glyph pixels drawn outside the character cell are not cached
+	int cacheable = ((!ctx->transparent) && (ctx->prop_char.xOffset >= 0) && ((ctx->prop_char.xOffset + ctx->prop_char.width) <= char_width) &&
+					 (ctx->prop_char.adjYOffset >= 0) && ((ctx->prop_char.adjYOffset + ctx->prop_char.height) <= lfb->height) &&
+					 ((col + char_width) <= lfb->width) && (col >= line->dirty) && (col >= line->used));
+
+	if ((col + char_width + 1) > line->used) line->used = col + char_width + 1;
+	if (line->used > lfb->width) line->used = lfb->width;
+	if ((cacheable) && (getCachedGlyph(ctx->prop_char.charCode, char_width, cell, lfb->width))) return;
+
+	if ((ctx->prop_char.xOffset + ctx->prop_char.width) > char_width) line->dirty = col + ctx->prop_char.xOffset + ctx->prop_char.width;
+
+	// transparent anti-aliased pixels are blended over the background in buffer
+	color_t *lut = _glyphLUT(ctx);
+	glyphReader gr;
+	_glyphReaderInit(&gr, _glyphData(), ctx->font.bpp, ctx->font.rle);
+	if (ctx->prop_char.height == 0) cacheable = 0;
+	for (int j=0; j < ctx->prop_char.height; j++) {
+		int row = j + ctx->prop_char.adjYOffset;
+		for (int i=0; i < ctx->prop_char.width; ) {
+			uint8_t v;
+			int run = _glyphRun(&gr, ctx->prop_char.width - i, &v);
+			if ((v != 0) && (row >= 0) && (row < lfb->height)) {
+				// visible pixels
+				color_t *pixel = lfb->buf + (row * lfb->width);
+				for (int bx = col + ctx->prop_char.xOffset + i; bx < (col + ctx->prop_char.xOffset + i + run); bx++) {
+					if ((bx >= 0) && (bx < lfb->width)) pixel[bx] = (ctx->transparent) ? _glyphBlend(ctx, v, pixel[bx]) : lut[v];
+				}
+			}
+			i += run;
+		}
+	}
+
+	if (cacheable) putCachedGlyph(ctx->prop_char.charCode, char_width, cell, lfb->width);
+}
+
+// Render the fixed width character to the text line buffer at display position x
+//-----------------------------------------------------------
+static void _bufferChar(textLine *line, uint8_t c, int x)
+{
+	tft_ctx_t *ctx = TFT_CTX;
+	tft_fb_t *lfb = &line->fb;
+	uint8_t ch, fz, mask;
+	int col = x - lfb->x;
+
+	// fz = bytes per char row
+	fz = ctx->font.x_size/8;
+	if (ctx->font.x_size % 8) fz++;
+
+	line->used = col + ctx->font.x_size;
+	if ((!ctx->transparent) && (getCachedGlyph(c, ctx->font.x_size, lfb->buf + col, lfb->width))) return;
+
+	// get character position in buffer
+	uint32_t temp = ((c-ctx->font.offset)*((fz)*ctx->font.y_size))+4;
+
+	for (int j=0; j<ctx->font.y_size; j++) {
+		color_t *row = lfb->buf + (j * lfb->width) + col;
+		for (int k=0; k < fz; k++) {
+			ch = ctx->font.font[temp+k];
+			mask=0x80;
+			for (int i=0; i<8; i++) {
+				if (((ch & mask) !=0) && ((i+(k*8)) < ctx->font.x_size)) row[i+(k*8)] = ctx->fg;
+				mask >>= 1;
+			}
+		}
+		temp += (fz);
+	}
+
+	if (!ctx->transparent) putCachedGlyph(c, ctx->font.x_size, lfb->buf + col, lfb->width);
+}
+
+// ==== Text rotated by right angle ============================================
+// The string is composed unrotated in the text line buffer, the buffer is then sent
+// with the display scan direction changed, so the display controller rotates it
+
+// Returns the number of clockwise quarter turns if the text can be drawn by scan direction change, 0 if not
+//------------------------------
+static uint8_t _rightAngleText()
+{
+	if ((font_transparent) || (tft_fb) || (cfont.bitmap != 1)) return 0;
+	if (font_rotate == 90) return 1;
+	if (font_rotate == 180) return 2;
+	if (font_rotate == 270) return 3;
+	return 0;
+}
+
+// Display position of the upper left corner of the text line buffer rotated by 'rot' quarter turns
+// around display point x,y; the buffer starts at strip x coordinate lfb->x
+// Positions match the pixel mapping of the rotated text strip
+//------------------------------------------------------------------------------------
+static void _rotatedLinePos(tft_fb_t *lfb, int x, int y, uint8_t rot, int *x1, int *y1)
+{
+	if (rot == 1) {
+		*x1 = x - lfb->height;
+		*y1 = y + lfb->x;
+	}
+	else if (rot == 2) {
+		*x1 = x - lfb->x - lfb->width;
+		*y1 = y - lfb->height;
+	}
+	else {
+		*x1 = x;
+		*y1 = y - lfb->x - lfb->width;
+	}
+}
+
+// Start the text line buffer for the string rotated by 'rot' quarter turns around display point x,y,
+// the first character is at strip x coordinate 'u0'
+// Returns 0 if the rotated string may not fit into the clip window or the buffer cannot be allocated
+//----------------------------------------------------------------------------------------
+static int _startRotatedLine(textLine *line, char *st, int u0, int x, int y, uint8_t rot)
+{
+	tft_fb_t *lfb = &line->fb;
+	int width;
+	if (cfont.x_size == 0) width = TFT_getStringWidth(st) + 2;
+	else width = (_strChars(st) + 1) * cfont.x_size;
+	if ((width <= 0) || ((width * cfont.y_size * sizeof(color_t)) > TEXT_LINE_BUF_SIZE)) return 0;
+
+	lfb->x = u0;
+	lfb->width = width;
+	lfb->height = cfont.y_size;
+
+	int x1, y1;
+	_rotatedLinePos(lfb, x, y, rot, &x1, &y1);
+	int x2 = x1 + ((rot & 1) ? lfb->height : lfb->width) - 1;
+	int y2 = y1 + ((rot & 1) ? lfb->width : lfb->height) - 1;
+	if ((x1 < dispWin.x1) || (y1 < dispWin.y1) || (x2 > dispWin.x2) || (y2 > dispWin.y2)) return 0;
+
+	lfb->buf = heap_caps_malloc(width * cfont.y_size * sizeof(color_t), MALLOC_CAP_DMA);
+	if (lfb->buf == NULL) return 0;
+
+	lfb->y = 0;
+	lfb->org_x = 0;
+	lfb->org_y = 0;
+	lfb->scale = 1;
+	lfb->dma = 1;
+	line->used = 0;
+	line->dirty = 0;
+
+	// fill with background color
+	for (int n = 0; n < (width * cfont.y_size); n++) {
+		lfb->buf[n] = _bg;
+	}
+	return 1;
+}
+
+// Send the text line buffer rotated by 'rot' quarter turns around display point x,y and free it
+//-------------------------------------------------------------------------
+static void _sendRotatedLine(textLine *line, int x, int y, uint8_t rot)
+{
+	tft_fb_t *lfb = &line->fb;
+	if (lfb->buf == NULL) return;
+
+	if (line->used > 0) {
+		// remove unused columns
+		for (int r=1; r<lfb->height; r++) {
+			memmove(lfb->buf + (r * line->used), lfb->buf + (r * lfb->width), line->used * sizeof(color_t));
+		}
+		lfb->width = line->used;
+
+		int x1, y1;
+		_rotatedLinePos(lfb, x, y, rot, &x1, &y1);
+		fb_send_rotated(lfb, x1, y1, rot);
+	}
+	free(lfb->buf);
+	lfb->buf = NULL;
+}
+
+// ==== Rotated text ===========================================================
+// Characters of the rotated string are first rendered unrotated to the text strip.
+// The strip is then drawn by inverse mapping each pixel of the rotated bounding box
+// to the strip (fixed point) and sending the box to display in bands
+
+typedef struct {
+	uint8_t		*mask;		// strip pixels, 1 byte per pixel, glyph pixel value (0 for background)
+	int			u0;			// strip x coordinate of the first mask column
+	int			width;		// mask width
+	int			height;		// mask height, font height
+	int			umin;		// used strip columns, umin ~ umax-1
+	int			umax;
+} textStrip;
+
+// Allocate the text strip for the string starting at strip x coordinate 'u0'
+// Returns 0 if the strip cannot be allocated
+//---------------------------------------------------------
+static int _startTextStrip(textStrip *strip, char *st, int u0)
+{
+	int width;
+	if (cfont.x_size == 0) width = TFT_getStringWidth(st) + 2;
+	else width = (_strChars(st) + 1) * cfont.x_size;
+	if (width <= 0) return 0;
+
+	strip->mask = calloc(width * cfont.y_size, 1);
+	if (strip->mask == NULL) return 0;
+
+	strip->u0 = u0;
+	strip->width = width;
+	strip->height = cfont.y_size;
+	strip->umin = 0x7FFF;
+	strip->umax = -0x7FFF;
+	return 1;
+}
+
+// Mark the strip columns u1 ~ u2-1 as used
+//-------------------------------------------------------------
+static void _textStripUse(textStrip *strip, int u1, int u2)
+{
+	if (u1 < strip->u0) u1 = strip->u0;
+	if (u2 > (strip->u0 + strip->width)) u2 = strip->u0 + strip->width;
+	if (u1 < strip->umin) strip->umin = u1;
+	if (u2 > strip->umax) strip->umax = u2;
+}
+
+// Render the proportional character (already in 'fontChar') to the strip at strip x coordinate 'u'
+// Returns the character advance
+//---------------------------------------------------------
+static int _stripPropChar(textStrip *strip, int u)
+{
+	tft_ctx_t *ctx = TFT_CTX;
+	glyphReader gr;
+	_glyphReaderInit(&gr, _glyphData(), ctx->font.bpp, ctx->font.rle);
+
+	for (int j=0; j < ctx->prop_char.height; j++) {
+		int row = j + ctx->prop_char.adjYOffset;
+		for (int i=0; i < ctx->prop_char.width; i++) {
+			uint8_t v = _glyphPixel(&gr);
+			if (v != 0) {
+				int col = u + ctx->prop_char.xOffset + i - strip->u0;
+				if ((col >= 0) && (col < strip->width) && (row >= 0) && (row < strip->height)) strip->mask[(row * strip->width) + col] = v;
+			}
+		}
+	}
+
+	_textStripUse(strip, u, u + ctx->prop_char.xDelta + 1);
+	return ctx->prop_char.xDelta+1;
+}
+
+// Render the fixed width character to the strip at strip x coordinate 'u'
+//--------------------------------------------------------------
+static void _stripChar(textStrip *strip, uint8_t c, int u)
+{
+	tft_ctx_t *ctx = TFT_CTX;
+	uint8_t ch, fz, mask;
+
+	// fz = bytes per char row
+	fz = ctx->font.x_size/8;
+	if (ctx->font.x_size % 8) fz++;
+
+	// get character position in buffer
+	uint32_t temp = ((c-ctx->font.offset)*((fz)*ctx->font.y_size))+4;
+
+	for (int j=0; j<ctx->font.y_size; j++) {
+		for (int k=0; k < fz; k++) {
+			ch = ctx->font.font[temp+k];
+			mask=0x80;
+			for (int i=0; i<8; i++) {
+				int col = u + i + (k*8) - strip->u0;
+				if (((ch & mask) !=0) && ((i+(k*8)) < ctx->font.x_size) && (col >= 0) && (col < strip->width)) {
+					strip->mask[(j * strip->width) + col] = 1;
+				}
+				mask >>= 1;
+			}
+		}
+		temp += (fz);
+	}
+
+	_textStripUse(strip, u, u + ctx->font.x_size);
+}
+
+// Draw the text strip rotated by 'font_rotate' around display point x,y and free it
+// Strip pixels are drawn in foreground color, strip background in background color
+// if not transparent. If the background under the text can be read (frame buffer,
+// or 'font_transparent_readback' set), the bounding box is written in bands,
+// otherwise each box row is written as one window (one span per run if transparent)
+//------------------------------------------------------------
+static void _drawTextStrip(textStrip *strip, int x, int y)
+{
+	tft_ctx_t *ctx = TFT_CTX;
+	uint8_t *rbuf = NULL;
+	color_t *wbuf = NULL;
+
+	if (strip->mask == NULL) return;
+	if (strip->umin >= strip->umax) goto exit;
+
+	double radian = ctx->rotate * DEG_TO_RAD;
+	float cos_radian = cos(radian);
+	float sin_radian = sin(radian);
+
+	// bounding box of the rotated strip
+	float cu[4] = { strip->umin, strip->umax, strip->umin, strip->umax };
+	float cv[4] = { 0, 0, strip->height, strip->height };
+	float fx1 = 1e9, fy1 = 1e9, fx2 = -1e9, fy2 = -1e9;
+	for (int n=0; n<4; n++) {
+		float px = x + (cu[n] * cos_radian) - (cv[n] * sin_radian);
+		float py = y + (cv[n] * cos_radian) + (cu[n] * sin_radian);
+		if (px < fx1) fx1 = px;
+		if (px > fx2) fx2 = px;
+		if (py < fy1) fy1 = py;
+		if (py > fy2) fy2 = py;
+	}
+	int x1 = (int)floor(fx1);
+	int y1 = (int)floor(fy1);
+	int x2 = (int)ceil(fx2);
+	int y2 = (int)ceil(fy2);
+
+	// clipping
+	if (x1 < ctx->win.x1) x1 = ctx->win.x1;
+	if (y1 < ctx->win.y1) y1 = ctx->win.y1;
+	if (x2 > ctx->win.x2) x2 = ctx->win.x2;
+	if (y2 > ctx->win.y2) y2 = ctx->win.y2;
+	if ((x1 > x2) || (y1 > y2)) goto exit;
+
+	int bw = x2 - x1 + 1;
+	uint8_t readback = ((tft_fb) || (ctx->transparent_rb));
+	int buf_size = (disp_spi->host->max_transfer_sz < TFT_FB_LINEBUF_SIZE) ? disp_spi->host->max_transfer_sz : TFT_FB_LINEBUF_SIZE;
+	int band_lines = buf_size / (bw * sizeof(color_t));
+	if (band_lines < 1) band_lines = 1;
+	if (band_lines > (y2 - y1 + 1)) band_lines = y2 - y1 + 1;
+
+	wbuf = heap_caps_malloc(band_lines * bw * sizeof(color_t), MALLOC_CAP_DMA);
+	if (wbuf == NULL) goto exit;
+	if (readback) {
+		rbuf = malloc((band_lines * bw * sizeof(color_t)) + 1);
+		if (rbuf == NULL) goto exit;
+	}
+
+	// strip coordinates of the pixel centers in 16.16 fixed point,
+	// u = dx*cos + dy*sin, v = dy*cos - dx*sin
+	color_t *lut = _glyphLUT(ctx);
+	int32_t fcos = (int32_t)(cos_radian * 65536.0);
+	int32_t fsin = (int32_t)(sin_radian * 65536.0);
+	int32_t umin = (strip->umin - strip->u0) << 16;
+	int32_t umax = (strip->umax - strip->u0) << 16;
+	int32_t vmax = strip->height << 16;
+
+	for (int by = y1; by <= y2; by += band_lines) {
+		int nlines = ((by + band_lines - 1) > y2) ? (y2 - by + 1) : band_lines;
+
+		if (readback) {
+			if (read_data(x1, by, x2, by + nlines - 1, nlines * bw, rbuf, 1) != ESP_OK) goto exit;
+			memcpy(wbuf, rbuf + 1, nlines * bw * sizeof(color_t));
+		}
+
+		disp_select();
+		for (int ly = 0; ly < nlines; ly++) {
+			color_t *row = wbuf + (ly * bw);
+			float dx = x1 - x + 0.5;
+			float dy = by + ly - y + 0.5;
+			int32_t u = (int32_t)(((dx * cos_radian) + (dy * sin_radian)) * 65536.0) - (strip->u0 << 16);
+			int32_t v = (int32_t)(((dy * cos_radian) - (dx * sin_radian)) * 65536.0);
+			int first = -1, last = -1, run = 0;
+
+			for (int lx = 0; lx < bw; lx++, u += fcos, v -= fsin) {
+				uint8_t fg = 0;
+				if ((u >= umin) && (u < umax) && (v >= 0) && (v < vmax)) {
+					// inside the strip
+					uint8_t pv = strip->mask[((v >> 16) * strip->width) + (u >> 16)];
+					if (first < 0) first = lx;
+					last = lx;
+					if (!ctx->transparent) row[lx] = lut[pv];
+					else if (pv) row[lx] = _glyphBlend(ctx, pv, row[lx]);
+					fg = GLYPH_PIXEL_VISIBLE(ctx, pv);
+				}
+				if ((!readback) && (ctx->transparent)) {
+					// draw runs of character pixels
+					if (fg) run++;
+					else if (run) {
+						drawSpan(x1 + lx - run, by + ly, run, ctx->fg);
+						run = 0;
+					}
+				}
+			}
+			if (readback) continue;
+			if (ctx->transparent) {
+				if (run) drawSpan(x1 + bw - run, by + ly, run, ctx->fg);
+			}
+			else if (first >= 0) send_data(x1 + first, by + ly, x1 + last, by + ly, last - first + 1, row + first);
+		}
+		if (readback) send_data(x1, by, x2, by + nlines - 1, nlines * bw, wbuf);
+		disp_deselect();
+	}
+
+exit:
+	if (rbuf) free(rbuf);
+	if (wbuf) free(wbuf);
+	free(strip->mask);
+	strip->mask = NULL;
+}
+
+// Calculate CENTER, RIGHT or BOTTOM position of the text 'width' x 'height' pixels
+// Returns 0 if the text is outside the clip window
+//----------------------------------------------------------
+static int _alignText(int *x, int *y, int width, int height)
+{
+	if (*x == RIGHT) *x = dispWin.x2 - width + dispWin.x1;
+	else if (*x == CENTER) *x = (((dispWin.x2 - dispWin.x1 + 1) - width) / 2) + dispWin.x1;
+
+	if (*y == BOTTOM) *y = dispWin.y2 - height + dispWin.y1;
+	else if (*y==CENTER) *y = (((dispWin.y2 - dispWin.y1 + 1) - (height/2)) / 2) + dispWin.y1;
+
+	if (*x < dispWin.x1) *x = dispWin.x1;
+	if (*y < dispWin.y1) *y = dispWin.y1;
+	if ((*x > dispWin.x2) || (*y > dispWin.y2)) return 0;
+	return 1;
+}
+
+//======================================
+void TFT_print(char *st, int x, int y) {
+	int n, tmpw, tmph, fh;
+	uint32_t ch;
+
+	if (cfont.bitmap == 0) return; // wrong font selected
+
+	// ** Rotated strings cannot be aligned
+	if ((font_rotate != 0) && ((x <= CENTER) || (y <= CENTER))) return;
+
+	if ((x < LASTX) || (font_rotate == 0)) TFT_OFFSET = 0;
+
+	if ((x >= LASTX) && (x < LASTY)) x = TFT_X + (x-LASTX);
+	else if (x > CENTER) x += dispWin.x1;
+
+	if (y >= LASTY) y = TFT_Y + (y-LASTY);
+	else if (y > CENTER) y += dispWin.y1;
+
+	// ** Calculate CENTER, RIGHT or BOTTOM position
+	tmpw = TFT_getStringWidth(st);	// string width in pixels
+	fh = cfont.y_size;			// font height
+	if ((cfont.x_size != 0) && (cfont.bitmap == 2)) {
+		// 7-segment font
+		fh = (3 * (2 * cfont.y_size + 1)) + (2 * cfont.x_size);  // 7-seg character height
+	}
+
+	if (!_alignText(&x, &y, tmpw, fh)) return;
+
+	TFT_X = x;
+	TFT_Y = y;
+
+	// ** Adjust y position
+	tmph = cfont.y_size; // font height
+	// for non-proportional fonts, char width is the same for all chars
+	tmpw = cfont.x_size;
+	if (cfont.x_size != 0) {
+		if (cfont.bitmap == 2) {	// 7-segment font
+			tmpw = _7seg_width();	// character width
+			tmph = _7seg_height();	// character height
+		}
+	}
+	else TFT_OFFSET = 0;	// fixed font; offset not needed
+
+	if ((TFT_Y + tmph - 1) > dispWin.y2) return;
+
+	int offset = TFT_OFFSET;
+
+	// ** Non rotated buffered characters are composed in the line buffer
+	// ** Transparent text is composed over the background read from frame buffer,
+	//    or from display if 'font_transparent_readback' is set
+	textLine line;
+	line.fb.buf = NULL;
+	uint8_t line_buffered = ((font_buffered_char) && (font_rotate == 0) && (cfont.bitmap == 1) &&
+							 ((!font_transparent) || (font_transparent_readback) || (tft_fb)));
+	// ** 7-segment characters are composed in the line buffer and sent at once,
+	//    character cells and gaps between them are cleared to the background color
+	uint8_t seg_buffered = ((font_buffered_char) && (cfont.bitmap == 2) && (!font_transparent) && (tft_fb == NULL));
+
+	// ** Rotated characters are rendered to the text strip which is drawn rotated at once
+	//    Text rotated by right angle is composed in the line buffer and rotated by display
+	textStrip strip;
+	strip.mask = NULL;
+	textLine rline;
+	rline.fb.buf = NULL;
+	uint8_t rquad = _rightAngleText();
+	if (rquad) _startRotatedLine(&rline, st, (cfont.x_size == 0) ? offset : 0, x, y, rquad);
+	if ((rline.fb.buf == NULL) && (font_rotate != 0) && (cfont.bitmap == 1)) _startTextStrip(&strip, st, (cfont.x_size == 0) ? offset : 0);
+
+	const char *p = st;
+	for (n=0; *p != 0; n++) {
+		char *chst = (char *)p;
+		ch = _nextChar(&p); // get string character
+
+		if (ch == 0x0D) { // === '\r', erase to eol ====
+			_flushTextLine(&line);
+			if ((!font_transparent) && (font_rotate==0)) _fillRect(TFT_X, TFT_Y,  dispWin.x2+1-TFT_X, tmph, _bg);
+		}
+
+		else if (ch == 0x0A) { // ==== '\n', new line ====
+			if (cfont.bitmap == 1) {
+				TFT_Y += tmph + font_line_space;
+				if (TFT_Y > (dispWin.y2-tmph)) break;
+				TFT_X = dispWin.x1;
+			}
+		}
+
+		else { // ==== other characters ====
+			if (cfont.x_size == 0) {
+				// for proportional font get character data to 'fontChar'
+				if (getCharPtr(ch)) tmpw = fontChar.xDelta;
+				else continue;
+			}
+
+			// check if character can be displayed in the current line
+			if ((TFT_X+tmpw) > (dispWin.x2)) {
+				if (text_wrap == 0) break;
+				TFT_Y += tmph + font_line_space;
+				if (TFT_Y > (dispWin.y2-tmph)) break;
+				TFT_X = dispWin.x1;
+			}
+
+			if (line_buffered) {
+				// continue the current line buffer or start the new one
+				if ((line.fb.buf) && ((TFT_Y != line.fb.y) || (TFT_X != (line.fb.x + line.used)) || ((TFT_X + tmpw) >= (line.fb.x + line.fb.width)))) {
+					_flushTextLine(&line);
+				}
+				if (line.fb.buf == NULL) {
+					int max_width = 0;
+					if (font_transparent) {
+						// read back only the background under the rest of the string
+						propFont pc = fontChar;
+						max_width = TFT_getStringWidth(chst) + 1;
+						fontChar = pc;
+					}
+					_startTextLine(&line, TFT_X, TFT_Y, cfont.y_size, tmpw+1, max_width);
+				}
+
+				if (line.fb.buf) {
+					if (cfont.x_size == 0) {
+						_bufferProportionalChar(&line, TFT_X);
+						TFT_X += ((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta) + 1;
+					}
+					else {
+						if ((ch < cfont.offset) || ((ch-cfont.offset) > cfont.numchars)) ch = cfont.offset;
+						_bufferChar(&line, ch, TFT_X);
+						TFT_X += tmpw;
+					}
+					continue;
+				}
+			}
+
+			// Let's print the character
+			if (cfont.x_size == 0) {
+				// == proportional font
+				if (font_rotate == 0) TFT_X += printProportionalChar(TFT_X, TFT_Y) + 1;
+				else {
+					// rotated proportional font
+					if (rline.fb.buf) {
+						_bufferProportionalChar(&rline, offset);
+						offset += fontChar.xDelta+1;
+					}
+					else if (strip.mask) offset += _stripPropChar(&strip, offset);
+					else offset += rotatePropChar(x, y, offset);
+					TFT_OFFSET = offset;
+				}
+			}
+			else {
+				if (cfont.bitmap == 1) {
+					// == fixed font
+					if ((ch < cfont.offset) || ((ch-cfont.offset) > cfont.numchars)) ch = cfont.offset;
+					if (font_rotate == 0) {
+						printChar(ch, TFT_X, TFT_Y);
+						TFT_X += tmpw;
+					}
+					else if ((rline.fb.buf) || (strip.mask)) {
+						if (rline.fb.buf) _bufferChar(&rline, ch, n * cfont.x_size);
+						else _stripChar(&strip, ch, n * cfont.x_size);
+						// calculate x,y for the next char
+						TFT_X = (int)(x + ((n+1) * cfont.x_size * cos(font_rotate * DEG_TO_RAD)));
+						TFT_Y = (int)(y + ((n+1) * cfont.x_size * sin(font_rotate * DEG_TO_RAD)));
+					}
+					else rotateChar(ch, x, y, n);
+				}
+				else if (cfont.bitmap == 2) {
+					// == 7-segment font ==
+					if (seg_buffered) {
+						// continue the current line buffer or start the new one
+						if ((line.fb.buf) && ((TFT_Y != line.fb.y) || ((TFT_X + tmpw) > (line.fb.x + line.fb.width)))) {
+							_flushTextLine(&line);
+						}
+						if (line.fb.buf == NULL) _startTextLine(&line, TFT_X, TFT_Y, tmph, tmpw, 0);
+					}
+					if (line.fb.buf) _buffer7segChar(&line, ch, TFT_X, TFT_Y);
+					else if (seg_buffered) _draw7segBands(ch, TFT_X, TFT_Y);
+					else _draw7seg(TFT_X, TFT_Y, ch, cfont.y_size, cfont.x_size, _fg);
+					TFT_X += (tmpw + 2);
+				}
+			}
+		}
+	}
+	_flushTextLine(&line);
+	_sendRotatedLine(&rline, x, y, rquad);
+	_drawTextStrip(&strip, x, y);
+}
+
+//=======================================
+tft_text_t *TFT_text_create(int x, int y)
+{
+	tft_text_t *text = calloc(1, sizeof(tft_text_t));
+	if (text == NULL) return NULL;
+
+	text->x = x;
+	text->y = y;
+	text->disp_x = -1;
+	text->ncells = -1;
+	return text;
+}
+
+//========================================
+void TFT_text_invalidate(tft_text_t *text)
+{
+	text->disp_x = -1;
+	text->ncells = -1;
+}
+
+//====================================
+void TFT_text_delete(tft_text_t *text)
+{
+	if (text == NULL) return;
+	if (text->cells) free(text->cells);
+	if (text->work) free(text->work);
+	free(text);
+}
+
+// Check if the text was printed with the current font, colors and clip window
+//-----------------------------------------
+static int _textStateSame(tft_text_t *text)
+{
+	return ((text->font == cfont.font) && (text->x_size == cfont.x_size) && (text->y_size == cfont.y_size) &&
+			(text->force_fixed == font_forceFixed) && (memcmp(&text->fg, &_fg, sizeof(color_t)) == 0) &&
+			(memcmp(&text->bg, &_bg, sizeof(color_t)) == 0) && (memcmp(&text->win, &dispWin, sizeof(dispWin_t)) == 0));
+}
+
+// Set the character cells of the string to 'text->work', starting at display x
+// Returns the number of cells, -1 if the string can not be printed by cells
+//------------------------------------------------------
+static int _textCells(tft_text_t *text, char *st, int x)
+{
+	const char *p = st;
+	int n = 0;
+
+	while (*p != 0) {
+		if (n == text->max_cells) {
+			int max_cells = (text->max_cells) ? (text->max_cells * 2) : 16;
+			tft_text_cell_t *cells = realloc(text->cells, max_cells * sizeof(tft_text_cell_t));
+			if (cells == NULL) return -1;
+			text->cells = cells;
+			cells = realloc(text->work, max_cells * sizeof(tft_text_cell_t));
+			if (cells == NULL) return -1;
+			text->work = cells;
+			text->max_cells = max_cells;
+		}
+		if ((p - st) > 0xFFFF) return -1;
+		tft_text_cell_t *cell = text->work + n;
+		cell->pos = p - st;
+		cell->code = _nextChar(&p);
+		cell->x = x;
+		cell->overhang = 0;
+		if ((cell->code == 0x0D) || (cell->code == 0x0A)) return -1;
+
+		if (cfont.x_size == 0) {
+			// missing characters of the proportional font are not printed
+			cell->width = 0;
+			if (getCharPtr(cell->code)) {
+				int char_width = ((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta);
+				cell->width = char_width + 1;
+				cell->overhang = ((fontChar.xOffset < 0) || ((fontChar.xOffset + fontChar.width) > char_width));
+				// the string must fit into the line
+				if ((x + fontChar.xDelta) > dispWin.x2) return -1;
+			}
+		}
+		else {
+			cell->width = cfont.x_size;
+			if ((x + cfont.x_size) > dispWin.x2) return -1;
+		}
+
+		x += cell->width;
+		n++;
+	}
+	return n;
+}
+
+// Print 'len' bytes of the string at display position x,y
+//---------------------------------------------------------
+static void _printTextPart(char *st, int len, int x, int y)
+{
+	char *part = malloc(len+1);
+	if (part == NULL) return;
+	memcpy(part, st, len);
+	part[len] = '\0';
+	TFT_print(part, x - dispWin.x1, y - dispWin.y1);
+	free(part);
+}
+
+// Changed characters are found by comparing the character cells of the printed and the new string
+// Characters overhanging the cell are redrawn with the changed neighbour cell,
+// as the neighbour's background covers them
+//=============================================
+int TFT_printUpdate(tft_text_t *text, char *st)
+{
+	int x = text->x;
+	int y = text->y;
+	int width, height, n;
+	int drawn = 0;
+
+	if (cfont.bitmap == 0) return 0;
+	if (x > CENTER) x += dispWin.x1;
+	if (y > CENTER) y += dispWin.y1;
+	width = TFT_getStringWidth(st);
+	height = (cfont.bitmap == 2) ? _7seg_height() : cfont.y_size;
+	uint8_t in_window = _alignText(&x, &y, width, height) && ((y + height - 1) <= dispWin.y2);
+
+	// ** Only non rotated and non transparent text of bitmap font is printed by character cells
+	n = -1;
+	if ((in_window) && (font_rotate == 0) && (!font_transparent) && (cfont.bitmap == 1)) n = _textCells(text, st, x);
+
+	if ((n >= 0) && (text->disp_x >= 0) && (text->ncells >= 0) && (y == text->disp_y) && (_textStateSame(text))) {
+		tft_text_cell_t *prev = text->cells;
+		tft_text_cell_t *cells = text->work;
+		uint8_t changed[n+1];
+
+		for (int i=0; i<n; i++) {
+			changed[i] = !((i < text->ncells) && (prev[i].code == cells[i].code) &&
+						   (prev[i].x == cells[i].x) && (prev[i].width == cells[i].width));
+		}
+		// overhanging characters next to the changed ones are redrawn
+		for (int i=1; i<n; i++) {
+			if ((changed[i-1]) && (cells[i].overhang)) changed[i] = 1;
+		}
+		for (int i=n-2; i>=0; i--) {
+			if ((changed[i+1]) && (cells[i].overhang)) changed[i] = 1;
+		}
+
+		for (int i=0; i<n; ) {
+			if (!changed[i]) {
+				i++;
+				continue;
+			}
+			int first = i;
+			while ((i < n) && (changed[i])) i++;
+			int len = ((i < n) ? cells[i].pos : strlen(st)) - cells[first].pos;
+			_printTextPart(st + cells[first].pos, len, cells[first].x, y);
+			drawn += i - first;
+		}
+
+		// clear the printed text outside the new one
+		int old_x2 = text->disp_x + text->width;
+		int new_x2 = (n) ? (cells[n-1].x + cells[n-1].width) : x;
+		if ((text->disp_x < x) && (text->width > 0)) _fillRect(text->disp_x, y, ((old_x2 < x) ? old_x2 : x) - text->disp_x, text->height, _bg);
+		if ((old_x2 > new_x2) && (text->width > 0)) {
+			int x1 = (text->disp_x > new_x2) ? text->disp_x : new_x2;
+			_fillRect(x1, y, old_x2 - x1, text->height, _bg);
+		}
+	}
+	else {
+		// ** Reprint the whole text
+		if ((text->disp_x >= 0) && (text->width > 0) && (font_rotate == 0) && (!font_transparent)) {
+			dispWin_t win = dispWin;
+			dispWin = text->win;
+			_fillRect(text->disp_x, text->disp_y, text->width, text->height, _bg);
+			dispWin = win;
+		}
+		TFT_print(st, text->x, text->y);
+		drawn = (n >= 0) ? n : _strChars(st);
+	}
+
+	// ** Save the printed text
+	// ** Display area of the text printed in more lines is not known
+	text->ncells = -1;
+	text->disp_x = -1;
+	if ((in_window) && (font_rotate == 0) &&
+			((n >= 0) || (cfont.bitmap == 2) || ((!text_wrap) && (strpbrk(st, "\r\n") == NULL)))) {
+		text->disp_x = x;
+		text->disp_y = y;
+		text->height = height;
+		if (n >= 0) {
+			tft_text_cell_t *cells = text->cells;
+			text->cells = text->work;
+			text->work = cells;
+			text->ncells = n;
+			text->width = (n) ? (text->cells[n-1].x + text->cells[n-1].width - x) : 0;
+		}
+		else text->width = ((cfont.bitmap == 1) && (cfont.x_size == 0)) ? width + 1 : width;
+		if (text->width > (dispWin.x2 - x + 1)) text->width = dispWin.x2 - x + 1;
+	}
+	text->font = cfont.font;
+	text->x_size = cfont.x_size;
+	text->y_size = cfont.y_size;
+	text->force_fixed = font_forceFixed;
+	text->fg = _fg;
+	text->bg = _bg;
+	text->win = dispWin;
+
+	return drawn;
+}
+
+// Display row of the console line 'row'
+// With display scrolling the line buffer index is also the line position in display memory
+//---------------------------------------------------
+static int _consoleLineY(tft_console_t *con, int row)
+{
+	if (!con->hw_scroll) return con->top + (row * con->line_height);
+	return con->top + (((con->first + row) % con->lines) * con->line_height);
+}
+
+// Print 'len' bytes of the string to the console line 'row' at x
+// If 'clear' is set, the rest of the line is cleared to background color
+// Returns x position after the printed text
+//-------------------------------------------------------------------------------------------
+static int _consoleText(tft_console_t *con, int row, int x, char *st, int len, uint8_t clear)
+{
+	int y = _consoleLineY(con, row);
+	dispWin_t win = dispWin;
+	uint8_t wrap = text_wrap;
+	int rotate = font_rotate;
+	int last_x = TFT_X;
+	int last_y = TFT_Y;
+
+	// console line is the clip window
+	dispWin.x1 = 0;
+	dispWin.y1 = y;
+	dispWin.x2 = _width-1;
+	dispWin.y2 = y + con->line_height - 1;
+	text_wrap = 0;
+	font_rotate = 0;
+
+	if ((clear) && ((font_transparent) || (len == 0) || (x > 0))) {
+		_fillRect(x, y, _width - x, con->line_height, _bg);
+		clear = 0;
+	}
+	if (len > 0) {
+		TFT_X = x;
+		_printTextPart(st, len, x, y);
+		x = TFT_X;
+	}
+	if (clear) {
+		// the printed text is drawn with its background
+		if (x < _width) _fillRect(x, y, _width - x, cfont.y_size, _bg);
+		if (con->line_height > cfont.y_size) _fillRect(0, y + cfont.y_size, _width, con->line_height - cfont.y_size, _bg);
+	}
+
+	dispWin = win;
+	text_wrap = wrap;
+	font_rotate = rotate;
+	TFT_X = last_x;
+	TFT_Y = last_y;
+	return x;
+}
+
+// Move to the start of the next console line, scroll the console if at the last line
+//---------------------------------------------
+static void _consoleNewLine(tft_console_t *con)
+{
+	con->x = 0;
+	con->clear = 1;
+	if (con->row < (con->lines - 1)) {
+		con->row++;
+		return;
+	}
+
+	// the top line buffer becomes the last line
+	if (con->text) {
+		free(con->text[con->first]);
+		con->text[con->first] = NULL;
+	}
+	con->first = (con->first + 1) % con->lines;
+	if (con->hw_scroll) {
+		disp_set_scroll_offset(con->first * con->line_height);
+		return;
+	}
+	// redraw the console lines
+	for (int row=0; row < (con->lines - 1); row++) {
+		char *st = con->text[(con->first + row) % con->lines];
+		_consoleText(con, row, 0, st, (st) ? strlen(st) : 0, 1);
+	}
+}
+
+//====================================================
+tft_console_t *TFT_console_create(int top, int height)
+{
+	if (cfont.bitmap != 1) return NULL;
+	int line_height = cfont.y_size + font_line_space;
+	int lines = height / line_height;
+	if ((lines < 1) || (top < 0) || ((top + height) > _height)) return NULL;
+
+	tft_console_t *con = calloc(1, sizeof(tft_console_t));
+	if (con == NULL) return NULL;
+	con->top = top;
+	con->lines = lines;
+	con->line_height = line_height;
+
+	// drawing to the frame buffer is not scrolled
+	con->hw_scroll = ((tft_fb == NULL) && (disp_set_scroll_area(top, lines * line_height, 0) == 0));
+	if (!con->hw_scroll) {
+		con->text = calloc(lines, sizeof(char *));
+		if (con->text == NULL) {
+			free(con);
+			return NULL;
+		}
+	}
+	TFT_console_clear(con);
+	return con;
+}
+
+//==================================================
+void TFT_console_print(tft_console_t *con, char *st)
+{
+	while (*st != 0) {
+		if (*st == '\n') {
+			if (con->newline) {
+				// empty line
+				_consoleNewLine(con);
+				con->x = _consoleText(con, con->row, 0, st, 0, 1);
+				con->clear = 0;
+			}
+			con->newline = 1;
+			st++;
+			continue;
+		}
+		if (con->newline) {
+			_consoleNewLine(con);
+			con->newline = 0;
+		}
+
+		char *end = strchr(st, '\n');
+		int len = (end) ? (end - st) : strlen(st);
+		if (con->text) {
+			// save the line text for redrawing
+			char **text = con->text + ((con->first + con->row) % con->lines);
+			int tlen = (*text) ? strlen(*text) : 0;
+			char *t = realloc(*text, tlen + len + 1);
+			if (t) {
+				memcpy(t + tlen, st, len);
+				t[tlen + len] = '\0';
+				*text = t;
+			}
+		}
+		con->x = _consoleText(con, con->row, con->x, st, len, con->clear);
+		con->clear = 0;
+		st += len;
+	}
+}
+
+//========================================
+void TFT_console_clear(tft_console_t *con)
+{
+	dispWin_t win = dispWin;
+	TFT_resetclipwin();
+	_fillRect(0, con->top, _width, con->lines * con->line_height, _bg);
+	dispWin = win;
+
+	if (con->hw_scroll) disp_set_scroll_offset(0);
+	if (con->text) {
+		for (int i=0; i < con->lines; i++) {
+			free(con->text[i]);
+			con->text[i] = NULL;
+		}
+	}
+	con->first = 0;
+	con->row = 0;
+	con->x = 0;
+	con->newline = 0;
+	con->clear = 0;
+}
+
+//=========================================
+void TFT_console_delete(tft_console_t *con)
+{
+	if (con == NULL) return;
+	if (con->hw_scroll) disp_set_scroll_area(0, 0, 0);
+	if (con->text) {
+		for (int i=0; i < con->lines; i++) free(con->text[i]);
+		free(con->text);
+	}
+	free(con);
+}
+
+// Chart row of the sample value, 0 at the chart top
+//---------------------------------------------------
+static int _chartRow(tft_chart_t *chart, float value)
+{
+	if (chart->max == chart->min) return chart->height - 1;
+	int row = (chart->height - 1) - (int)((((value - chart->min) * (chart->height - 1)) / (chart->max - chart->min)) + 0.5);
+	if (row < 0) row = 0;
+	if (row >= chart->height) row = chart->height - 1;
+	return row;
+}
+
+// Compose the chart column 'col' in column 'c' of the buffer 'cols' columns wide
+// The trace segment is drawn from the previous sample; if 'col' < 0 the column is empty
+//--------------------------------------------------------------------
+static void _chartColumn(tft_chart_t *chart, int c, int cols, int col)
+{
+	color_t *p = chart->buf + c;
+	for (int r=0; r < chart->height; r++) {
+		p[r * cols] = ((chart->grid > 0) && (((chart->height - 1 - r) % chart->grid) == 0)) ? chart->grid_color : chart->bg;
+	}
+	if (col < 0) return;
+
+	// the oldest sample has no previous one
+	int oldest = (chart->count < chart->width) ? 0 : chart->head;
+	int r1 = _chartRow(chart, chart->samples[col]);
+	int r0 = (col == oldest) ? r1 : _chartRow(chart, chart->samples[(col + chart->width - 1) % chart->width]);
+	if (r0 > r1) {
+		int tmp = r0;
+		r0 = r1;
+		r1 = tmp;
+	}
+	for (int r=r0; r <= r1; r++) p[r * cols] = chart->color;
+}
+
+// Send 'cols' columns composed in the buffer to the chart column 'col'
+//-----------------------------------------------------------
+static void _chartSend(tft_chart_t *chart, int col, int cols)
+{
+	int x = chart->x + col;
+	disp_select();
+	send_data(x, chart->y, x + cols - 1, chart->y + chart->height - 1, cols * chart->height, chart->buf);
+	disp_deselect();
+}
+
+//======================================================================================================
+tft_chart_t *TFT_chart_create(int x, int y, int width, int height, float min, float max, uint8_t scroll)
+{
+	x += dispWin.x1;
+	y += dispWin.y1;
+	if ((width < 2) || (height < 1) || (x < dispWin.x1) || (y < dispWin.y1) ||
+			((x + width - 1) > dispWin.x2) || ((y + height - 1) > dispWin.y2)) return NULL;
+
+	tft_chart_t *chart = calloc(1, sizeof(tft_chart_t));
+	if (chart == NULL) return NULL;
+	chart->x = x;
+	chart->y = y;
+	chart->width = width;
+	chart->height = height;
+	chart->min = min;
+	chart->max = max;
+	chart->color = _fg;
+	chart->bg = _bg;
+	chart->grid_color = _fg;
+	chart->buf_cols = CHART_BUF_SIZE / (height * sizeof(color_t));
+	if (chart->buf_cols < 1) chart->buf_cols = 1;
+	if (chart->buf_cols > width) chart->buf_cols = width;
+	chart->samples = malloc(width * sizeof(float));
+	chart->buf = heap_caps_malloc(chart->buf_cols * height * sizeof(color_t), MALLOC_CAP_DMA);
+	if ((chart->samples == NULL) || (chart->buf == NULL)) {
+		TFT_chart_delete(chart);
+		return NULL;
+	}
+
+	// drawing to the frame buffer is not scrolled
+	chart->hw_scroll = ((scroll) && (tft_fb == NULL) && (disp_set_scroll_area(x, width, 1) == 0));
+	TFT_chart_clear(chart);
+	return chart;
+}
+
+//================================================================
+void TFT_chart_add(tft_chart_t *chart, const float *values, int n)
+{
+	while (n > 0) {
+		// new columns up to the chart end are composed and sent together
+		int col = chart->head;
+		int cols = chart->width - col;
+		if (cols > n) cols = n;
+		if (cols > chart->buf_cols) cols = chart->buf_cols;
+
+		memcpy(chart->samples + col, values, cols * sizeof(float));
+		chart->head = (col + cols) % chart->width;
+		chart->count += cols;
+		if (chart->count > chart->width) chart->count = chart->width;
+
+		for (int c=0; c < cols; c++) _chartColumn(chart, c, cols, col + c);
+		_chartSend(chart, col, cols);
+		values += cols;
+		n -= cols;
+	}
+
+	if (chart->count < chart->width) return;
+	// the oldest sample is scrolled to the left chart side and drawn without the segment from the removed sample,
+	// or it is cleared to mark the sweep position
+	_chartColumn(chart, 0, 1, (chart->hw_scroll) ? chart->head : -1);
+	_chartSend(chart, chart->head, 1);
+	if (chart->hw_scroll) disp_set_scroll_offset(chart->head);
+}
+
+//=======================================
+void TFT_chart_redraw(tft_chart_t *chart)
+{
+	for (int col=0; col < chart->width; col += chart->buf_cols) {
+		int cols = chart->width - col;
+		if (cols > chart->buf_cols) cols = chart->buf_cols;
+		for (int c=0; c < cols; c++) {
+			int n = col + c;
+			uint8_t empty = (chart->count < chart->width) ? (n >= chart->count) : ((!chart->hw_scroll) && (n == chart->head));
+			_chartColumn(chart, c, cols, (empty) ? -1 : n);
+		}
+		_chartSend(chart, col, cols);
+	}
+}
+
+//======================================
+void TFT_chart_clear(tft_chart_t *chart)
+{
+	chart->head = 0;
+	chart->count = 0;
+	if (chart->hw_scroll) disp_set_scroll_offset(0);
+	TFT_chart_redraw(chart);
+}
+
+//=======================================
+void TFT_chart_delete(tft_chart_t *chart)
+{
+	if (chart == NULL) return;
+	if (chart->hw_scroll) disp_set_scroll_area(0, 0, 0);
+	if (chart->samples) free(chart->samples);
+	if (chart->buf) free(chart->buf);
+	free(chart);
+}
+
+
+// ================ Service functions ==========================================
+
+// Change the screen rotation.
+// Input: m new rotation value (0 to 3)
+//=================================
+void TFT_setRotation(uint8_t rot) {
+	// frame buffer geometry is not valid after rotation change
+	if (fb_is_canvas) TFT_canvas_select(NULL);
+	else if (tft_fb) TFT_fb_end(0);
+
+    if (rot > 3) {
+        disp_set_madctl(rot & 0xF8); // for testing, manually set MADCTL register
+    }
+	else {
+		orientation = rot;
+        _tft_setRotation(rot);
+	}
+
+	dispWin.x1 = 0;
+	dispWin.y1 = 0;
+	dispWin.x2 = _width-1;
+	dispWin.y2 = _height-1;
+
+	TFT_fillScreen(_bg);
+}
+
+// Send the command to invert all of the colors.
+// Input: i 0 to disable inversion; non-zero to enable inversion
+//==========================================
+void TFT_invertDisplay(const uint8_t mode) {
+  if ( mode == INVERT_ON ) disp_spi_transfer_cmd(TFT_INVONN);
+  else disp_spi_transfer_cmd(TFT_INVOFF);
+}
+
+// Select gamma curve
+// Input: gamma = 0~3
+//==================================
+void TFT_setGammaCurve(uint8_t gm) {
+  uint8_t gamma_curve = 1 << (gm & 0x03);
+  disp_spi_transfer_cmd_data(TFT_CMD_GAMMASET, &gamma_curve, 1);
+}
+
+//===========================================================
+color_t HSBtoRGB(float _hue, float _sat, float _brightness) {
+ float red = 0.0;
+ float green = 0.0;
+ float blue = 0.0;
+
+ if (_sat == 0.0) {
+   red = _brightness;
+   green = _brightness;
+   blue = _brightness;
+ } else {
+   if (_hue == 360.0) {
+     _hue = 0;
+   }
+
+   int slice = (int)(_hue / 60.0);
+   float hue_frac = (_hue / 60.0) - slice;
+
+   float aa = _brightness * (1.0 - _sat);
+   float bb = _brightness * (1.0 - _sat * hue_frac);
+   float cc = _brightness * (1.0 - _sat * (1.0 - hue_frac));
+
+   switch(slice) {
+     case 0:
+         red = _brightness;
+         green = cc;
+         blue = aa;
+         break;
+     case 1:
+         red = bb;
+         green = _brightness;
+         blue = aa;
+         break;
+     case 2:
+         red = aa;
+         green = _brightness;
+         blue = cc;
+         break;
+     case 3:
+         red = aa;
+         green = bb;
+         blue = _brightness;
+         break;
+     case 4:
+         red = cc;
+         green = aa;
+         blue = _brightness;
+         break;
+     case 5:
+         red = _brightness;
+         green = aa;
+         blue = bb;
+         break;
+     default:
+         red = 0.0;
+         green = 0.0;
+         blue = 0.0;
+         break;
+   }
+ }
+
+ color_t color;
+ color.r = ((uint8_t)(red * 255.0)) & 0xFC;
+ color.g = ((uint8_t)(green * 255.0)) & 0xFC;
+ color.b = ((uint8_t)(blue * 255.0)) & 0xFC;
+
+ return color;
+}
+
+//==============================================================
+color_t TFT_HSBtoRGB_fixed(int hue, uint8_t sat, uint8_t bright)
+{
+	color_t color;
+	if (sat == 0) {
+		color.r = bright;
+		color.g = bright;
+		color.b = bright;
+		return color;
+	}
+
+	hue %= 360;
+	if (hue < 0) hue += 360;
+	int slice = hue / 60;
+	int hue_frac = ((hue - (slice * 60)) * 256) / 60;		// 0~255
+
+	uint8_t aa = (bright * (255 - sat)) / 255;
+	uint8_t bb = (bright * (65280 - (sat * hue_frac))) / 65280;
+	uint8_t cc = (bright * (65280 - (sat * (256 - hue_frac)))) / 65280;
+
+	switch (slice) {
+		case 0: color.r = bright; color.g = cc; color.b = aa; break;
+		case 1: color.r = bb; color.g = bright; color.b = aa; break;
+		case 2: color.r = aa; color.g = bright; color.b = cc; break;
+		case 3: color.r = aa; color.g = bb; color.b = bright; break;
+		case 4: color.r = cc; color.g = aa; color.b = bright; break;
+		default: color.r = bright; color.g = aa; color.b = bb; break;
+	}
+	return color;
+}
+
+//===========================================================
+color_t TFT_blendColor(color_t fg, color_t bg, uint8_t alpha)
+{
+	int a = alpha + (alpha >> 7);	// 0~256
+	color_t color;
+	color.r = BLEND_COMP(fg.r, bg.r, a);
+	color.g = BLEND_COMP(fg.g, bg.g, a);
+	color.b = BLEND_COMP(fg.b, bg.b, a);
+	return color;
+}
+
+//====================================================
+color_t *TFT_makeRamp(color_t from, color_t to, int n)
+{
+	if (n < 1) return NULL;
+	color_t *ramp = malloc(n * sizeof(color_t));
+	if (ramp == NULL) return NULL;
+
+	for (int i=0; i<n; i++) {
+		// position in the ramp, 0~256, rounded
+		int a = (n > 1) ? (((i * 256) + ((n - 1) / 2)) / (n - 1)) : 0;
+		ramp[i].r = BLEND_COMP(to.r, from.r, a);
+		ramp[i].g = BLEND_COMP(to.g, from.g, a);
+		ramp[i].b = BLEND_COMP(to.b, from.b, a);
+	}
+	return ramp;
+}
+//=====================================================================
+void TFT_setclipwin(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+{
+	dispWin.x1 = x1;
+	dispWin.y1 = y1;
+	dispWin.x2 = x2;
+	dispWin.y2 = y2;
+
+	if (dispWin.x2 >= _target_width()) dispWin.x2 = _target_width()-1;
+	if (dispWin.y2 >= _target_height()) dispWin.y2 = _target_height()-1;
+	if (dispWin.x1 > dispWin.x2) dispWin.x1 = dispWin.x2;
+	if (dispWin.y1 > dispWin.y2) dispWin.y1 = dispWin.y2;
+}
+
+//=====================
+void TFT_resetclipwin()
+{
+	dispWin.x2 = _target_width()-1;
+	dispWin.y2 = _target_height()-1;
+	dispWin.x1 = 0;
+	dispWin.y1 = 0;
+}
+
+//==========================================================================
+void set_7seg_font_atrib(uint8_t l, uint8_t w, int outline, color_t color) {
+	if (cfont.bitmap != 2) return;
+
+	if (l < 6) l = 6;
+    if (l > 40) l = 40;
+    if (w < 1) w = 1;
+    if (w > (l/2)) w = l/2;
+    if (w > 12) w = 12;
+
+    cfont.x_size = l;
+	cfont.y_size = w;
+	cfont.offset = outline;
+	cfont.color  = color;
+}
+
+//==========================================
+int TFT_getfontsize(int *width, int* height)
+{
+  if (cfont.bitmap == 1) {
+    if (cfont.x_size != 0) *width = cfont.x_size;	// fixed width font
+    else *width = cfont.max_x_size;					// proportional font
+    *height = cfont.y_size;
+  }
+  else if (cfont.bitmap == 2) {
+	// 7-segment font
+    *width = _7seg_width();
+    *height = _7seg_height();
+  }
+  else {
+    *width = 0;
+    *height = 0;
+    return 0;
   }
+  return 1;
 }
 
-//----------------------------------------------------------------------------------------------
-static void barHor(int16_t x, int16_t y, int16_t w, int16_t l, color_t color, color_t outline) {
-  _fillTriangle(x+2*w, y+2*w-1, x+w+1, y+w, x+2*w, y+1, color);
-  _fillTriangle(x+2*w+l+1, y+2*w-1, x+3*w+l, y+w, x+2*w+l+1, y+1, color);
-  _fillRect(x+2*w+1, y, l, 2*w+1, color);
-  if (cfont.offset) {
-    _drawTriangle(x+2*w, y+2*w-1, x+w+1, y+w, x+2*w, y+1, outline);
-    _drawTriangle(x+2*w+l+1, y+2*w-1, x+3*w+l, y+w, x+2*w+l+1, y+1, outline);
-    _drawRect(x+2*w+1, y, l, 2*w+1, outline);
-  }
+//=====================
+int TFT_getfontheight()
+{
+  if (cfont.bitmap == 1) return cfont.y_size;			// Bitmap font
+  else if (cfont.bitmap == 2) return _7seg_height();	// 7-segment font
+  return 0;
 }
 
-//--------------------------------------------------------------------------------------------
-static void _draw7seg(int16_t x, int16_t y, int8_t num, int16_t w, int16_t l, color_t color) {
-  /* TODO: clipping */
-  if (num < 0x2D || num > 0x3A) return;
+//====================
+void TFT_saveClipWin()
+{
+	dispWinTemp.x1 = dispWin.x1;
+	dispWinTemp.y1 = dispWin.y1;
+	dispWinTemp.x2 = dispWin.x2;
+	dispWinTemp.y2 = dispWin.y2;
+}
 
-  int16_t c = font_bcd[num-0x2D];
-  int16_t d = 2*w+l+1;
+//=======================
+void TFT_restoreClipWin()
+{
+	dispWin.x1 = dispWinTemp.x1;
+	dispWin.y1 = dispWinTemp.y1;
+	dispWin.x2 = dispWinTemp.x2;
+	dispWin.y2 = dispWinTemp.y2;
+}
 
-  // === Clear unused segments ===
-  if (!(c & 0x001)) barVert(x+d, y+d, w, l, _bg, _bg);
-  if (!(c & 0x002)) barVert(x,   y+d, w, l, _bg, _bg);
-  if (!(c & 0x004)) barVert(x+d, y, w, l, _bg, _bg);
-  if (!(c & 0x008)) barVert(x,   y, w, l, _bg, _bg);
-  if (!(c & 0x010)) barHor(x, y+2*d, w, l, _bg, _bg);
-  if (!(c & 0x020)) barHor(x, y+d, w, l, _bg, _bg);
-  if (!(c & 0x040)) barHor(x, y, w, l, _bg, _bg);
 
-  if (!(c & 0x080)) {
-    // low point
-    _fillRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, _bg);
-    if (cfont.offset) _drawRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, _bg);
-  }
-  if (!(c & 0x100)) {
-    // down middle point
-    _fillRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, _bg);
-    if (cfont.offset) _drawRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, _bg);
-  }
-  if (!(c & 0x800)) {
-	// up middle point
-    _fillRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, _bg);
-    if (cfont.offset) _drawRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, _bg);
-  }
-  if (!(c & 0x200)) {
-    // middle, minus
-    _fillRect(x+2*w+1, y+d, l, 2*w+1, _bg);
-    if (cfont.offset) _drawRect(x+2*w+1, y+d, l, 2*w+1, _bg);
-  }
+// ================ Drawing context functions ==================================
 
-  // === Draw used segments ===
-  if (c & 0x001) barVert(x+d, y+d, w, l, color, cfont.color);	// down right
-  if (c & 0x002) barVert(x,   y+d, w, l, color, cfont.color);	// down left
-  if (c & 0x004) barVert(x+d, y, w, l, color, cfont.color);		// up right
-  if (c & 0x008) barVert(x,   y, w, l, color, cfont.color);		// up left
-  if (c & 0x010) barHor(x, y+2*d, w, l, color, cfont.color);	// down
-  if (c & 0x020) barHor(x, y+d, w, l, color, cfont.color);		// middle
-  if (c & 0x040) barHor(x, y, w, l, color, cfont.color);		// up
+// Copy the drawing state, the context keeps its own frame buffer target and glyph data buffer
+// The copy does not reference the font loaded from file, the state's context must keep it loaded
+//--------------------------------------------------------------
+static void _contextLoad(tft_ctx_t *ctx, const tft_ctx_t *state)
+{
+	tft_fb_t *fb = ctx->fb;
+	uint8_t *glyph_data = ctx->glyph_data;
+	uint16_t glyph_data_size = ctx->glyph_data_size;
+
+	*ctx = *state;
+	ctx->fb = fb;
+	ctx->glyph_data = glyph_data;
+	ctx->glyph_data_size = glyph_data_size;
+}
 
-  if (c & 0x080) {
-    // low point
-    _fillRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, color);
-    if (cfont.offset) _drawRect(x+(d/2), y+2*d, 2*w+1, 2*w+1, cfont.color);
-  }
-  if (c & 0x100) {
-    // down middle point
-    _fillRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, color);
-    if (cfont.offset) _drawRect(x+(d/2), y+d+2*w+1, 2*w+1, l/2, cfont.color);
-  }
-  if (c & 0x800) {
-	// up middle point
-    _fillRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, color);
-    if (cfont.offset) _drawRect(x+(d/2), y+(2*w)+1+(l/2), 2*w+1, l/2, cfont.color);
-  }
-  if (c & 0x200) {
-    // middle, minus
-    _fillRect(x+2*w+1, y+d, l, 2*w+1, color);
-    if (cfont.offset) _drawRect(x+2*w+1, y+d, l, 2*w+1, cfont.color);
-  }
+//=============================
+tft_ctx_t *TFT_context_create()
+{
+	tft_ctx_t *ctx = calloc(1, sizeof(tft_ctx_t));
+	if (ctx == NULL) return NULL;
+
+	// the new context draws to display, with the font loaded by the creating task's context
+	_contextLoad(ctx, TFT_CTX);
+	_userFontAcquire(ctx->user_font);
+	if (tft_fb) ctx->win = dispWinFb;
+	ctx->fb_canvas = 0;
+	return ctx;
 }
-//==============================================================================
 
-//======================================
-void TFT_print(char *st, int x, int y) {
-	int stl, i, tmpw, tmph, fh;
-	uint8_t ch;
+//====================================
+int TFT_context_select(tft_ctx_t *ctx)
+{
+	#if TFT_TASK_CONTEXTS
+	vTaskSetThreadLocalStoragePointer(NULL, TFT_TLS_INDEX, ctx);
+	return 0;
+	#else
+	return -1;
+	#endif
+}
 
-	if (cfont.bitmap == 0) return; // wrong font selected
+//=====================================
+void TFT_context_delete(tft_ctx_t *ctx)
+{
+	if (ctx == NULL) return;
+	_userFontRelease(ctx->user_font);
+	if (ctx->glyph_data) free(ctx->glyph_data);
+	free(ctx);
+}
 
-	// ** Rotated strings cannot be aligned
-	if ((font_rotate != 0) && ((x <= CENTER) || (y <= CENTER))) return;
 
-	if ((x < LASTX) || (font_rotate == 0)) TFT_OFFSET = 0;
+// ================ Frame buffer functions =====================================
 
-	if ((x >= LASTX) && (x < LASTY)) x = TFT_X + (x-LASTX);
-	else if (x > CENTER) x += dispWin.x1;
+//------------------------------------------------------------------
+static tft_fb_t *_fb_alloc(int width, int height, uint8_t scale)
+{
+	tft_fb_t *fb = malloc(sizeof(tft_fb_t));
+	if (fb == NULL) return NULL;
+
+	int size = width * height * sizeof(color_t);
+	fb->buf = NULL;
+	fb->dma = 0;
+	#if CONFIG_SPIRAM_SUPPORT
+	// Large buffer is placed in PSRAM, it is sent to display through internal DMA buffers
+	if (size > TFT_FB_INTERNAL_MAX) fb->buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+	#endif
+	if (fb->buf == NULL) {
+		// Buffer in internal DMA capable memory is sent to display directly
+		fb->buf = heap_caps_malloc(size, MALLOC_CAP_DMA);
+		if (fb->buf) fb->dma = 1;
+		else fb->buf = malloc(size);
+	}
+	if (fb->buf == NULL) {
+		free(fb);
+		return NULL;
+	}
+	fb->width = width;
+	fb->height = height;
+	fb->org_x = 0;
+	fb->org_y = 0;
+	fb->scale = scale;
+	return fb;
+}
 
-	if (y >= LASTY) y = TFT_Y + (y-LASTY);
-	else if (y > CENTER) y += dispWin.y1;
+//-------------------------------------
+static void _fb_free(tft_fb_t *fb)
+{
+	free(fb->buf);
+	free(fb);
+}
 
-	// ** Get number of characters in string to print
-	stl = strlen(st);
+//=============================
+int TFT_fb_begin(uint8_t scale)
+{
+	if (tft_fb) return -1;		// already drawing to frame buffer
+	if (scale < 1) scale = 1;
+	if (scale > 3) scale = 3;
 
-	// ** Calculate CENTER, RIGHT or BOTTOM position
-	tmpw = TFT_getStringWidth(st);	// string width in pixels
-	fh = cfont.y_size;			// font height
-	if ((cfont.x_size != 0) && (cfont.bitmap == 2)) {
-		// 7-segment font
-		fh = (3 * (2 * cfont.y_size + 1)) + (2 * cfont.x_size);  // 7-seg character height
-	}
+	int width = (dispWin.x2 - dispWin.x1 + 1) / scale;
+	int height = (dispWin.y2 - dispWin.y1 + 1) / scale;
+	if ((width < 1) || (height < 1)) return -2;
 
-	if (x == RIGHT) x = dispWin.x2 - tmpw + dispWin.x1;
-	else if (x == CENTER) x = (((dispWin.x2 - dispWin.x1 + 1) - tmpw) / 2) + dispWin.x1;
+	tft_fb_t *fb = _fb_alloc(width, height, scale);
+	if (fb == NULL) return -3;
+	fb->x = dispWin.x1;
+	fb->y = dispWin.y1;
 
-	if (y == BOTTOM) y = dispWin.y2 - fh + dispWin.y1;
-	else if (y==CENTER) y = (((dispWin.y2 - dispWin.y1 + 1) - (fh/2)) / 2) + dispWin.y1;
+	// Drawing coordinates are now frame buffer coordinates
+	dispWinFb = dispWin;
+	tft_fb = fb;
+	TFT_resetclipwin();
+	TFT_fillScreen(_bg);
 
-	if (x < dispWin.x1) x = dispWin.x1;
-	if (y < dispWin.y1) y = dispWin.y1;
-	if ((x > dispWin.x2) || (y > dispWin.y2)) return;
+	return 0;
+}
 
-	TFT_X = x;
-	TFT_Y = y;
+//==================
+void TFT_fb_flush()
+{
+	if ((tft_fb == NULL) || (fb_is_canvas)) return;
+	fb_send(tft_fb, tft_fb->x, tft_fb->y, 1);
+}
 
-	// ** Adjust y position
-	tmph = cfont.y_size; // font height
-	// for non-proportional fonts, char width is the same for all chars
-	tmpw = cfont.x_size;
-	if (cfont.x_size != 0) {
-		if (cfont.bitmap == 2) {	// 7-segment font
-			tmpw = _7seg_width();	// character width
-			tmph = _7seg_height();	// character height
-		}
+//============================
+void TFT_fb_end(uint8_t flush)
+{
+	if ((tft_fb == NULL) || (fb_is_canvas)) return;
+
+	tft_fb_t *fb = tft_fb;
+	if (flush) fb_send(fb, fb->x, fb->y, 1);
+
+	tft_fb = NULL;
+	dispWin = dispWinFb;
+	_fb_free(fb);
+}
+
+// ================ Canvas functions ===========================================
+
+//================================================
+tft_fb_t *TFT_canvas_create(int width, int height)
+{
+	if ((width < 1) || (height < 1)) return NULL;
+
+	tft_fb_t *canvas = _fb_alloc(width, height, 1);
+	if (canvas == NULL) return NULL;
+
+	canvas->x = 0;
+	canvas->y = 0;
+	for (int i=0; i<(width*height); i++) {
+		canvas->buf[i] = _bg;
 	}
-	else TFT_OFFSET = 0;	// fixed font; offset not needed
+	return canvas;
+}
 
-	if ((TFT_Y + tmph - 1) > dispWin.y2) return;
+//=====================================
+int TFT_canvas_select(tft_fb_t *canvas)
+{
+	if (canvas == tft_fb) return 0;
+	if ((tft_fb) && (!fb_is_canvas)) return -1;		// drawing to frame buffer
+
+	if (canvas == NULL) {
+		// back to display
+		tft_fb = NULL;
+		fb_is_canvas = 0;
+		dispWin = dispWinFb;
+		return 0;
+	}
 
-	int offset = TFT_OFFSET;
+	if (tft_fb == NULL) dispWinFb = dispWin;
+	tft_fb = canvas;
+	fb_is_canvas = 1;
+	TFT_resetclipwin();
+	return 0;
+}
 
-	for (i=0; i<stl; i++) {
-		ch = st[i]; // get string character
+//==================================================
+void TFT_canvas_blit(tft_fb_t *canvas, int x, int y)
+{
+	if (canvas == NULL) return;
+	canvas->x = x;
+	canvas->y = y;
+	fb_send(canvas, x, y, 0);
+}
 
-		if (ch == 0x0D) { // === '\r', erase to eol ====
-			if ((!font_transparent) && (font_rotate==0)) _fillRect(TFT_X, TFT_Y,  dispWin.x2+1-TFT_X, tmph, _bg);
+//==================================================================
+int TFT_canvas_blitRotated(tft_fb_t *canvas, int x, int y, uint8_t rot)
+{
+	if (canvas == NULL) return -1;
+	canvas->x = x;
+	canvas->y = y;
+	return fb_send_rotated(canvas, x, y, rot);
+}
+
+//=====================
+void TFT_canvas_wait()
+{
+	// the display stays selected by this task until the transfer is finished
+	fb_send_wait();
+}
+
+//=======================================
+void TFT_canvas_delete(tft_fb_t *canvas)
+{
+	if (canvas == NULL) return;
+	if (canvas == tft_fb) TFT_canvas_select(NULL);
+	// the canvas may still be sent to display
+	TFT_canvas_wait();
+	_fb_free(canvas);
+}
+
+
+// ================ Band rendering functions ===================================
+
+#define TFT_BAND_TASK_STACK	4096
+
+typedef struct {
+	void				(*render)(void *arg);	// user's render function
+	void				*arg;					// user's render function argument
+	int					first;					// first band rendered by this worker
+	int					nbands;					// total number of bands
+	int					band_height;			// height of the band in pixels
+	tft_ctx_t			start_ctx;				// drawing context at the start of each band
+	tft_ctx_t			ctx;					// worker's drawing context and target
+	tft_fb_t			*band_buf[2];			// worker's band buffers
+	QueueHandle_t		free_q;					// band buffers ready for rendering
+	QueueHandle_t		ready_q;				// rendered band buffers ready for sending
+	SemaphoreHandle_t	done;					// given when the worker finishes
+} band_worker_t;
+
+// Render the worker's bands, every portNUM_PROCESSORS-th band of the window
+//---------------------------------------
+static void band_worker_task(void *arg)
+{
+	band_worker_t *worker = (band_worker_t *)arg;
+
+	// Draw using the worker's context and band buffer
+	#if TFT_TASK_CONTEXTS
+	vTaskSetThreadLocalStoragePointer(NULL, TFT_TLS_INDEX, &worker->ctx);
+	#endif
+
+	for (int band = worker->first; band < worker->nbands; band += portNUM_PROCESSORS) {
+		tft_fb_t *fb;
+		xQueueReceive(worker->free_q, &fb, portMAX_DELAY);
+
+		// Each band starts with the same drawing state
+		_contextLoad(&worker->ctx, &worker->start_ctx);
+		worker->ctx.fb = fb;
+
+		fb->y = dispWin.y1 + (band * worker->band_height);
+		fb->height = ((fb->y + worker->band_height - 1) > dispWin.y2) ? (dispWin.y2 - fb->y + 1) : worker->band_height;
+		fb->org_y = fb->y;
+		for (int i=0; i<(fb->width * fb->height); i++) {
+			fb->buf[i] = _bg;
 		}
 
-		else if (ch == 0x0A) { // ==== '\n', new line ====
-			if (cfont.bitmap == 1) {
-				TFT_Y += tmph + font_line_space;
-				if (TFT_Y > (dispWin.y2-tmph)) break;
-				TFT_X = dispWin.x1;
+		worker->render(worker->arg);
+
+		xQueueSend(worker->ready_q, &fb, portMAX_DELAY);
+	}
+
+	#if TFT_TASK_CONTEXTS
+	vTaskSetThreadLocalStoragePointer(NULL, TFT_TLS_INDEX, NULL);
+	#endif
+	if (worker->ctx.glyph_data) free(worker->ctx.glyph_data);
+	xSemaphoreGive(worker->done);
+	vTaskDelete(NULL);
+}
+
+//-----------------------------------------------
+static void band_worker_free(band_worker_t *worker)
+{
+	if (worker == NULL) return;
+	for (int i=0; i<2; i++) {
+		if (worker->band_buf[i]) _fb_free(worker->band_buf[i]);
+	}
+	if (worker->free_q) vQueueDelete(worker->free_q);
+	if (worker->ready_q) vQueueDelete(worker->ready_q);
+	if (worker->done) vSemaphoreDelete(worker->done);
+	free(worker);
+}
+
+//=========================================================================
+int TFT_render_bands(uint8_t nbands, void (*render)(void *arg), void *arg)
+{
+	int err = 0;
+	int nworkers = 0;
+	band_worker_t *workers[portNUM_PROCESSORS] = { NULL };
+
+	#if !TFT_TASK_CONTEXTS
+	// workers draw with their own context, the per core default contexts are used by other tasks
+	return -2;
+	#endif
+	if (tft_fb) return -1;		// already drawing to frame buffer
+	if (render == NULL) return 0;
+
+	int width = dispWin.x2 - dispWin.x1 + 1;
+	int height = dispWin.y2 - dispWin.y1 + 1;
+	if (nbands < 1) nbands = 1;
+	if (nbands > height) nbands = height;
+	int band_height = (height + nbands - 1) / nbands;
+	nbands = (height + band_height - 1) / band_height;
+
+	// ** Prepare one worker for each core
+	for (int i=0; (i < portNUM_PROCESSORS) && (i < nbands); i++) {
+		band_worker_t *worker = calloc(1, sizeof(band_worker_t));
+		if (worker == NULL) {
+			err = -3;
+			goto exit;
+		}
+		workers[i] = worker;
+		worker->render = render;
+		worker->arg = arg;
+		worker->first = i;
+		worker->nbands = nbands;
+		worker->band_height = band_height;
+		worker->start_ctx = *TFT_CTX;
+		worker->free_q = xQueueCreate(2, sizeof(tft_fb_t *));
+		worker->ready_q = xQueueCreate(2, sizeof(tft_fb_t *));
+		worker->done = xSemaphoreCreateBinary();
+		if ((worker->free_q == NULL) || (worker->ready_q == NULL) || (worker->done == NULL)) {
+			err = -3;
+			goto exit;
+		}
+		for (int n=0; n<2; n++) {
+			worker->band_buf[n] = _fb_alloc(width, band_height, 1);
+			if (worker->band_buf[n] == NULL) {
+				err = -3;
+				goto exit;
 			}
+			worker->band_buf[n]->x = dispWin.x1;
+			worker->band_buf[n]->org_x = dispWin.x1;
+			xQueueSend(worker->free_q, &worker->band_buf[n], 0);
 		}
+	}
 
-		else { // ==== other characters ====
-			if (cfont.x_size == 0) {
-				// for proportional font get character data to 'fontChar'
-				if (getCharPtr(ch)) tmpw = fontChar.xDelta;
-				else continue;
-			}
+	// ** Start the workers
+	for (int i=0; (i < portNUM_PROCESSORS) && (workers[i]); i++) {
+		if (xTaskCreatePinnedToCore(band_worker_task, "TFT_band", TFT_BAND_TASK_STACK, workers[i], uxTaskPriorityGet(NULL), NULL, i) != pdPASS) {
+			err = -4;
+			break;
+		}
+		nworkers++;
+	}
 
-			// check if character can be displayed in the current line
-			if ((TFT_X+tmpw) > (dispWin.x2)) {
-				if (text_wrap == 0) break;
-				TFT_Y += tmph + font_line_space;
-				if (TFT_Y > (dispWin.y2-tmph)) break;
-				TFT_X = dispWin.x1;
-			}
+	// ** Send the rendered bands to display in order
+	for (int band = 0; band < nbands; band++) {
+		band_worker_t *worker = workers[band % portNUM_PROCESSORS];
+		if ((band % portNUM_PROCESSORS) >= nworkers) continue;	// worker not started
+		tft_fb_t *fb;
+		xQueueReceive(worker->ready_q, &fb, portMAX_DELAY);
+		fb_send(fb, fb->x, fb->y, 1);
+		xQueueSend(worker->free_q, &fb, portMAX_DELAY);
+	}
 
-			// Let's print the character
-			if (cfont.x_size == 0) {
-				// == proportional font
-				if (font_rotate == 0) TFT_X += printProportionalChar(TFT_X, TFT_Y) + 1;
-				else {
-					// rotated proportional font
-					offset += rotatePropChar(x, y, offset);
-					TFT_OFFSET = offset;
-				}
-			}
-			else {
-				if (cfont.bitmap == 1) {
-					// == fixed font
-					if ((ch < cfont.offset) || ((ch-cfont.offset) > cfont.numchars)) ch = cfont.offset;
-					if (font_rotate == 0) {
-						printChar(ch, TFT_X, TFT_Y);
-						TFT_X += tmpw;
-					}
-					else rotateChar(ch, x, y, i);
-				}
-				else if (cfont.bitmap == 2) {
-					// == 7-segment font ==
-					_draw7seg(TFT_X, TFT_Y, ch, cfont.y_size, cfont.x_size, _fg);
-					TFT_X += (tmpw + 2);
-				}
+	for (int i=0; i<nworkers; i++) {
+		xSemaphoreTake(workers[i]->done, portMAX_DELAY);
+	}
+
+exit:
+	for (int i=0; i<portNUM_PROCESSORS; i++) {
+		band_worker_free(workers[i]);
+	}
+	return err;
+}
+
+// ================ Alpha blending functions ===================================
+
+// Blend the colors over the display (or frame buffer) content of the rectangle (x,y,w,h)
+// Source colors are taken from 'src' array ('w' colors per line) or 'color' if 'src' is NULL
+// Per pixel alpha is taken from 'amap' array ('w' values per line), multiplied by 'alpha'
+// The rectangle is read and written back in line bands
+//----------------------------------------------------------------------------------------------------------------
+static int _blendRect(int x, int y, int w, int h, color_t *src, color_t color, uint8_t *amap, uint8_t alpha)
+{
+	int err = 0;
+	uint8_t *rbuf = NULL;
+	color_t *wbuf = NULL;
+
+	// clipping
+	int x1 = (x < dispWin.x1) ? dispWin.x1 : x;
+	int y1 = (y < dispWin.y1) ? dispWin.y1 : y;
+	int x2 = ((x + w - 1) > dispWin.x2) ? dispWin.x2 : (x + w - 1);
+	int y2 = ((y + h - 1) > dispWin.y2) ? dispWin.y2 : (y + h - 1);
+	if ((x1 > x2) || (y1 > y2)) return 0;
+
+	int cw = x2 - x1 + 1;
+	int buf_size = (disp_spi->host->max_transfer_sz < TFT_FB_LINEBUF_SIZE) ? disp_spi->host->max_transfer_sz : TFT_FB_LINEBUF_SIZE;
+	int band_lines = buf_size / (cw * sizeof(color_t));
+	if (band_lines < 1) band_lines = 1;
+	if (band_lines > (y2 - y1 + 1)) band_lines = y2 - y1 + 1;
+
+	rbuf = malloc((band_lines * cw * sizeof(color_t)) + 1);
+	wbuf = heap_caps_malloc(band_lines * cw * sizeof(color_t), MALLOC_CAP_DMA);
+	if ((rbuf == NULL) || (wbuf == NULL)) {
+		err = -1;
+		goto exit;
+	}
+
+	int a = alpha + (alpha >> 7);	// 0~256
+	for (int by = y1; by <= y2; by += band_lines) {
+		int nlines = ((by + band_lines - 1) > y2) ? (y2 - by + 1) : band_lines;
+		int len = nlines * cw;
+
+		// read the background from display
+		if (read_data(x1, by, x2, by + nlines - 1, len, rbuf, 1) != ESP_OK) {
+			err = -2;
+			goto exit;
+		}
+
+		color_t *bg = (color_t *)(rbuf + 1);
+		for (int ly = 0; ly < nlines; ly++) {
+			int src_idx = ((by - y + ly) * w) + (x1 - x);
+			for (int lx = 0; lx < cw; lx++, src_idx++) {
+				int n = (ly * cw) + lx;
+				color_t fg = (src) ? src[src_idx] : color;
+				int pa = (amap) ? (((amap[src_idx] + (amap[src_idx] >> 7)) * a) >> 8) : a;
+				wbuf[n].r = BLEND_COMP(fg.r, bg[n].r, pa);
+				wbuf[n].g = BLEND_COMP(fg.g, bg[n].g, pa);
+				wbuf[n].b = BLEND_COMP(fg.b, bg[n].b, pa);
 			}
 		}
+
+		// write the blended colors back
+		disp_select();
+		send_data(x1, by, x2, by + nlines - 1, len, wbuf);
+		disp_deselect();
 	}
+
+exit:
+	if (rbuf) free(rbuf);
+	if (wbuf) free(wbuf);
+	return err;
 }
 
+//====================================================================================
+int TFT_fillRectAlpha(int16_t x, int16_t y, int16_t w, int16_t h, color_t color, uint8_t alpha)
+{
+	if (alpha == 0) return 0;
+	if (alpha == 255) {
+		_fillRect(x+dispWin.x1, y+dispWin.y1, w, h, color);
+		return 0;
+	}
+	return _blendRect(x+dispWin.x1, y+dispWin.y1, w, h, NULL, color, NULL, alpha);
+}
 
-// ================ Service functions ==========================================
+//=========================================================================================
+int TFT_drawImageAlpha(int x, int y, int w, int h, color_t *img, uint8_t *amap, uint8_t alpha)
+{
+	if ((img == NULL) || (w < 1) || (h < 1)) return 0;
+	return _blendRect(x+dispWin.x1, y+dispWin.y1, w, h, img, _fg, amap, alpha);
+}
 
-// Change the screen rotation.
-// Input: m new rotation value (0 to 3)
-//=================================
-void TFT_setRotation(uint8_t rot) {
-    if (rot > 3) {
-        uint8_t madctl = (rot & 0xF8); // for testing, manually set MADCTL register
-		if (disp_select() == ESP_OK) {
-			disp_spi_transfer_cmd_data(TFT_MADCTL, &madctl, 1);
-			disp_deselect();
-		}
-    }
-	else {
-		orientation = rot;
-        _tft_setRotation(rot);
-	}
+//=====================================================
+int TFT_printAlpha(char *st, int x, int y, uint8_t alpha)
+{
+	if (cfont.bitmap == 0) return 0;	// wrong font selected
+	if (font_rotate != 0) return -3;	// rotated strings are not supported
+
+	int w = TFT_getStringWidth(st);
+	int h = TFT_getfontheight();
+	if ((w < 1) || (h < 1)) return 0;
+
+	// ** Calculate the string position, the same way as TFT_print does
+	if ((x >= LASTX) && (x < LASTY)) x = TFT_X + (x-LASTX);
+	else if (x > CENTER) x += dispWin.x1;
+
+	if (y >= LASTY) y = TFT_Y + (y-LASTY);
+	else if (y > CENTER) y += dispWin.y1;
 
+	if (x == RIGHT) x = dispWin.x2 - w + dispWin.x1;
+	else if (x == CENTER) x = (((dispWin.x2 - dispWin.x1 + 1) - w) / 2) + dispWin.x1;
+
+	if (y == BOTTOM) y = dispWin.y2 - h + dispWin.y1;
+	else if (y == CENTER) y = (((dispWin.y2 - dispWin.y1 + 1) - (h/2)) / 2) + dispWin.y1;
+
+	// ** Print the string to the mask buffer
+	tft_fb_t mask;
+	mask.buf = calloc(w * h, sizeof(color_t));
+	if (mask.buf == NULL) return -1;
+	mask.width = w;
+	mask.height = h;
+	mask.x = 0;
+	mask.y = 0;
+	mask.org_x = 0;
+	mask.org_y = 0;
+	mask.scale = 1;
+	mask.dma = 0;
+
+	tft_fb_t *old_fb = tft_fb;
+	dispWin_t old_win = dispWin;
+	color_t old_fg = _fg;
+	uint8_t old_transparent = font_transparent;
+	uint8_t old_wrap = text_wrap;
+
+	tft_fb = &mask;
 	dispWin.x1 = 0;
 	dispWin.y1 = 0;
-	dispWin.x2 = _width-1;
-	dispWin.y2 = _height-1;
+	dispWin.x2 = w - 1;
+	dispWin.y2 = h - 1;
+	_fg.r = 255;
+	_fg.g = 255;
+	_fg.b = 255;
+	font_transparent = 1;
+	text_wrap = 0;
+
+	TFT_print(st, 0, 0);
+
+	tft_fb = old_fb;
+	dispWin = old_win;
+	_fg = old_fg;
+	font_transparent = old_transparent;
+	text_wrap = old_wrap;
+
+	// Mask color is used as alpha, compacted in place to one byte per pixel
+	uint8_t *amap = (uint8_t *)mask.buf;
+	for (int i=0; i<(w*h); i++) {
+		amap[i] = mask.buf[i].g;
+	}
 
-	TFT_fillScreen(_bg);
+	int err = _blendRect(x, y, w, h, NULL, _fg, amap, alpha);
+	free(mask.buf);
+
+	TFT_X = x + w;
+	TFT_Y = y;
+	return err;
 }
 
-// Send the command to invert all of the colors.
-// Input: i 0 to disable inversion; non-zero to enable inversion
-//==========================================
-void TFT_invertDisplay(const uint8_t mode) {
-  if ( mode == INVERT_ON ) disp_spi_transfer_cmd(TFT_INVONN);
-  else disp_spi_transfer_cmd(TFT_INVOFF);
+
+// ================ Widgets ====================================================
+
+#define WIDGET_MAX_AREAS	8	// maximal number of rectangles redrawn by TFT_render()
+
+//------------------------------------------------------------------------------------------------------
+tft_widget_t *TFT_widget_create(tft_widget_t *parent, uint8_t type, int x, int y, int width, int height)
+{
+	if ((type > TFT_WIDGET_GAUGE) || (width < 1) || (height < 1)) return NULL;
+
+	tft_widget_t *widget = calloc(1, sizeof(tft_widget_t));
+	if (widget == NULL) return NULL;
+	widget->type = type;
+	widget->x = x;
+	widget->y = y;
+	widget->width = width;
+	widget->height = height;
+	widget->fg = _fg;
+	widget->bg = _bg;
+	widget->border_color = _fg;
+	widget->border = ((type == TFT_WIDGET_BAR) || (type == TFT_WIDGET_BUTTON)) ? 1 : 0;
+	widget->font = TFT_WIDGET_CURRENT_FONT;
+	widget->align = ((type == TFT_WIDGET_BUTTON) || (type == TFT_WIDGET_GAUGE)) ? CENTER : 0;
+	widget->visible = 1;
+	widget->max = 100;
+	widget->dirty = 1;
+
+	// the new widget is the last (top) child of the parent
+	widget->parent = parent;
+	if (parent) {
+		tft_widget_t **last = &parent->child;
+		while (*last) last = &(*last)->next;
+		*last = widget;
+	}
+	return widget;
 }
 
-// Select gamma curve
-// Input: gamma = 0~3
-//==================================
-void TFT_setGammaCurve(uint8_t gm) {
-  uint8_t gamma_curve = 1 << (gm & 0x03);
-  disp_spi_transfer_cmd_data(TFT_CMD_GAMMASET, &gamma_curve, 1);
+//-------------------------------------------
+static void _widgetFree(tft_widget_t *widget)
+{
+	while (widget->child) {
+		tft_widget_t *child = widget->child;
+		widget->child = child->next;
+		_widgetFree(child);
+	}
+	if (widget->text) free(widget->text);
+	if (widget->decoded) free(widget->decoded);
+	free(widget);
 }
 
-//===========================================================
-color_t HSBtoRGB(float _hue, float _sat, float _brightness) {
- float red = 0.0;
- float green = 0.0;
- float blue = 0.0;
+//==========================================
+void TFT_widget_delete(tft_widget_t *widget)
+{
+	if (widget == NULL) return;
+	tft_widget_t *parent = widget->parent;
+	if (parent) {
+		// remove from the parent's children, the parent is redrawn over the widget's area
+		tft_widget_t **prev = &parent->child;
+		while ((*prev) && (*prev != widget)) prev = &(*prev)->next;
+		if (*prev) *prev = widget->next;
+		parent->dirty = 1;
+	}
+	_widgetFree(widget);
+}
 
- if (_sat == 0.0) {
-   red = _brightness;
-   green = _brightness;
-   blue = _brightness;
- } else {
-   if (_hue == 360.0) {
-     _hue = 0;
-   }
+//==============================================
+void TFT_widget_invalidate(tft_widget_t *widget)
+{
+	if (widget) widget->dirty = 1;
+}
 
-   int slice = (int)(_hue / 60.0);
-   float hue_frac = (_hue / 60.0) - slice;
+//=============================================================
+void TFT_widget_setText(tft_widget_t *widget, const char *text)
+{
+	if ((widget->text == NULL) && (text == NULL)) return;
+	if ((widget->text) && (text) && (strcmp(widget->text, text) == 0)) return;
+	if (widget->text) free(widget->text);
+	widget->text = (text) ? strdup(text) : NULL;
+	widget->dirty = 1;
+}
 
-   float aa = _brightness * (1.0 - _sat);
-   float bb = _brightness * (1.0 - _sat * hue_frac);
-   float cc = _brightness * (1.0 - _sat * (1.0 - hue_frac));
+//=========================================================
+void TFT_widget_setValue(tft_widget_t *widget, float value)
+{
+	if (widget->value == value) return;
+	widget->value = value;
+	widget->dirty = 1;
+}
 
-   switch(slice) {
-     case 0:
-         red = _brightness;
-         green = cc;
-         blue = aa;
-         break;
-     case 1:
-         red = bb;
-         green = _brightness;
-         blue = aa;
-         break;
-     case 2:
-         red = aa;
-         green = _brightness;
-         blue = cc;
-         break;
-     case 3:
-         red = aa;
-         green = bb;
-         blue = _brightness;
-         break;
-     case 4:
-         red = cc;
-         green = aa;
-         blue = _brightness;
-         break;
-     case 5:
-         red = _brightness;
-         green = aa;
-         blue = bb;
-         break;
-     default:
-         red = 0.0;
-         green = 0.0;
-         blue = 0.0;
-         break;
-   }
- }
+//=====================================================================
+void TFT_widget_setColors(tft_widget_t *widget, color_t fg, color_t bg)
+{
+	if ((TFT_compare_colors(widget->fg, fg) == 0) && (TFT_compare_colors(widget->bg, bg) == 0)) return;
+	widget->fg = fg;
+	widget->bg = bg;
+	widget->dirty = 1;
+}
 
- color_t color;
- color.r = ((uint8_t)(red * 255.0)) & 0xFC;
- color.g = ((uint8_t)(green * 255.0)) & 0xFC;
- color.b = ((uint8_t)(blue * 255.0)) & 0xFC;
+//===============================================================
+void TFT_widget_setVisible(tft_widget_t *widget, uint8_t visible)
+{
+	// shown or hidden widget is found by TFT_render() comparing with the drawn state
+	widget->visible = (visible != 0);
+}
 
- return color;
+//======================================================
+void TFT_widget_move(tft_widget_t *widget, int x, int y)
+{
+	// moved widget is found by TFT_render() comparing with the drawn area
+	widget->x = x;
+	widget->y = y;
 }
-//=====================================================================
-void TFT_setclipwin(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+
+//===============================================================
+void TFT_widget_setPressed(tft_widget_t *widget, uint8_t pressed)
 {
-	dispWin.x1 = x1;
-	dispWin.y1 = y1;
-	dispWin.x2 = x2;
-	dispWin.y2 = y2;
+	if (widget->pressed == (pressed != 0)) return;
+	widget->pressed = (pressed != 0);
+	widget->dirty = 1;
+}
 
-	if (dispWin.x2 >= _width) dispWin.x2 = _width-1;
-	if (dispWin.y2 >= _height) dispWin.y2 = _height-1;
-	if (dispWin.x1 > dispWin.x2) dispWin.x1 = dispWin.x2;
-	if (dispWin.y1 > dispWin.y2) dispWin.y1 = dispWin.y2;
+// Add the display rectangle to the list of areas to be redrawn
+// Touching or overlapping areas are merged; if the list is full,
+// the rectangle is merged with the area growing the least
+//------------------------------------------------------------------
+static void _addInvalidArea(int areas[][4], int *n, const int *rect)
+{
+	int r[4];
+	r[0] = (rect[0] < 0) ? 0 : rect[0];
+	r[1] = (rect[1] < 0) ? 0 : rect[1];
+	r[2] = (rect[2] >= _width) ? _width-1 : rect[2];
+	r[3] = (rect[3] >= _height) ? _height-1 : rect[3];
+	if ((r[0] > r[2]) || (r[1] > r[3])) return;
+
+	int i = 0;
+	while (i < *n) {
+		int *a = areas[i];
+		if ((r[0] <= (a[2]+1)) && (a[0] <= (r[2]+1)) && (r[1] <= (a[3]+1)) && (a[1] <= (r[3]+1))) {
+			// merge with the area and check the remaining areas again
+			if (a[0] < r[0]) r[0] = a[0];
+			if (a[1] < r[1]) r[1] = a[1];
+			if (a[2] > r[2]) r[2] = a[2];
+			if (a[3] > r[3]) r[3] = a[3];
+			(*n)--;
+			memcpy(a, areas[*n], sizeof(areas[0]));
+			i = 0;
+		}
+		else i++;
+	}
+
+	if (*n == WIDGET_MAX_AREAS) {
+		int best = 0;
+		int best_growth = 0x7FFFFFFF;
+		for (i=0; i < *n; i++) {
+			int *a = areas[i];
+			int ux1 = (a[0] < r[0]) ? a[0] : r[0];
+			int uy1 = (a[1] < r[1]) ? a[1] : r[1];
+			int ux2 = (a[2] > r[2]) ? a[2] : r[2];
+			int uy2 = (a[3] > r[3]) ? a[3] : r[3];
+			int growth = ((ux2-ux1+1) * (uy2-uy1+1)) - ((a[2]-a[0]+1) * (a[3]-a[1]+1));
+			if (growth < best_growth) {
+				best_growth = growth;
+				best = i;
+			}
+		}
+		int u[4];
+		memcpy(u, areas[best], sizeof(u));
+		if (r[0] < u[0]) u[0] = r[0];
+		if (r[1] < u[1]) u[1] = r[1];
+		if (r[2] > u[2]) u[2] = r[2];
+		if (r[3] > u[3]) u[3] = r[3];
+		(*n)--;
+		memcpy(areas[best], areas[*n], sizeof(areas[0]));
+		// the grown area may now touch other areas
+		_addInvalidArea(areas, n, u);
+		return;
+	}
+	memcpy(areas[*n], r, sizeof(r));
+	(*n)++;
 }
 
-//=====================
-void TFT_resetclipwin()
+// Update the display areas of the widget and its children, 'px', 'py' is the parent's position
+// Areas of the changed, moved, shown or hidden widgets are added to the areas to be redrawn
+//----------------------------------------------------------------------------------------------------------
+static void _widgetUpdateArea(tft_widget_t *widget, int px, int py, uint8_t visible, int areas[][4], int *n)
 {
-	dispWin.x2 = _width-1;
-	dispWin.y2 = _height-1;
-	dispWin.x1 = 0;
-	dispWin.y1 = 0;
+	int r[4];
+	r[0] = px + widget->x;
+	r[1] = py + widget->y;
+	r[2] = r[0] + widget->width - 1;
+	r[3] = r[1] + widget->height - 1;
+	visible = ((visible) && (widget->visible));
+
+	if ((widget->dirty) || (visible != widget->drawn) || ((visible) && (memcmp(r, widget->area, sizeof(r)) != 0))) {
+		if (widget->drawn) _addInvalidArea(areas, n, widget->area);
+		if (visible) _addInvalidArea(areas, n, r);
+	}
+	if ((widget->dirty) && (widget->decoded)) {
+		// the image file, scale, size or background may be changed
+		free(widget->decoded);
+		widget->decoded = NULL;
+	}
+	memcpy(widget->area, r, sizeof(r));
+	widget->drawn = visible;
+	widget->dirty = 0;
+
+	for (tft_widget_t *child = widget->child; child; child = child->next) {
+		_widgetUpdateArea(child, r[0], r[1], visible, areas, n);
+	}
 }
 
-//==========================================================================
-void set_7seg_font_atrib(uint8_t l, uint8_t w, int outline, color_t color) {
-	if (cfont.bitmap != 2) return;
+// Draw the widget border inside the clip window
+//---------------------------------------------
+static void _widgetBorder(tft_widget_t *widget)
+{
+	for (int i=0; i<widget->border; i++) {
+		if (((i * 2) >= widget->width) || ((i * 2) >= widget->height)) break;
+		TFT_drawRect(i, i, widget->width - (i * 2), widget->height - (i * 2), widget->border_color);
+	}
+}
 
-	if (l < 6) l = 6;
-    if (l > 40) l = 40;
-    if (w < 1) w = 1;
-    if (w > (l/2)) w = l/2;
-    if (w > 12) w = 12;
+// Print the widget text aligned inside the border and centered vertically
+//-------------------------------------------------------------------------------
+static void _widgetText(tft_widget_t *widget, char *text, color_t fg, color_t bg)
+{
+	if ((text == NULL) || (*text == 0)) return;
 
-    cfont.x_size = l;
-	cfont.y_size = w;
-	cfont.offset = outline;
-	cfont.color  = color;
+	dispWin_t win = dispWin;
+	int pad = widget->border + ((widget->align == CENTER) ? 0 : 1);
+	if ((dispWin.x2 - dispWin.x1) > (pad * 2)) {
+		dispWin.x1 += pad;
+		dispWin.x2 -= pad;
+	}
+	int y = (widget->height - TFT_getfontheight()) / 2;
+	_fg = fg;
+	_bg = bg;
+	TFT_print(text, widget->align, (y < 0) ? 0 : y);
+	dispWin = win;
 }
 
-//==========================================
-int TFT_getfontsize(int *width, int* height)
+// Value of the bar or gauge as the fraction of its range, 0.0 ~ 1.0
+//------------------------------------------------
+static float _widgetFraction(tft_widget_t *widget)
 {
-  if (cfont.bitmap == 1) {
-    if (cfont.x_size != 0) *width = cfont.x_size;	// fixed width font
-    else *width = cfont.max_x_size;					// proportional font
-    *height = cfont.y_size;
-  }
-  else if (cfont.bitmap == 2) {
-	// 7-segment font
-    *width = _7seg_width();
-    *height = _7seg_height();
-  }
-  else {
-    *width = 0;
-    *height = 0;
-    return 0;
-  }
-  return 1;
+	if (widget->max == widget->min) return 0;
+	float f = (widget->value - widget->min) / (widget->max - widget->min);
+	if (f < 0) f = 0;
+	if (f > 1) f = 1;
+	return f;
 }
 
-//=====================
-int TFT_getfontheight()
+// Decode the IMAGE widget's jpeg file centered on the widget background, as it is drawn on display
+// Returns 'width' x 'height' pixels, NULL if no memory
+//------------------------------------------------------
+static color_t *_widgetDecodeImage(tft_widget_t *widget)
 {
-  if (cfont.bitmap == 1) return cfont.y_size;			// Bitmap font
-  else if (cfont.bitmap == 2) return _7seg_height();	// 7-segment font
-  return 0;
+	tft_fb_t img = { 0 };
+	img.buf = malloc(widget->width * widget->height * sizeof(color_t));
+	if (img.buf == NULL) return NULL;
+	img.width = widget->width;
+	img.height = widget->height;
+	img.x = widget->area[0];
+	img.y = widget->area[1];
+	img.org_x = widget->area[0];
+	img.org_y = widget->area[1];
+	img.scale = 1;
+
+	// the whole widget is decoded, also the part outside the screen
+	dispWin_t win = dispWin;
+	tft_fb_t *target = tft_fb;
+	dispWin.x1 = widget->area[0];
+	dispWin.y1 = widget->area[1];
+	dispWin.x2 = widget->area[2];
+	dispWin.y2 = widget->area[3];
+	tft_fb = &img;
+	TFT_fillRect(0, 0, widget->width, widget->height, widget->bg);
+	TFT_jpg_image(CENTER, CENTER, widget->scale, widget->file, NULL, 0);
+	tft_fb = target;
+	dispWin = win;
+
+	return img.buf;
 }
 
-//====================
-void TFT_saveClipWin()
+// Draw the widget in the clip window set to the widget's display area
+// Only the part inside 'clip' rectangle is needed
+//----------------------------------------------------------------------------------
+static void _drawWidget(tft_widget_t *widget, const int *clip, const tft_ctx_t *ctx)
 {
-	dispWinTemp.x1 = dispWin.x1;
-	dispWinTemp.y1 = dispWin.y1;
-	dispWinTemp.x2 = dispWin.x2;
-	dispWinTemp.y2 = dispWin.y2;
+	int w = widget->width;
+	int h = widget->height;
+	char buf[40];
+
+	if (widget->font == TFT_WIDGET_CURRENT_FONT) cfont = ctx->font;
+	else TFT_setFont(widget->font, NULL);
+
+	switch (widget->type) {
+		case TFT_WIDGET_PANEL:
+		case TFT_WIDGET_LABEL:
+			TFT_fillRect(0, 0, w, h, widget->bg);
+			_widgetBorder(widget);
+			if (widget->type == TFT_WIDGET_LABEL) _widgetText(widget, widget->text, widget->fg, widget->bg);
+			break;
+
+		case TFT_WIDGET_VALUE:
+			TFT_fillRect(0, 0, w, h, widget->bg);
+			_widgetBorder(widget);
+			snprintf(buf, sizeof(buf), "%.*f%s", widget->decimals, widget->value, (widget->text) ? widget->text : "");
+			_widgetText(widget, buf, widget->fg, widget->bg);
+			break;
+
+		case TFT_WIDGET_BAR: {
+			int b = widget->border;
+			TFT_fillRect(0, 0, w, h, widget->bg);
+			_widgetBorder(widget);
+			if (((b * 2) >= w) || ((b * 2) >= h)) break;
+			float f = _widgetFraction(widget);
+			if (w >= h) {
+				int len = (int)(((w - (b * 2)) * f) + 0.5);
+				if (len > 0) TFT_fillRect(b, b, len, h - (b * 2), widget->fg);
+			}
+			else {
+				// vertical bar grows from the bottom
+				int len = (int)(((h - (b * 2)) * f) + 0.5);
+				if (len > 0) TFT_fillRect(b, h - b - len, w - (b * 2), len, widget->fg);
+			}
+			break;
+		}
+
+		case TFT_WIDGET_BUTTON: {
+			// corners show the widgets below
+			int r = ((w < h) ? w : h) / 4;
+			color_t fill = (widget->pressed) ? widget->fg : widget->bg;
+			color_t text = (widget->pressed) ? widget->bg : widget->fg;
+			TFT_fillRoundRect(0, 0, w, h, r, fill);
+			if (widget->border) TFT_drawRoundRect(0, 0, w, h, r, widget->border_color);
+			_widgetText(widget, widget->text, text, fill);
+			break;
+		}
+
+		case TFT_WIDGET_IMAGE: {
+			color_t *pixels = widget->pixels;
+			if ((pixels == NULL) && (widget->file)) {
+				// the jpeg file is decoded once, not for each band
+				if (widget->decoded == NULL) widget->decoded = _widgetDecodeImage(widget);
+				pixels = widget->decoded;
+				if (pixels == NULL) {
+					TFT_fillRect(0, 0, w, h, widget->bg);
+					TFT_jpg_image(CENTER, CENTER, widget->scale, widget->file, NULL, 0);
+					break;
+				}
+			}
+			if (pixels) {
+				// only the image lines inside the clip rectangle are copied
+				int y1 = (clip[1] > dispWin.y1) ? clip[1] : dispWin.y1;
+				int y2 = (clip[3] < dispWin.y2) ? clip[3] : dispWin.y2;
+				color_t *line = pixels + ((y1 - widget->area[1]) * w) + (dispWin.x1 - widget->area[0]);
+				for (int y=y1; y <= y2; y++, line += w) {
+					send_data(dispWin.x1, y, dispWin.x2, y, dispWin.x2 - dispWin.x1 + 1, line);
+				}
+			}
+			break;
+		}
+
+		case TFT_WIDGET_GAUGE: {
+			// the arc runs clockwise from the lower left, 270 degrees
+			int r = (((w < h) ? w : h) / 2) - 1;
+			if (r < 2) break;
+			int th = (r / 5 < 2) ? 2 : r / 5;
+			float start = 225 * _arcAngleMax / 360;
+			float sweep = 270 * _arcAngleMax / 360;
+			float f = _widgetFraction(widget);
+			TFT_fillRect(0, 0, w, h, widget->bg);
+			TFT_drawArc(w / 2, h / 2, r, th, start, start + sweep, widget->border_color, widget->border_color);
+			if (f > 0) TFT_drawArc(w / 2, h / 2, r, th, start, start + (sweep * f), widget->fg, widget->fg);
+			snprintf(buf, sizeof(buf), "%.*f%s", widget->decimals, widget->value, (widget->text) ? widget->text : "");
+			_widgetText(widget, buf, widget->fg, widget->bg);
+			break;
+		}
+	}
 }
 
-//=======================
-void TFT_restoreClipWin()
+// Draw the widget and its children intersecting the 'clip' rectangle, in z-order
+//------------------------------------------------------------------------------------
+static void _renderWidget(tft_widget_t *widget, const int *clip, const tft_ctx_t *ctx)
 {
-	dispWin.x1 = dispWinTemp.x1;
-	dispWin.y1 = dispWinTemp.y1;
-	dispWin.x2 = dispWinTemp.x2;
-	dispWin.y2 = dispWinTemp.y2;
+	if (!widget->drawn) return;		// hidden, with all its children
+
+	int *a = widget->area;
+	if ((a[0] <= clip[2]) && (a[2] >= clip[0]) && (a[1] <= clip[3]) && (a[3] >= clip[1])) {
+		// the widget is drawn relative to its area, clipped to the screen
+		int x1 = (a[0] < 0) ? 0 : a[0];
+		int y1 = (a[1] < 0) ? 0 : a[1];
+		int x2 = (a[2] >= _width) ? _width-1 : a[2];
+		int y2 = (a[3] >= _height) ? _height-1 : a[3];
+		if ((x1 <= x2) && (y1 <= y2)) {
+			dispWin.x1 = x1;
+			dispWin.y1 = y1;
+			dispWin.x2 = x2;
+			dispWin.y2 = y2;
+			_drawWidget(widget, clip, ctx);
+		}
+	}
+
+	for (tft_widget_t *child = widget->child; child; child = child->next) {
+		_renderWidget(child, clip, ctx);
+	}
 }
 
+//================================
+int TFT_render(tft_widget_t *root)
+{
+	int err = 0;
+	int areas[WIDGET_MAX_AREAS][4];
+	int n = 0;
+
+	if (root == NULL) return 0;
+	_widgetUpdateArea(root, 0, 0, 1, areas, &n);
+	if (n == 0) return 0;
+
+	// widgets are drawn with their own settings, the drawing state is restored at the end
+	tft_ctx_t saved_ctx = { 0 };
+	_contextLoad(&saved_ctx, TFT_CTX);
+	tft_fb_t *target = tft_fb;
+	font_rotate = 0;
+	text_wrap = 0;
+	font_transparent = 0;
+	_angleOffset = DEFAULT_ANGLE_OFFSET;
+
+	for (int i=0; i<n; i++) {
+		int *a = areas[i];
+		int width = a[2] - a[0] + 1;
+		int height = a[3] - a[1] + 1;
+
+		// The area is composed in horizontal bands, smaller bands are tried if low on memory
+		int band_height = WIDGET_BUF_SIZE / (width * sizeof(color_t));
+		if (band_height < 1) band_height = 1;
+		if (band_height > height) band_height = height;
+		tft_fb_t *band = _fb_alloc(width, band_height, 1);
+		while ((band == NULL) && (band_height > 1)) {
+			band_height /= 2;
+			band = _fb_alloc(width, band_height, 1);
+		}
+		if (band == NULL) {
+			err = -1;
+			break;
+		}
+		band->x = a[0];
+		band->org_x = a[0];
+
+		for (int y=a[1]; y <= a[3]; y += band_height) {
+			int clip[4] = {a[0], y, a[2], ((y + band_height - 1) > a[3]) ? a[3] : (y + band_height - 1)};
+			band->y = y;
+			band->org_y = y;
+			band->height = clip[3] - y + 1;
+			for (int k=0; k<(band->width * band->height); k++) {
+				band->buf[k] = root->bg;
+			}
+
+			tft_fb = band;
+			_renderWidget(root, clip, &saved_ctx);
+			tft_fb = target;
+
+			if (tft_fb) send_data(band->x, band->y, band->x + band->width - 1, band->y + band->height - 1, band->width * band->height, band->buf);
+			else fb_send(band, band->x, band->y, 1);
+		}
+		_fb_free(band);
+	}
+
+	_contextLoad(TFT_CTX, &saved_ctx);
+	// not all areas are redrawn, the whole tree is redrawn next time
+	if (err) root->dirty = 1;
+	return (err) ? err : n;
+}
 
 // ================ JPG SUPPORT ================================================
 // User defined device identifier
@@ -2357,12 +5999,13 @@ static UINT tjd_output (
 				else src += 3; // skip
 			}
 		}
-		wait_trans_finish(1);
+		// drawing to frame buffer does not wait for the display transfer
+		if (tft_fb == NULL) wait_trans_finish(1);
 		send_data(dleft, dtop, dright, dbottom, len, dev->linbuf[dev->linbuf_idx]);
 		dev->linbuf_idx = ((dev->linbuf_idx + 1) & 1);
 	}
 	else {
-		wait_trans_finish(1);
+		if (tft_fb == NULL) wait_trans_finish(1);
 		printf("Data size error: %d jpg: (%d,%d,%d,%d) disp: (%d,%d,%d,%d)\r\n", len, left,top,right,bottom, dleft,dtop,dright,dbottom);
 		return 0;  // stop decompression
 	}
@@ -2655,7 +6298,8 @@ int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int
 	if (image_debug) printf("BMP: image size: (%d,%d) scale: %d disp size: (%d,%d) img xofs: %d img yofs: %d at: %d,%d; line buf: 2* %d scale buf: %d\r\n",
 			img_xsize, img_ysize, scale_pix, img_xlen, img_ylen, img_xstart, img_ystart, disp_xstart, disp_ystart, img_xsize*3, ((scale) ? (rd_len*scale_pix) : 0));
 
-	// * Select the display
+	// * Select the display, frame buffer target does not wait for the display transfers
+	uint8_t to_display = (tft_fb == NULL);
 	disp_select();
 
 	while ((disp_yend >= disp_ystart) && ((img_pos + (img_xsize*3)) <= size)) {
@@ -2729,7 +6373,7 @@ int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int
 			}
 		}
 
-		wait_trans_finish(1);
+		if (to_display) wait_trans_finish(1);
 		send_data(disp_xstart, disp_yend, disp_xend, disp_yend, img_xlen, (color_t *)line_buf[lb_idx]);
 		lb_idx = (lb_idx + 1) & 1;  // change buffer
 
@@ -2848,6 +6492,8 @@ int TFT_read_touch(int *x, int* y, uint8_t raw)
     #if USE_TOUCH == TOUCH_TYPE_NONE
 	return 0;
     #else
+	// finish the canvas transfer which may still be running, the touch controller uses the same spi bus
+	fb_send_wait();
 	int result = -1;
     int X=0, Y=0;
 
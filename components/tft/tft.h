@@ -23,33 +23,207 @@ typedef struct {
 	uint8_t 	y_size;
 	uint8_t	    offset;
 	uint16_t	numchars;
-    uint16_t	size;
+    uint32_t	size;
 	uint8_t 	max_x_size;
     uint8_t     bitmap;
 	color_t     color;
+	struct fontIndex_s *index;	// cached glyph data offsets of the proportional font, NULL if not available
+	uint8_t		bpp;		// proportional font bits per glyph pixel; 1, or 2 & 4 for anti-aliased fonts
+	uint8_t		rle;		// proportional font glyph pixels are run-length coded
+	uint8_t		paged;		// glyph data of the proportional file font is read from the file on demand
+	uint8_t		unicode;	// proportional font with the sorted code point table
 } Font;
 
+typedef struct {
+      uint32_t charCode;
+      int adjYOffset;
+      int width;
+      int height;
+      int xOffset;
+      int xDelta;
+      uint32_t dataPtr;
+} propFont;
+
+// Character cell of the text printed by TFT_printUpdate()
+typedef struct {
+	uint32_t	code;		// character code
+	int			x;			// display x of the character cell
+	uint16_t	width;		// cell width, including the gap to the next character
+	uint16_t	pos;		// offset of the character in the string
+	uint8_t		overhang;	// glyph pixels are drawn outside the cell
+} tft_text_cell_t;
+
+// Text which is reprinted in place by TFT_printUpdate()
+typedef struct {
+	int				x;			// text position, as in TFT_print()
+	int				y;
+	int				disp_x;		// display position of the printed text, -1 if nothing is printed
+	int				disp_y;
+	int				width;		// printed text width and height
+	int				height;
+	int				ncells;		// number of character cells, -1 if the text can only be reprinted whole
+	int				max_cells;
+	tft_text_cell_t	*cells;		// character cells of the printed text
+	tft_text_cell_t	*work;		// character cells of the new text
+	uint8_t			*font;		// drawing state of the printed text
+	uint8_t			x_size;
+	uint8_t			y_size;
+	uint8_t			force_fixed;
+	color_t			fg;
+	color_t			bg;
+	dispWin_t		win;
+} tft_text_t;
+
+// Text console, scrolled by one text line when the new line is started at the bottom
+typedef struct {
+	int			top;			// display row of the console area
+	int			lines;			// number of text lines
+	int			line_height;	// font height and line spacing
+	int			first;			// line buffer index of the top console line
+	int			row;			// current console line, 0 at top
+	int			x;				// x position of the next character in the current line
+	uint8_t		newline;		// new line is started before the next printed character
+	uint8_t		clear;			// rest of the current line is not cleared yet
+	uint8_t		hw_scroll;		// lines are scrolled by display, else redrawn
+	char		**text;			// text of each line, used for redrawing
+} tft_console_t;
+
+// Strip chart, each sample is drawn as one column
+typedef struct {
+	int			x;				// chart area on display
+	int			y;
+	int			width;
+	int			height;
+	float		min;			// value at the chart bottom
+	float		max;			// value at the chart top
+	color_t		color;			// trace color
+	color_t		bg;				// background color
+	color_t		grid_color;		// horizontal grid lines color
+	int			grid;			// distance between horizontal grid lines in pixels, 0 for no grid
+	float		*samples;		// samples of chart columns
+	int			head;			// chart column of the next sample
+	int			count;			// number of samples in chart, up to width
+	uint8_t		hw_scroll;		// chart columns are scrolled by display, else the new sample overwrites the oldest
+	color_t		*buf;			// buffer in which the new columns are composed
+	int			buf_cols;
+} tft_chart_t;
+
+// Widget types
+#define TFT_WIDGET_PANEL	0	// filled rectangle with optional border, container for other widgets
+#define TFT_WIDGET_LABEL	1	// text
+#define TFT_WIDGET_VALUE	2	// number with 'decimals' decimal places followed by the 'text'
+#define TFT_WIDGET_BAR		3	// horizontal or vertical (if higher than wide) bar showing the value
+#define TFT_WIDGET_BUTTON	4	// rounded rectangle with text, colors are swapped when pressed
+#define TFT_WIDGET_IMAGE	5	// color_t array or jpeg file
+#define TFT_WIDGET_GAUGE	6	// 270 degrees arc showing the value, with the value in the center
+
+#define TFT_WIDGET_CURRENT_FONT	0xFF	// widget font: the font selected when rendering
+
+// Widget, drawn over its parent and the previous sibling widgets
+typedef struct tft_widget_s {
+	uint8_t		type;
+	int			x;				// position relative to the parent widget, display position of the root widget
+	int			y;
+	int			width;
+	int			height;
+	color_t		fg;				// text, value bar and value arc color
+	color_t		bg;				// background color
+	color_t		border_color;	// border, bar frame and gauge track color
+	uint8_t		border;			// border width, 0 for no border
+	uint8_t		font;			// font used for text, TFT_WIDGET_CURRENT_FONT for the font selected when rendering
+	int			align;			// text x position inside the border, CENTER or RIGHT
+	uint8_t		visible;
+	uint8_t		pressed;
+	char		*text;			// widget text, units of the VALUE widget
+	float		value;
+	float		min;			// values at the bar and gauge start and end
+	float		max;
+	uint8_t		decimals;
+	color_t		*pixels;		// IMAGE pixels, 'width' x 'height', or NULL
+	char		*file;			// IMAGE jpeg file name, drawn centered if 'pixels' is NULL
+	uint8_t		scale;			// jpeg image scale factor, 0~3
+	color_t		*decoded;		// jpeg image decoded to 'width' x 'height' pixels by TFT_render(), NULL if not decoded
+	struct tft_widget_s *parent;
+	struct tft_widget_s *child;	// first child widget
+	struct tft_widget_s *next;	// next sibling widget
+	uint8_t		dirty;			// widget has to be redrawn
+	uint8_t		drawn;			// widget is drawn at 'area'
+	int			area[4];		// display area x1, y1, x2, y2 at which the widget was drawn
+} tft_widget_t;
+
+// Drawing context, holds all drawing state
+// Tasks normally use the same (default) context; a task can select its own context
+// with TFT_context_select(), band rendering tasks use their own copies
+typedef struct {
+	tft_fb_t	*fb;			// frame buffer target of the task using the context, must be the first member
+	uint8_t		fb_canvas;		// frame buffer target is the user's canvas
+	dispWin_t	win_fb;			// clip window saved while drawing to frame buffer
+	uint16_t	rotate;
+	uint8_t		transparent;
+	uint8_t		force_fixed;
+	uint8_t		buffered_char;
+	uint8_t		transparent_rb;
+	uint8_t		line_space;
+	uint8_t		wrap;
+	uint8_t		utf8;
+	color_t		fg;
+	color_t		bg;
+	dispWin_t	win;
+	dispWin_t	win_temp;
+	float		angle_offset;
+	Font		font;
+	int			x;
+	int			y;
+	int			offset;
+	propFont	prop_char;
+	color_t		aa_lut[16];		// colors of the anti-aliased glyph pixel levels
+	color_t		aa_fg;			// colors and bits per pixel the 'aa_lut' is calculated for
+	color_t		aa_bg;
+	uint8_t		aa_bpp;			// 0 if 'aa_lut' is not calculated
+	uint8_t		*glyph_data;	// glyph data of the paged file font character being drawn
+	uint16_t	glyph_data_size;
+	struct userFont_s *user_font;	// font loaded from file by TFT_setFont(), NULL if not loaded
+} tft_ctx_t;
+
+// Drawing context of each core, used by the tasks without their own context
+extern tft_ctx_t *tft_ctx[portNUM_PROCESSORS];
+
+//---------------------------------
+static inline tft_ctx_t *_tft_ctx()
+{
+	#if TFT_TASK_CONTEXTS
+	tft_ctx_t *ctx = (tft_ctx_t *)pvTaskGetThreadLocalStoragePointer(NULL, TFT_TLS_INDEX);
+	if (ctx) return ctx;
+	#endif
+	return tft_ctx[xPortGetCoreID()];
+}
+#define TFT_CTX	(_tft_ctx())
+
 
 //==========================================================================================
 // ==== Global variables ===================================================================
 //==========================================================================================
 extern uint8_t   orientation;		// current screen orientation
-extern uint16_t  font_rotate;   	// current font font_rotate angle (0~395)
-extern uint8_t   font_transparent;	// if not 0 draw fonts transparent
-extern uint8_t   font_forceFixed;   // if not zero force drawing proportional fonts with fixed width
-extern uint8_t   font_buffered_char;
-extern uint8_t   font_line_space;	// additional spacing between text lines; added to font height
-extern uint8_t   text_wrap;         // if not 0 wrap long text to the new line, else clip
-extern color_t   _fg;            	// current foreground color for fonts
-extern color_t   _bg;            	// current background for non transparent fonts
-extern dispWin_t dispWin;			// display clip window
-extern float	  _angleOffset;		// angle offset for arc, polygon and line by angle functions
 extern uint8_t	  image_debug;		// print debug messages during image decode if set to 1
 
-extern Font cfont;					// Current font structure
-
-extern int	TFT_X;					// X position of the next character after TFT_print() function
-extern int	TFT_Y;					// Y position of the next character after TFT_print() function
+// Drawing state variables, members of the current drawing context
+#define font_rotate			(TFT_CTX->rotate)			// current font font_rotate angle (0~395)
+#define font_transparent	(TFT_CTX->transparent)		// if not 0 draw fonts transparent
+#define font_forceFixed		(TFT_CTX->force_fixed)		// if not zero force drawing proportional fonts with fixed width
+#define font_buffered_char	(TFT_CTX->buffered_char)	// if not 0 compose the text line in buffer and send it at once
+#define font_transparent_readback (TFT_CTX->transparent_rb)	// if not 0 compose transparent text line over the background read from display
+#define font_line_space		(TFT_CTX->line_space)		// additional spacing between text lines; added to font height
+#define text_wrap			(TFT_CTX->wrap)				// if not 0 wrap long text to the new line, else clip
+#define text_utf8			(TFT_CTX->utf8)				// if not 0 strings are UTF-8 encoded, else each byte is a character
+#define _fg					(TFT_CTX->fg)				// current foreground color for fonts
+#define _bg					(TFT_CTX->bg)				// current background for non transparent fonts
+#define dispWin				(TFT_CTX->win)				// display clip window
+#define _angleOffset		(TFT_CTX->angle_offset)		// angle offset for arc, polygon and line by angle functions
+
+#define cfont				(TFT_CTX->font)				// Current font structure
+
+#define TFT_X				(TFT_CTX->x)				// X position of the next character after TFT_print() function
+#define TFT_Y				(TFT_CTX->y)				// Y position of the next character after TFT_print() function
 
 extern uint32_t tp_calx;			// touch screen X calibration constant
 extern uint32_t tp_caly;			// touch screen Y calibration constant
@@ -61,6 +235,24 @@ extern uint32_t tp_caly;			// touch screen Y calibration constant
 // The size must be multiple of 256 bytes !!
 #define JPG_IMAGE_LINE_BUF_SIZE 512
 
+// Maximal size in bytes of the buffer in which the text line is composed
+// before sending it to display (if font_buffered_char is set)
+#define TEXT_LINE_BUF_SIZE 16384
+
+// Default size in bytes of the cache of rendered characters used for buffered text
+// Can be changed at run time using TFT_setGlyphCacheSize(), 0 disables the cache
+#define GLYPH_CACHE_SIZE 8192
+
+// Default size in bytes of the cache of glyph data read from the proportional font file
+// Can be changed at run time using TFT_setFontPageCacheSize()
+#define FONT_PAGE_CACHE_SIZE 4096
+
+// Maximal size in bytes of the buffer in which new strip chart columns are composed
+#define CHART_BUF_SIZE 4096
+
+// Maximal size in bytes of the buffer in which the widget area is composed by TFT_render()
+#define WIDGET_BUF_SIZE 16384
+
 // --- Constants for ellipse function ---
 #define TFT_ELLIPSE_UPPER_RIGHT 0x01
 #define TFT_ELLIPSE_UPPER_LEFT  0x02
@@ -126,6 +318,10 @@ extern const color_t TFT_PINK;
 #define FONT_7SEG		9
 #define USER_FONT		10  // font will be read from file
 
+// compile_font_file() flags
+#define COMPILE_FONT_DEBUG	0x01	// print debug information
+#define COMPILE_FONT_RLE	0x02	// run-length code the glyphs of 1-bit proportional font if it becomes smaller
+
 
 
 // ===== PUBLIC FUNCTIONS =========================================================================
@@ -426,10 +622,23 @@ void TFT_drawPolygon(int cx, int cy, int sides, int diameter, color_t color, col
  * For 7 segment font only characters 0,1,2,3,4,5,6,7,8,9, . , - , : , / are available.
  *   Character ‘/‘ draws the degree sign.
  * ------------------------------------------------------------------------------------
+ * Anti-aliased proportional fonts have 2 or 4 bits per glyph pixel,
+ *   set in the 3rd font header byte (0 in 1-bit fonts).
+ * ------------------------------------------------------------------------------------
+ * Unicode proportional fonts have 0x40 added to the 3rd font header byte;
+ *   the header is followed by the number of glyphs (2 bytes) and the table of
+ *   code points (3 bytes) and glyph record offsets (3 bytes) sorted by code point.
+ *   Characters are found by binary search; set 'text_utf8' to print UTF-8 strings.
+ * ------------------------------------------------------------------------------------
  *
  * Params:
  *			 font: font number; use defined font names
  *		font_file: pointer to font file name; NULL for embeded fonts
+ *				   NULL with USER_FONT selects the font file already loaded, DEFAULT_FONT if none
+ *
+ * The font file is loaded to the drawing context of the calling task and replaces the font file
+ * the context loaded before. Contexts created from it share the loaded font; it is freed when
+ * the last of them loads another font file or is deleted.
  */
 //----------------------------------------------------
 void TFT_setFont(uint8_t font, const char *font_file);
@@ -457,10 +666,14 @@ int TFT_getfontheight();
  *
  * Rotation of the displayed text depends on 'font_rotate' variable (0~360)
  * if 'font_transparent' variable is set to 1, no background pixels will be printed
+ *   if also 'font_transparent_readback' is set, the background is read from display
+ *   and the text line is composed over it and sent at once (display must support reading)
  *
  * If the text does not fit the screen width it will be clipped (if text_wrap=0),
  * or continued on next line (if text_wrap=1)
  *
+ * If 'text_utf8' is set, the string is decoded as UTF-8; invalid bytes are printed as 8-bit characters
+ *
  * Two special characters are allowed in strings:
  * 		‘\r’ CR (0x0D), clears the display to EOL
  * 		‘\n’ LF (ox0A), continues to the new line, x=0
@@ -482,6 +695,215 @@ int TFT_getfontheight();
 //-------------------------------------
 void TFT_print(char *st, int x, int y);
 
+/*
+ * Create the text which is reprinted in place with TFT_printUpdate()
+ *
+ * Params:
+ *		x, y:	text position as in TFT_print(); LASTX and LASTY cannot be used
+ *
+ * Returns:
+ * 		pointer to the text, NULL if it cannot be allocated
+ */
+//----------------------------------------
+tft_text_t *TFT_text_create(int x, int y);
+
+/*
+ * Print the new string in place of the text previously printed with the same handle
+ *
+ * Only the characters whose code, position or width differ from the printed ones are drawn,
+ * display area of the printed text not covered by the new string is cleared to background color.
+ * Whole text is reprinted if the font, colors or clip window are changed, if the string does not fit
+ * into a single line, or if the text is rotated or transparent (transparent text is not cleared).
+ *
+ * Params:
+ *		text:	text created with TFT_text_create()
+ *		  st:	pointer to null terminated string to be printed
+ *
+ * Returns:
+ * 		number of drawn characters
+ */
+//----------------------------------------------
+int TFT_printUpdate(tft_text_t *text, char *st);
+
+/*
+ * Forget the printed text, the next TFT_printUpdate() prints the whole string without clearing
+ * Use it when the text area was cleared or overwritten
+ */
+//-----------------------------------------
+void TFT_text_invalidate(tft_text_t *text);
+
+/*
+ * Free the text created with TFT_text_create()
+ */
+//-------------------------------------
+void TFT_text_delete(tft_text_t *text);
+
+/*
+ * Create the text console in display rows top ~ top+height-1, using the full display width
+ *
+ * The console is scrolled up by one text line when a new line is started below its last line.
+ * If the display supports vertical scrolling in the current orientation (see disp_set_scroll_area())
+ * and the frame buffer is not used, only the new line is drawn and the display scroll start is moved;
+ * otherwise all console lines are redrawn. Only one console can use the display scrolling.
+ * Number of lines is set by the current font height and 'font_line_space'; the current font must not be
+ * changed while printing to the console. Orientation change removes the display scrolling area.
+ *
+ * Params:
+ *		top:	first display row of the console
+ *	 height:	console height in pixels
+ *
+ * Returns:
+ * 		pointer to the console, NULL if the console cannot be created
+ */
+//-----------------------------------------------------
+tft_console_t *TFT_console_create(int top, int height);
+
+/*
+ * Print the string to the console
+ *
+ * ‘\n’ LF starts the new line, it is started when the next character is printed.
+ * Text not fitting into the console width is clipped, text is not rotated.
+ *
+ * Params:
+ *		con:	console created with TFT_console_create()
+ *		 st:	pointer to null terminated string to be printed
+ */
+//---------------------------------------------------
+void TFT_console_print(tft_console_t *con, char *st);
+
+/*
+ * Clear the console and print from its first line
+ */
+//-----------------------------------------
+void TFT_console_clear(tft_console_t *con);
+
+/*
+ * Free the console created with TFT_console_create()
+ * Display scrolling is removed, the console area should be cleared or redrawn
+ */
+//------------------------------------------
+void TFT_console_delete(tft_console_t *con);
+
+/*
+ * Create the strip chart
+ *
+ * Each new sample is drawn as the chart column with the trace segment from the previous sample;
+ * only the new columns are sent to display. Without scrolling the new sample overwrites the oldest one
+ * and the column after it is cleared (sweep). If 'scroll' is set and the display can scroll screen columns
+ * (see disp_set_scroll_area(), landscape orientations where screen columns are display memory rows) the chart is scrolled by display,
+ * the newest sample is always at the right; the chart columns are scrolled over the full screen height.
+ * Trace and background colors are set from '_fg' and '_bg', chart fields 'color', 'bg', 'grid'
+ * and 'grid_color' can be changed and the chart redrawn with TFT_chart_redraw().
+ *
+ * Params:
+ *		x, y:	upper left corner of the chart, relative to the clip window
+ *	width, height:	chart size in pixels, the chart must fit into the clip window
+ *	min, max:	values at the chart bottom and top
+ *	  scroll:	scroll the chart by display if possible
+ *
+ * Returns:
+ * 		pointer to the chart, NULL if the chart cannot be created
+ */
+//-------------------------------------------------------------------------------------------------------
+tft_chart_t *TFT_chart_create(int x, int y, int width, int height, float min, float max, uint8_t scroll);
+
+/*
+ * Add 'n' samples to the chart
+ * Adding more samples at once is faster, the new columns are sent to display together
+ */
+//-----------------------------------------------------------------
+void TFT_chart_add(tft_chart_t *chart, const float *values, int n);
+
+/*
+ * Redraw all chart columns
+ */
+//----------------------------------------
+void TFT_chart_redraw(tft_chart_t *chart);
+
+/*
+ * Remove all samples and clear the chart
+ */
+//---------------------------------------
+void TFT_chart_clear(tft_chart_t *chart);
+
+/*
+ * Free the chart created with TFT_chart_create()
+ * Display scrolling is removed, the chart area should be cleared or redrawn
+ */
+//----------------------------------------
+void TFT_chart_delete(tft_chart_t *chart);
+
+/*
+ * Create the widget
+ *
+ * Widgets form a tree; each widget is drawn over its parent and the widgets created before it
+ * with the same parent. Colors are set from '_fg' and '_bg', the font is TFT_WIDGET_CURRENT_FONT (the font selected
+ * when rendering); USER_FONT uses the font file loaded with TFT_setFont() by the rendering task's context.
+ * Widget fields can be changed directly, the widget must then be marked with TFT_widget_invalidate().
+ * The new widget is drawn by the next TFT_render().
+ *
+ * Params:
+ *		parent:	parent widget, NULL for the root widget
+ *		  type:	widget type, TFT_WIDGET_xxx
+ *		  x, y:	upper left corner relative to the parent widget, display position for the root widget
+ *	width, height:	widget size in pixels
+ *
+ * Returns:
+ * 		pointer to the widget, NULL if the widget cannot be created
+ */
+//-------------------------------------------------------------------------------------------------------
+tft_widget_t *TFT_widget_create(tft_widget_t *parent, uint8_t type, int x, int y, int width, int height);
+
+/*
+ * Free the widget and all its child widgets
+ * The area of the widget is redrawn by the next TFT_render() of its parent tree
+ */
+//-------------------------------------------
+void TFT_widget_delete(tft_widget_t *widget);
+
+/*
+ * Mark the widget to be redrawn by the next TFT_render()
+ */
+//-----------------------------------------------
+void TFT_widget_invalidate(tft_widget_t *widget);
+
+/*
+ * Set the widget text (copied), value, colors, visibility, position or pressed state
+ * The widget is marked to be redrawn only if the new setting differs from the current one
+ */
+//--------------------------------------------------------------
+void TFT_widget_setText(tft_widget_t *widget, const char *text);
+//----------------------------------------------------------
+void TFT_widget_setValue(tft_widget_t *widget, float value);
+//----------------------------------------------------------------------
+void TFT_widget_setColors(tft_widget_t *widget, color_t fg, color_t bg);
+//----------------------------------------------------------------
+void TFT_widget_setVisible(tft_widget_t *widget, uint8_t visible);
+//-------------------------------------------------------
+void TFT_widget_move(tft_widget_t *widget, int x, int y);
+//----------------------------------------------------------------
+void TFT_widget_setPressed(tft_widget_t *widget, uint8_t pressed);
+
+/*
+ * Redraw the changed widgets of the widget tree
+ *
+ * Display areas of the changed, moved, shown or hidden widgets are collected and merged
+ * into up to 8 rectangles. Each rectangle is composed in the buffer of up to WIDGET_BUF_SIZE bytes,
+ * in horizontal bands if needed, redrawing all widgets intersecting it in z-order, and sent to display
+ * (or to the frame buffer if drawing to it). Unchanged screen areas are not redrawn.
+ * The drawing state (clip window, colors, font) is restored after rendering.
+ * Widgets should be placed inside the screen. The jpeg image is decoded once and kept with the widget
+ * until the widget is invalidated; if there is no memory for it, it is decoded for each band it is drawn in.
+ *
+ * Params:
+ *		root:	root widget of the tree
+ *
+ * Returns:
+ * 		number of redrawn rectangles, -1 if no memory for the composing buffer
+ */
+//---------------------------------
+int TFT_render(tft_widget_t *root);
+
 /*
  * Set atributes for 7 segment vector font
  * == 7 segment font must be the current font to this function to have effect ==
@@ -530,6 +952,265 @@ void TFT_saveClipWin();
 //------------------------
 void TFT_restoreClipWin();
 
+/*
+ * Start drawing to the low resolution frame buffer covering the current clip window
+ * Frame buffer is cleared with current background color.
+ * All drawing functions then draw to the frame buffer, the clip window is set to
+ * the whole frame buffer area and all coordinates are frame buffer coordinates.
+ * TFT_setclipwin() can be used to clip drawing inside the frame buffer.
+ * When the frame buffer is sent to display, each its pixel is replicated to
+ * scale x scale block of display pixels, filling the original clip window.
+ * Frame buffers larger than TFT_FB_INTERNAL_MAX bytes are allocated in PSRAM if available.
+ *
+ * Params:
+ * 		scale:	1~3; frame buffer resolution is 1/scale of the clip window resolution
+ *
+ * Returns:
+ * 		0 on success
+ * 		-1 if frame buffer is already active
+ * 		-2 if clip window is too small
+ * 		-3 on memory allocation error
+ *
+ */
+//==============================
+int TFT_fb_begin(uint8_t scale);
+
+/*
+ * Send the frame buffer to display
+ *
+ */
+//===================
+void TFT_fb_flush();
+
+/*
+ * Stop drawing to the frame buffer, free it and restore the clip window
+ *
+ * Params:
+ * 		flush:	if not 0, send the frame buffer to display before freeing it
+ *
+ */
+//=============================
+void TFT_fb_end(uint8_t flush);
+
+/*
+ * Create the offscreen canvas
+ * Canvas is cleared with current background color.
+ * Canvas can be selected as drawing target with TFT_canvas_select() and
+ * sent to any display position with TFT_canvas_blit().
+ *
+ * Params:
+ * 		width:	canvas width in pixels
+ * 		height:	canvas height in pixels
+ *
+ * Returns:
+ * 		pointer to the canvas or NULL on memory allocation error
+ *
+ */
+//================================================
+tft_fb_t *TFT_canvas_create(int width, int height);
+
+/*
+ * Select the drawing target
+ * All drawing functions then draw to the canvas, the clip window is set to
+ * the whole canvas area and all coordinates are canvas coordinates.
+ * Selecting NULL returns drawing to the display and restores the clip window.
+ *
+ * Params:
+ * 		canvas:	canvas created with TFT_canvas_create() or NULL for display
+ *
+ * Returns:
+ * 		0 on success
+ * 		-1 if frame buffer started with TFT_fb_begin() is active
+ *
+ */
+//=====================================
+int TFT_canvas_select(tft_fb_t *canvas);
+
+/*
+ * Send the canvas to display, upper left canvas pixel at position (x,y)
+ * Only the part which fits on the screen is sent.
+ * The function does not wait for the end of the transfer, the next canvas state
+ * can be drawn while the previous one is still being sent.
+ * The sent canvas must not be changed or deleted before TFT_canvas_wait()
+ * or any other display access.
+ * The display stays selected by the calling task until then, other tasks
+ * drawing to display wait for it.
+ *
+ * Params:
+ * 		canvas:	canvas to send
+ * 		x:		display x position
+ * 		y:		display y position
+ *
+ */
+//==================================================
+void TFT_canvas_blit(tft_fb_t *canvas, int x, int y);
+
+/*
+ * Send the canvas to display rotated clockwise by 90, 180 or 270 degrees
+ * The display controller's scan direction is temporary changed, so the canvas
+ * is sent in its natural order at the same speed as unrotated one.
+ * The function waits for the end of the transfer.
+ *
+ * Params:
+ * 		canvas:	canvas to send
+ * 		x:		display x position of the upper left corner of the rotated canvas
+ * 		y:		display y position of the upper left corner of the rotated canvas
+ * 		rot:	number of clockwise quarter turns, 0~3
+ *
+ * Returns:
+ * 		0 on success
+ * 		-1 if the rotated canvas does not fit on the screen
+ * 		-2 on memory allocation error
+ * 		-3 if the display cannot be selected
+ */
+//==================================================================
+int TFT_canvas_blitRotated(tft_fb_t *canvas, int x, int y, uint8_t rot);
+
+/*
+ * Wait until the canvas transfer to display is finished
+ * and release the display to other tasks
+ *
+ */
+//=====================
+void TFT_canvas_wait();
+
+/*
+ * Free the canvas memory
+ * If the canvas is selected, drawing returns to the display.
+ *
+ */
+//=======================================
+void TFT_canvas_delete(tft_fb_t *canvas);
+
+/*
+ * Render the current clip window in horizontal bands on both cores
+ * Worker task pinned to each core calls the render function for every 2nd band,
+ * drawing to its own band buffer; rendered bands are sent to display in order
+ * by the calling task while the workers render the next bands.
+ * Render function draws the whole window content as usual, drawing outside
+ * the band is clipped. Each call starts with the drawing state of the calling task,
+ * changes of the drawing state made in the render function are not preserved.
+ * Render function must not load fonts from file or use other tasks' drawing.
+ *
+ * Params:
+ * 		nbands:	number of bands the window is split to; more bands use less memory,
+ * 				but the render function is called more times
+ * 		render:	render function
+ * 		arg:	argument passed to the render function
+ *
+ * Returns:
+ * 		0 on success
+ * 		-1 if frame buffer or canvas is active
+ * 		-2 if CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS is not greater than TFT_TLS_INDEX,
+ * 		   the workers need their own drawing contexts; nothing is rendered
+ * 		-3 on memory allocation error
+ * 		-4 if the worker task cannot be created; not all bands are rendered
+ *
+ */
+//=========================================================================
+int TFT_render_bands(uint8_t nbands, void (*render)(void *arg), void *arg);
+
+/*
+ * Create the drawing context with the calling task's current drawing state
+ * Selected with TFT_context_select(), the context holds the task's colors, fonts, clip window,
+ * text position and frame buffer or canvas target, so tasks can draw concurrently on both cores;
+ * the display itself is used by one task at a time (see disp_select()).
+ * Drawing with the new context goes to display.
+ * The new context shares the font file loaded by the calling task's context.
+ *
+ * Returns:
+ * 		pointer to the new context, NULL if no memory
+ */
+//------------------------------
+tft_ctx_t *TFT_context_create();
+
+/*
+ * Select the drawing context of the calling task
+ * All drawing functions called by the task use the selected context.
+ * Each context draws with its own font loaded from file, see TFT_setFont().
+ *
+ * Params:
+ * 		ctx:	context created with TFT_context_create(),
+ * 				NULL to use the default context shared by the tasks without their own context
+ *
+ * Returns:
+ * 		0 on success
+ * 		-1 if CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS is not greater than TFT_TLS_INDEX
+ */
+//-------------------------------------
+int TFT_context_select(tft_ctx_t *ctx);
+
+/*
+ * Free the context created with TFT_context_create()
+ * The context must not be selected by any task
+ * The font file loaded by the context is freed if no other context uses it
+ */
+//--------------------------------------
+void TFT_context_delete(tft_ctx_t *ctx);
+
+/*
+ * Fill the rectangle with color blended over the existing screen content
+ * The rectangle area is read from display, blended and written back.
+ *
+ * Params:
+ * 		x:		rectangle x position
+ * 		y:		rectangle y position
+ * 		w:		rectangle width
+ * 		h:		rectangle height
+ * 		color:	fill color
+ * 		alpha:	0~255; 0 - transparent (nothing is drawn), 255 - opaque
+ *
+ * Returns:
+ * 		0 on success
+ * 		-1 on memory allocation error
+ * 		-2 on display read error
+ *
+ */
+//============================================================================================
+int TFT_fillRectAlpha(int16_t x, int16_t y, int16_t w, int16_t h, color_t color, uint8_t alpha);
+
+/*
+ * Draw the image from color buffer blended over the existing screen content
+ *
+ * Params:
+ * 		x:		image x position
+ * 		y:		image y position
+ * 		w:		image width
+ * 		h:		image height
+ * 		img:	image colors, 'w' * 'h' values
+ * 		amap:	per pixel alpha, 'w' * 'h' values; NULL if only global alpha is used
+ * 		alpha:	0~255; global alpha, multiplied with per pixel alpha
+ *
+ * Returns:
+ * 		0 on success
+ * 		-1 on memory allocation error
+ * 		-2 on display read error
+ *
+ */
+//=============================================================================================
+int TFT_drawImageAlpha(int x, int y, int w, int h, color_t *img, uint8_t *amap, uint8_t alpha);
+
+/*
+ * Print the string blended over the existing screen content
+ * Only the character pixels are blended, the background is left as it is.
+ * Text is printed in one line, rotated text is not supported.
+ *
+ * Params:
+ * 		st:		pointer to null terminated string to be printed
+ * 		x:		x position, the same values as for TFT_print can be used
+ * 		y:		y position, the same values as for TFT_print can be used
+ * 		alpha:	0~255; text color alpha
+ *
+ * Returns:
+ * 		0 on success
+ * 		-1 on memory allocation error
+ * 		-2 on display read error
+ * 		-3 if font rotation is set
+ *
+ */
+//=======================================================
+int TFT_printAlpha(char *st, int x, int y, uint8_t alpha);
+
 /*
  * Set the screen rotation
  * Also resets the clip window and clears the screen with current background color
@@ -583,6 +1264,52 @@ int TFT_getStringWidth(char* str);
  */
 void TFT_clearStringRect(int x, int y, char *str);
 
+/*
+ * Set the size of the rendered character cache
+ * When composing the buffered text line, characters already rendered with the same font
+ * and colors are copied from cache instead of being expanded from the font data again.
+ * Least recently used characters are removed when the cache size is exceeded.
+ *
+ * Params:
+ * 		size:	maximal cache size in bytes; 0 disables the cache and frees all cached characters
+ */
+//--------------------------------------
+void TFT_setGlyphCacheSize(uint32_t size);
+
+/*
+ * Get the rendered character cache statistics
+ *
+ * Params:
+ * 		  hits:	pointer to returned number of characters taken from cache; can be NULL
+ * 		misses:	pointer to returned number of characters not found in cache; can be NULL
+ * 		  used:	pointer to returned number of bytes used by the cache; can be NULL
+ */
+//------------------------------------------------------------------------
+void TFT_getGlyphCacheStats(uint32_t *hits, uint32_t *misses, uint32_t *used);
+
+/*
+ * Set the size of the proportional file font glyph data cache
+ * Only the character metrics of the proportional font file are kept in memory,
+ * glyph data is read from the file when the character is drawn and kept in this cache.
+ * Least recently used glyphs are removed when the cache size is exceeded.
+ *
+ * Params:
+ * 		size:	maximal cache size in bytes; 0 disables the cache, glyph data is read from file each time
+ */
+//----------------------------------------
+void TFT_setFontPageCacheSize(uint32_t size);
+
+/*
+ * Get the proportional file font glyph data cache statistics
+ *
+ * Params:
+ * 		fetches:	pointer to returned number of glyph data requests; can be NULL
+ * 		 misses:	pointer to returned number of glyphs read from file; can be NULL
+ * 		   used:	pointer to returned number of bytes used by the cache; can be NULL
+ */
+//----------------------------------------------------------------------------
+void TFT_getFontPageCacheStats(uint32_t *fetches, uint32_t *misses, uint32_t *used);
+
 /*
  * Converts the components of a color, as specified by the HSB model,
  * to an equivalent set of values for the default RGB model.
@@ -599,6 +1326,39 @@ void TFT_clearStringRect(int x, int y, char *str);
 //----------------------------------------------------------
 color_t HSBtoRGB(float _hue, float _sat, float _brightness);
 
+/*
+ * Integer version of HSBtoRGB(), without floating point operations
+ *
+ * Params:
+ * 		   hue:	hue angle in degrees, any number is wrapped to 0 ~ 359
+ * 		   sat:	saturation, 0 ~ 255
+ *	    bright:	brightness, 0 ~ 255
+ */
+//---------------------------------------------------------------
+color_t TFT_HSBtoRGB_fixed(int hue, uint8_t sat, uint8_t bright);
+
+/*
+ * Blend (linearly interpolate) two colors
+ *
+ * Params:
+ * 		    fg:	color returned for alpha 255
+ * 		    bg:	color returned for alpha 0
+ *	     alpha:	0 ~ 255
+ */
+//------------------------------------------------------------
+color_t TFT_blendColor(color_t fg, color_t bg, uint8_t alpha);
+
+/*
+ * Create the table of 'n' colors going linearly from color 'from' to color 'to'
+ * The table can be used for gradients, heat map plots or anti-aliasing levels;
+ * the color of value v in the range min~max is ramp[((v - min) * (n - 1)) / (max - min)].
+ *
+ * Returns:
+ * 		pointer to the table, the caller frees it with free(); NULL if no memory or n < 1
+ */
+//-----------------------------------------------------
+color_t *TFT_makeRamp(color_t from, color_t to, int n);
+
 /*
  * Decodes and displays JPG image
  * Limits:
@@ -659,17 +1419,21 @@ int TFT_read_touch(int *x, int* y, uint8_t raw);
  * which can be used in TFT_setFont() function to select external font
  * Created file have the same name as source file and extension .fnt
  *
+ * Glyphs of the run-length coded font take less memory and are drawn as runs of pixels.
+ * The 3rd font header byte is set to 0x81 in run-length coded font.
+ *
  * Params:
  *		fontfile: pointer to c source font file name; must have .c extension
- *			 dbg: if set to 1, prints debug information
+ *		   flags: COMPILE_FONT_DEBUG prints debug information
+ *				  COMPILE_FONT_RLE run-length codes the glyphs of 1-bit proportional font if it becomes smaller
  *
  * Returns:
  * 		0 on success
  * 		err no on error
  *
  */
-//------------------------------------------------
-int compile_font_file(char *fontfile, uint8_t dbg);
+//--------------------------------------------------
+int compile_font_file(char *fontfile, uint8_t flags);
 
 /*
  * Get all font's characters to buffer
@@ -35,11 +35,26 @@ uint8_t tft_disp_type = DEFAULT_DISP_TYPE;
 spi_lobo_device_handle_t disp_spi = NULL;
 spi_lobo_device_handle_t ts_spi = NULL;
 
+// Active frame buffer, drawing goes directly to display if NULL
+static tft_fb_t *tft_fb_default = NULL;
+// Frame buffer used by each core
+tft_fb_t **tft_fb_target[portNUM_PROCESSORS] = { [0 ... portNUM_PROCESSORS-1] = &tft_fb_default };
+
 // ====================================================
 
 
+static SemaphoreHandle_t disp_mutex = NULL;	// held by the task which selected the display
+static TaskHandle_t disp_owner = NULL;
+static int disp_select_count = 0;		// nested selects of the task owning the display
+
 static color_t *trans_cline = NULL;
+static color_t *gs_buf[2] = {NULL, NULL};	// gray scale conversion buffers, allocated on first gray scale send
+static uint32_t gs_buf_colors = 0;
+static uint8_t gs_buf_idx = 0;				// buffer to fill next, the other one may still be sent
 static uint8_t _dma_sending = 0;
+static uint8_t disp_madctl = 0;		// memory access control set for the current orientation
+static int scroll_start = 0;		// scrolling area, set by disp_set_scroll_area()
+static int scroll_size = 0;
 
 // RGB to GRAYSCALE constants
 // 0.2989  0.5870  0.1140
@@ -75,18 +90,81 @@ esp_err_t IRAM_ATTR wait_trans_finish(uint8_t free_line)
     return ESP_OK;
 }
 
+// Select the display for the calling task, also if drawing is done in frame buffer
+// Selects are counted, the display is released by the matching (outermost) deselect
+//---------------------------------------
+static esp_err_t IRAM_ATTR _disp_select()
+{
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	uint8_t taken = 0;
+	if (disp_owner != task) {
+		// wait for the task using the display to deselect it
+		if (disp_mutex) xSemaphoreTake(disp_mutex, portMAX_DELAY);
+		disp_owner = task;
+		disp_select_count = 0;
+		taken = 1;
+	}
+
+	wait_trans_finish(1);
+	esp_err_t ret = spi_lobo_device_select(disp_spi, 0);
+	if (ret != ESP_OK) {
+		if (taken) {
+			disp_owner = NULL;
+			if (disp_mutex) xSemaphoreGive(disp_mutex);
+		}
+		return ret;
+	}
+	disp_select_count++;
+	return ret;
+}
+
+// Release the display (and the spi bus) owned by the calling task
+//----------------------------------------
+static esp_err_t IRAM_ATTR _disp_release()
+{
+	wait_trans_finish(1);
+	esp_err_t ret = spi_lobo_device_deselect(disp_spi);
+	disp_select_count = 0;
+	disp_owner = NULL;
+	if (disp_mutex) xSemaphoreGive(disp_mutex);
+	return ret;
+}
+
+//-----------------------------------------
+static esp_err_t IRAM_ATTR _disp_deselect()
+{
+	// the display is selected only by its owner, the spi bus is released by the task which took it
+	if (disp_owner != xTaskGetCurrentTaskHandle()) return ESP_OK;
+
+	// still selected by an outer select of the task
+	if (disp_select_count > 1) {
+		disp_select_count--;
+		return ESP_OK;
+	}
+	return _disp_release();
+}
+
+// End the select of a transfer left running, the display stays owned by the task
+// It is released by the next outermost deselect of the task or by fb_send_wait()
+//--------------------------------
+static void IRAM_ATTR _disp_hold()
+{
+	if ((disp_owner == xTaskGetCurrentTaskHandle()) && (disp_select_count > 0)) disp_select_count--;
+}
+
+// Drawing to frame buffer does not use the display, nor waits for its transfers
 //-------------------------------
 esp_err_t IRAM_ATTR disp_select()
 {
-	wait_trans_finish(1);
-	return spi_lobo_device_select(disp_spi, 0);
+	if (tft_fb) return ESP_OK;
+	return _disp_select();
 }
 
 //---------------------------------
 esp_err_t IRAM_ATTR disp_deselect()
 {
-	wait_trans_finish(1);
-	return spi_lobo_device_deselect(disp_spi);
+	if (tft_fb) return ESP_OK;
+	return _disp_deselect();
 }
 
 //---------------------------------------------------------------------------------------------------
@@ -171,9 +249,9 @@ void IRAM_ATTR disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t le
     if (bits > 0) _spi_transfer_start(disp_spi, bits, 0);
 }
 
-// Set the address window for display write & read commands, display must be selected
+// Set the display memory address window (columns a1~a2, rows b1~b2) for write & read commands, display must be selected
 //---------------------------------------------------------------------------------------------------
-static void IRAM_ATTR disp_spi_transfer_addrwin(uint16_t x1, uint16_t x2, uint16_t y1, uint16_t y2) {
+static void IRAM_ATTR _disp_spi_transfer_memwin(uint16_t a1, uint16_t a2, uint16_t b1, uint16_t b2) {
 	uint32_t wd;
 
     taskDISABLE_INTERRUPTS();
@@ -190,10 +268,10 @@ static void IRAM_ATTR disp_spi_transfer_addrwin(uint16_t x1, uint16_t x2, uint16
 
 	disp_spi->host->hw->cmd.usr = 1; // Start transfer
 
-	wd = (uint32_t)((x1 + 2)>>8);
-	wd |= (uint32_t)((x1 + 2)&0xff) << 8;
-	wd |= (uint32_t)((x2 + 2)>>8) << 16;
-	wd |= (uint32_t)((x2 + 2)&0xff) << 24;
+	wd = (uint32_t)(a1>>8);
+	wd |= (uint32_t)(a1&0xff) << 8;
+	wd |= (uint32_t)(a2>>8) << 16;
+	wd |= (uint32_t)(a2&0xff) << 24;
 
 	while (disp_spi->host->hw->cmd.usr); // wait transfer end
 	gpio_set_level(PIN_NUM_DC, 1);
@@ -207,10 +285,10 @@ static void IRAM_ATTR disp_spi_transfer_addrwin(uint16_t x1, uint16_t x2, uint16
 	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
 	disp_spi->host->hw->cmd.usr = 1; // Start transfer
 
-	wd = (uint32_t)((y1 + 1)>>8);
-	wd |= (uint32_t)((y1 + 1)&0xff) << 8;
-	wd |= (uint32_t)((y2 + 1)>>8) << 16;
-	wd |= (uint32_t)((y2 + 1)&0xff) << 24;
+	wd = (uint32_t)(b1>>8);
+	wd |= (uint32_t)(b1&0xff) << 8;
+	wd |= (uint32_t)(b2>>8) << 16;
+	wd |= (uint32_t)(b2&0xff) << 24;
 
 	while (disp_spi->host->hw->cmd.usr);
 	gpio_set_level(PIN_NUM_DC, 1);
@@ -222,29 +300,128 @@ static void IRAM_ATTR disp_spi_transfer_addrwin(uint16_t x1, uint16_t x2, uint16
     taskENABLE_INTERRUPTS();
 }
 
+// Set the address window for display write & read commands in screen coordinates, display must be selected
+//---------------------------------------------------------------------------------------------------
+static void IRAM_ATTR disp_spi_transfer_addrwin(uint16_t x1, uint16_t x2, uint16_t y1, uint16_t y2) {
+	_disp_spi_transfer_memwin(x1 + TFT_COL_OFFSET, x2 + TFT_COL_OFFSET, y1 + TFT_ROW_OFFSET, y2 + TFT_ROW_OFFSET);
+}
+
+// Gray scale level contributed by each color component value, scaled by 256
+static uint16_t gs_lut_r[256];
+static uint16_t gs_lut_g[256];
+static uint16_t gs_lut_b[256];
+
+// Prepare the gray scale conversion tables
+//------------------------
+static void _gs_lut_init()
+{
+	for (int i=0; i<256; i++) {
+		gs_lut_r[i] = (uint16_t)(GS_FACT_R * i * 256);
+		gs_lut_g[i] = (uint16_t)(GS_FACT_G * i * 256);
+		gs_lut_b[i] = (uint16_t)(GS_FACT_B * i * 256);
+	}
+}
+
 // Convert color to gray scale
 //----------------------------------------------
 static color_t IRAM_ATTR color2gs(color_t color)
 {
 	color_t _color;
-    float gs_clr = GS_FACT_R * color.r + GS_FACT_G * color.g + GS_FACT_B * color.b;
-    if (gs_clr > 255) gs_clr = 255;
+	uint32_t gs_clr = (gs_lut_r[color.r] + gs_lut_g[color.g] + gs_lut_b[color.b]) >> 8;
+	if (gs_clr > 255) gs_clr = 255;
 
-    _color.r = (uint8_t)gs_clr;
-    _color.g = (uint8_t)gs_clr;
-    _color.b = (uint8_t)gs_clr;
+	_color.r = gs_clr;
+	_color.g = gs_clr;
+	_color.b = gs_clr;
 
-    return _color;
+	return _color;
+}
+
+// ==== Frame buffer functions ========================================
+// Colors are stored in frame buffer unconverted,
+// gray scale conversion is done when sending it to display
+
+// Fill the frame buffer rectangle (x1,y1),(x2,y2) with color
+//---------------------------------------------------------------------------------------
+static void fb_fillRect(tft_fb_t *fb, int x1, int y1, int x2, int y2, color_t color)
+{
+	x1 -= fb->org_x;
+	x2 -= fb->org_x;
+	y1 -= fb->org_y;
+	y2 -= fb->org_y;
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 >= fb->width) x2 = fb->width-1;
+	if (y2 >= fb->height) y2 = fb->height-1;
+	if ((x1 > x2) || (y1 > y2)) return;
+
+	int w = x2 - x1 + 1;
+	color_t *first = fb->buf + (y1 * fb->width) + x1;
+
+	// fill the first line, copy it to the rest
+	for (int n=0; n<w; n++) {
+		first[n] = color;
+	}
+	for (int y=y1+1; y<=y2; y++) {
+		memcpy(fb->buf + (y * fb->width) + x1, first, w*sizeof(color_t));
+	}
+}
+
+// Copy 'len' colors from buffer to the frame buffer window (x1,y1),(x2,y2)
+// Colors are placed in window line by line, as they would be on display
+//------------------------------------------------------------------------------------------------
+static void fb_sendData(tft_fb_t *fb, int x1, int y1, int x2, int y2, uint32_t len, color_t *buf)
+{
+	x1 -= fb->org_x;
+	x2 -= fb->org_x;
+	y1 -= fb->org_y;
+	y2 -= fb->org_y;
+	int w = x2 - x1 + 1;
+	int cx1 = (x1 < 0) ? 0 : x1;
+	int cx2 = (x2 >= fb->width) ? fb->width-1 : x2;
+
+	for (int y=y1; (y<=y2) && (len > 0); y++) {
+		int n = (len < w) ? len : w;
+		if ((y >= 0) && (y < fb->height) && (cx1 <= cx2) && ((x1 + n - 1) >= cx1)) {
+			int cn = ((x1 + n - 1) > cx2) ? (cx2 - cx1 + 1) : (x1 + n - cx1);
+			memcpy(fb->buf + (y * fb->width) + cx1, buf + (cx1 - x1), cn*sizeof(color_t));
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+// Read 'len' colors from the frame buffer window (x1,y1),(x2,y2)
+// Pixels outside the frame buffer are returned as black
+//------------------------------------------------------------------------------------------------
+static void fb_readData(tft_fb_t *fb, int x1, int y1, int x2, int y2, uint32_t len, color_t *buf)
+{
+	x1 -= fb->org_x;
+	x2 -= fb->org_x;
+	y1 -= fb->org_y;
+	y2 -= fb->org_y;
+	for (int y=y1; (y<=y2) && (len > 0); y++) {
+		for (int x=x1; (x<=x2) && (len > 0); x++) {
+			if ((x >= 0) && (y >= 0) && (x < fb->width) && (y < fb->height)) *buf = fb->buf[(y * fb->width) + x];
+			buf++;
+			len--;
+		}
+	}
 }
 
 // Set display pixel at given coordinates to given color
 //------------------------------------------------------------------------
 void IRAM_ATTR drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel)
 {
+	tft_fb_t *fb = tft_fb;
+	if (fb) {
+		fb_drawPixel(fb, x, y, color);
+		return;
+	}
 	if (!(disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return;
 
 	if (sel) {
-		if (disp_select()) return;
+		if (_disp_select()) return;
 	}
 	else wait_trans_finish(1);
 
@@ -275,7 +452,7 @@ void IRAM_ATTR drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel)
 	while (disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
 
     taskENABLE_INTERRUPTS();
-   if (sel) disp_deselect();
+   if (sel) _disp_deselect();
 }
 
 //-----------------------------------------------------------
@@ -296,59 +473,115 @@ static void IRAM_ATTR _dma_send(uint8_t *data, uint32_t size)
 	disp_spi->host->hw->cmd.usr = 1;
 }
 
+// Pack up to 21 colors (512 bits) into the SPI data buffer and start the transfer
+// 'rep' and 'gray' are constants in each call below, so each packing loop is generated without per color tests
+//-------------------------------------------------------------------------------------------------------------------------------
+static inline __attribute__((always_inline)) void _pack_send(color_t *color, uint32_t len, const uint8_t rep, const uint8_t gray)
+{
+	uint32_t wd[16];
+	uint8_t *dest = (uint8_t *)wd;
+	int nbytes = len * sizeof(color_t);
+
+	if (rep) {
+		// 4 colors fill 3 words, the rest is repeated by words
+		int n = (len > 4) ? 4 : len;
+		for (int i=0; i<n; i++, dest += 3) {
+			dest[0] = color->r;
+			dest[1] = color->g;
+			dest[2] = color->b;
+		}
+		for (int i=3; i<((nbytes + 3) / 4); i++) wd[i] = wd[i-3];
+	}
+	else if (gray) {
+		for (int i=0; i<len; i++, dest += 3) {
+			color_t _color = color2gs(color[i]);
+			dest[0] = _color.r;
+			dest[1] = _color.g;
+			dest[2] = _color.b;
+		}
+	}
+	else memcpy(dest, color, nbytes);
+
+    taskDISABLE_INTERRUPTS();
+	while (disp_spi->host->hw->cmd.usr);						// Wait for SPI bus ready
+	for (int i=0; i<((nbytes + 3) / 4); i++) {
+		disp_spi->host->hw->data_buf[i] = wd[i];
+	}
+	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = (nbytes * 8) - 1;	// set number of bits to be sent
+	disp_spi->host->hw->cmd.usr = 1;							// Start transfer
+    taskENABLE_INTERRUPTS();
+}
+
+// Send up to 21 colors, the packing is selected once for the whole transfer
 //---------------------------------------------------------------------------
 static void IRAM_ATTR _direct_send(color_t *color, uint32_t len, uint8_t rep)
 {
-	uint32_t cidx = 0;	// color buffer index
-	uint32_t wd = 0;
-	int idx = 0;
-	int bits = 0;
-	int wbits = 0;
+	if (rep) {
+		color_t _color = (gray_scale) ? color2gs(color[0]) : color[0];
+		_pack_send(&_color, len, 1, 0);
+	}
+	else if (gray_scale) _pack_send(color, len, 0, 1);
+	else _pack_send(color, len, 0, 0);
+}
 
-    taskDISABLE_INTERRUPTS();
-	color_t _color = color[0];
-	if ((rep) && (gray_scale)) _color = color2gs(color[0]);
-
-	while (len) {
-		// ** Get color data from color buffer **
-		if (rep == 0) {
-			if (gray_scale) _color = color2gs(color[cidx]);
-			else _color = color[cidx];
-		}
+// Send RAM WRITE command, display must be selected and address window set
+// After it, all data sent is written to display GRAM
+//--------------------------------------------------
+static void IRAM_ATTR disp_spi_transfer_ramwr()
+{
+    gpio_set_level(PIN_NUM_DC, 0);
+    disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_RAMWR;
+	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
+	disp_spi->host->hw->cmd.usr = 1;		// Start transfer
+	while (disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
 
-		wd |= (uint32_t)_color.r << wbits;
-		wbits += 8;
-		if (wbits == 32) {
-			bits += wbits;
-			wbits = 0;
-			disp_spi->host->hw->data_buf[idx++] = wd;
-			wd = 0;
+	gpio_set_level(PIN_NUM_DC, 1);								// Set DC to 1 (data mode);
+}
+
+// Send colors converted to gray scale, the caller's color buffer is not changed
+// Colors are converted into two internal DMA buffers, one is filled while the other is sent
+// The buffers are allocated once and kept, the last one is still sent on return
+//--------------------------------------------------------------
+static void IRAM_ATTR _dma_send_gs(color_t *color, uint32_t len)
+{
+	if (gs_buf_colors == 0) {
+		int buf_size = (disp_spi->host->max_transfer_sz < TFT_FB_LINEBUF_SIZE) ? disp_spi->host->max_transfer_sz : TFT_FB_LINEBUF_SIZE;
+		gs_buf[0] = heap_caps_malloc(buf_size, MALLOC_CAP_DMA);
+		gs_buf[1] = heap_caps_malloc(buf_size, MALLOC_CAP_DMA);
+		if ((gs_buf[0]) && (gs_buf[1])) gs_buf_colors = buf_size / sizeof(color_t);
+		else {
+			if (gs_buf[0]) free(gs_buf[0]);
+			if (gs_buf[1]) free(gs_buf[1]);
+			gs_buf[0] = NULL;
+			gs_buf[1] = NULL;
 		}
-		wd |= (uint32_t)_color.g << wbits;
-		wbits += 8;
-		if (wbits == 32) {
-			bits += wbits;
-			wbits = 0;
-			disp_spi->host->hw->data_buf[idx++] = wd;
-			wd = 0;
+	}
+
+	if (gs_buf_colors == 0) {
+		// no memory for the buffers, colors are sent through the SPI data buffer
+		while (len > 0) {
+			uint32_t n = (len > 21) ? 21 : len;
+			_direct_send(color, n, 0);
+			color += n;
+			len -= n;
 		}
-		wd |= (uint32_t)_color.b << wbits;
-		wbits += 8;
-		if (wbits == 32) {
-			bits += wbits;
-			wbits = 0;
-			disp_spi->host->hw->data_buf[idx++] = wd;
-			wd = 0;
+		return;
+	}
+
+	while (len > 0) {
+		uint32_t n = (len > gs_buf_colors) ? gs_buf_colors : len;
+		color_t *buf = gs_buf[gs_buf_idx];
+		// the buffer filled here is not the one which may still be sent
+		for (uint32_t i=0; i<n; i++) {
+			buf[i] = color2gs(color[i]);
 		}
-    	len--;					// Decrement colors counter
-        if (rep == 0) cidx++;	// if not repeating color, increment color buffer index
-    }
-	if (bits) {
-		while (disp_spi->host->hw->cmd.usr);						// Wait for SPI bus ready
-		disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = bits-1;	// set number of bits to be sent
-        disp_spi->host->hw->cmd.usr = 1;							// Start transfer
+		// wait for the previous buffer to be sent, then start sending this one
+		wait_trans_finish(0);
+		_dma_send((uint8_t *)buf, n * sizeof(color_t));
+		color += n;
+		len -= n;
+		gs_buf_idx ^= 1;
 	}
-    taskENABLE_INTERRUPTS();
 }
 
 // ================================================================
@@ -364,13 +597,7 @@ static void IRAM_ATTR _TFT_pushColorRep(color_t *color, uint32_t len, uint8_t re
 	if (!(disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return;
 
 	// Send RAM WRITE command
-    gpio_set_level(PIN_NUM_DC, 0);
-    disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_RAMWR;
-	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
-	disp_spi->host->hw->cmd.usr = 1;		// Start transfer
-	while (disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
-
-	gpio_set_level(PIN_NUM_DC, 1);								// Set DC to 1 (data mode);
+	disp_spi_transfer_ramwr();
 
 	if ((len*24) <= 512) {
 
@@ -379,14 +606,8 @@ static void IRAM_ATTR _TFT_pushColorRep(color_t *color, uint32_t len, uint8_t re
 	}
 	else if (rep == 0)  {
 		// ==== use DMA transfer ====
-		// ** Prepare data
-		if (gray_scale) {
-			for (int n=0; n<len; n++) {
-				color[n] = color2gs(color[n]);
-			}
-	    }
-
-	    _dma_send((uint8_t *)color, len*3);
+		if (gray_scale) _dma_send_gs(color, len);
+		else _dma_send((uint8_t *)color, len*3);
 	}
 	else {
 		// ==== Repeat color, more than 512 bits total ====
@@ -436,14 +657,36 @@ static void IRAM_ATTR _TFT_pushColorRep(color_t *color, uint32_t len, uint8_t re
 //-------------------------------------------------------------------------------------------
 void IRAM_ATTR TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t color, uint32_t len)
 {
-	if (disp_select() != ESP_OK) return;
+	tft_fb_t *fb = tft_fb;
+	if (fb) {
+		fb_fillRect(fb, x1, y1, x2, y2, color);
+		return;
+	}
+	if (_disp_select() != ESP_OK) return;
 
 	// ** Send address window **
 	disp_spi_transfer_addrwin(x1, x2, y1, y2);
 
 	_TFT_pushColorRep(&color, len, 1, 1);
 
-	disp_deselect();
+	_disp_deselect();
+}
+
+// Fill 'len' pixels of the display line 'y' starting at 'x' with color
+// ** Device must already be selected **
+//-----------------------------------------------------------------------
+void IRAM_ATTR drawSpan(int16_t x, int16_t y, int16_t len, color_t color)
+{
+	tft_fb_t *fb = tft_fb;
+	if (fb) {
+		fb_drawSpan(fb, x, y, len, color);
+		return;
+	}
+	wait_trans_finish(1);
+
+	// ** Send address window **
+	disp_spi_transfer_addrwin(x, x+len-1, y, y);
+	_TFT_pushColorRep(&color, len, 1, 1);
 }
 
 // Write 'len' color data to TFT 'window' (x1,y2),(x2,y2) from given buffer
@@ -451,6 +694,11 @@ void IRAM_ATTR TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t color, u
 //-----------------------------------------------------------------------------------
 void IRAM_ATTR send_data(int x1, int y1, int x2, int y2, uint32_t len, color_t *buf)
 {
+	tft_fb_t *fb = tft_fb;
+	if (fb) {
+		fb_sendData(fb, x1, y1, x2, y2, len, buf);
+		return;
+	}
 	// ** Send address window **
 	disp_spi_transfer_addrwin(x1, x2, y1, y2);
 	_TFT_pushColorRep(buf, len, 0, 0);
@@ -468,15 +716,29 @@ int IRAM_ATTR read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, u
     memset(&t, 0, sizeof(t));  //Zero out the transaction
 	memset(buf, 0, len*sizeof(color_t));
 
+	tft_fb_t *fb = tft_fb;
+	if (fb) {
+		fb_readData(fb, x1, y1, x2, y2, len, (color_t *)(buf+1));
+		return ESP_OK;
+	}
+
+	if (_disp_select() != ESP_OK) return -2;
+
 	if (set_sp) {
-		if (disp_deselect() != ESP_OK) return -1;
 		// Change spi clock if needed
+		// The display stays selected by this task, other tasks can not send data at the read clock;
+		// the spi driver sets the clock with the device deselected
+		wait_trans_finish(1);
+		spi_lobo_device_deselect(disp_spi);
 		current_clock = spi_lobo_get_speed(disp_spi);
 		if (max_rdclock < current_clock) spi_lobo_set_speed(disp_spi, max_rdclock);
+		if (spi_lobo_device_select(disp_spi, 0) != ESP_OK) {
+			if (max_rdclock < current_clock) spi_lobo_set_speed(disp_spi, current_clock);
+			_disp_deselect();
+			return -1;
+		}
 	}
 
-	if (disp_select() != ESP_OK) return -2;
-
 	// ** Send address window **
 	disp_spi_transfer_addrwin(x1, x2, y1, y2);
 
@@ -491,16 +753,351 @@ int IRAM_ATTR read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, u
 
 	esp_err_t res = spi_lobo_transfer_data(disp_spi, &t); // Receive using direct mode
 
-	disp_deselect();
-
-	if (set_sp) {
-		// Restore spi clock if needed
-		if (max_rdclock < current_clock) spi_lobo_set_speed(disp_spi, current_clock);
+	if ((set_sp) && (max_rdclock < current_clock)) {
+		// Restore spi clock before other tasks can use the display
+		spi_lobo_device_deselect(disp_spi);
+		spi_lobo_set_speed(disp_spi, current_clock);
 	}
 
+	_disp_deselect();
+
     return res;
 }
 
+//============================================================
+void IRAM_ATTR fb_send(tft_fb_t *fb, int x, int y, uint8_t wait)
+{
+	int scale = (fb->scale) ? fb->scale : 1;
+
+	// Display area covered by the frame buffer, clipped to the screen
+	int dx1 = (x < 0) ? 0 : x;
+	int dy1 = (y < 0) ? 0 : y;
+	int dx2 = x + (fb->width * scale) - 1;
+	int dy2 = y + (fb->height * scale) - 1;
+	if (dx2 >= _width) dx2 = _width-1;
+	if (dy2 >= _height) dy2 = _height-1;
+	if ((dx1 > dx2) || (dy1 > dy2)) return;
+
+	int dw = dx2 - dx1 + 1;
+	int buf_size = (disp_spi->host->max_transfer_sz < TFT_FB_LINEBUF_SIZE) ? disp_spi->host->max_transfer_sz : TFT_FB_LINEBUF_SIZE;
+
+	uint8_t *data = (uint8_t *)(fb->buf + ((dy1 - y) * fb->width));
+	if ((fb->dma) && (scale == 1) && (!gray_scale) && (dx1 == x) && (dw == fb->width) && (((uint32_t)data & 3) == 0)) {
+		// ==== Whole buffer lines are sent from DMA capable memory, no copy needed ====
+		uint32_t size = (dy2 - dy1 + 1) * dw * sizeof(color_t);
+		buf_size -= buf_size % 12;	// keep the chunks 4-byte aligned
+
+		if (_disp_select() != ESP_OK) return;
+		disp_spi_transfer_addrwin(dx1, dx2, dy1, dy2);
+		disp_spi_transfer_ramwr();
+		while (size > 0) {
+			uint32_t to_send = (size > buf_size) ? buf_size : size;
+			wait_trans_finish(0);
+			_dma_send(data, to_send);
+			data += to_send;
+			size -= to_send;
+		}
+		// without waiting, the display stays selected by this task until it deselects it
+		if (wait) _disp_deselect();
+		else _disp_hold();
+		return;
+	}
+
+	int buf_lines = buf_size / (dw * sizeof(color_t));
+	if (buf_lines < 1) buf_lines = 1;
+
+	// Two internal DMA line buffers, one is filled while the other is sent
+	color_t *line_buf[2];
+	line_buf[0] = heap_caps_malloc(buf_lines * dw * sizeof(color_t), MALLOC_CAP_DMA);
+	line_buf[1] = heap_caps_malloc(buf_lines * dw * sizeof(color_t), MALLOC_CAP_DMA);
+	if ((line_buf[0] == NULL) || (line_buf[1] == NULL)) goto exit;
+
+	if (_disp_select() != ESP_OK) goto exit;
+	disp_spi_transfer_addrwin(dx1, dx2, dy1, dy2);
+	disp_spi_transfer_ramwr();
+
+	int dy = dy1;
+	int lb_idx = 0;
+	while (dy <= dy2) {
+		color_t *lbuf = line_buf[lb_idx];
+		int nlines = 0;
+		while ((nlines < buf_lines) && (dy <= dy2)) {
+			color_t *dest = lbuf + (nlines * dw);
+			if ((nlines > 0) && (((dy - y) % scale) != 0)) {
+				// same frame buffer line as the previous display line
+				memcpy(dest, dest - dw, dw * sizeof(color_t));
+			}
+			else if ((scale == 1) && (!gray_scale)) {
+				// copy frame buffer line as it is
+				memcpy(dest, fb->buf + ((dy - y) * fb->width) + (dx1 - x), dw * sizeof(color_t));
+			}
+			else {
+				// expand frame buffer line, replicate each pixel 'scale' times
+				color_t *src = fb->buf + (((dy - y) / scale) * fb->width) + ((dx1 - x) / scale);
+				int rep = scale - ((dx1 - x) % scale);
+				int n = 0;
+				while (n < dw) {
+					color_t color = (gray_scale) ? color2gs(*src) : *src;
+					for (; (rep > 0) && (n < dw); rep--) {
+						dest[n++] = color;
+					}
+					rep = scale;
+					src++;
+				}
+			}
+			nlines++;
+			dy++;
+		}
+		// wait for the previous buffer to be sent, then start sending this one
+		wait_trans_finish(0);
+		_dma_send((uint8_t *)lbuf, nlines * dw * sizeof(color_t));
+		lb_idx ^= 1;
+	}
+	_disp_deselect();
+
+exit:
+	if (line_buf[0]) free(line_buf[0]);
+	if (line_buf[1]) free(line_buf[1]);
+}
+
+//=================
+void fb_send_wait()
+{
+	if (disp_owner != xTaskGetCurrentTaskHandle()) return;
+
+	// inside the task's own select the display is only waited for
+	if (disp_select_count > 0) wait_trans_finish(1);
+	else _disp_release();
+}
+
+// Get the controller's display memory (GRAM) size in columns and rows, without swapped rows and columns
+// The screen is placed in it at TFT_COL_OFFSET, TFT_ROW_OFFSET of the current orientation
+//----------------------------------------------
+static void _disp_mem_size(int *cols, int *rows)
+{
+	switch (tft_disp_type) {
+		case DISP_TYPE_ILI9488:
+			*cols = 320;
+			*rows = 480;
+			break;
+		case DISP_TYPE_ILI9341:
+		case DISP_TYPE_ST7789V:
+			*cols = 240;
+			*rows = 320;
+			break;
+		default:
+			// ST7735, ST7735R, ST7735B
+			*cols = 132;
+			*rows = 162;
+	}
+}
+
+// Map address window column/row c,p to display memory column/row a,b for memory access control 'madctl'
+// Rows and columns are mirrored over the whole display memory
+//-------------------------------------------------------------------
+static void _madctl_map(uint8_t madctl, int c, int p, int *a, int *b)
+{
+	int mw, mh;
+	_disp_mem_size(&mw, &mh);
+
+	if (madctl & MADCTL_MV) {
+		*a = p;
+		*b = c;
+	}
+	else {
+		*a = c;
+		*b = p;
+	}
+	if (madctl & MADCTL_MX) *a = mw - 1 - *a;
+	if (madctl & MADCTL_MY) *b = mh - 1 - *b;
+}
+
+// Map display memory column/row a,b to address window column/row c,p for memory access control 'madctl'
+//---------------------------------------------------------------------
+static void _madctl_unmap(uint8_t madctl, int a, int b, int *c, int *p)
+{
+	int mw, mh;
+	_disp_mem_size(&mw, &mh);
+
+	if (madctl & MADCTL_MX) a = mw - 1 - a;
+	if (madctl & MADCTL_MY) b = mh - 1 - b;
+	if (madctl & MADCTL_MV) {
+		*c = b;
+		*p = a;
+	}
+	else {
+		*c = a;
+		*p = b;
+	}
+}
+
+//===============================================================================
+int IRAM_ATTR fb_send_rotated(tft_fb_t *fb, int x, int y, uint8_t rot)
+{
+	int err = 0;
+	color_t *line_buf = NULL;
+	int w = fb->width;
+	int h = fb->height;
+
+	rot &= 3;
+	int dw = (rot & 1) ? h : w;
+	int dh = (rot & 1) ? w : h;
+	if ((fb->scale > 1) || (x < 0) || (y < 0) || ((x + dw) > _width) || ((y + dh) > _height)) return -1;
+	if (rot == 0) {
+		fb_send(fb, x, y, 1);
+		return 0;
+	}
+
+	// display positions of the buffer pixels (0,0), (1,0) and (0,1)
+	int dx[3], dy[3];
+	for (int n=0; n<3; n++) {
+		int sx = (n == 1) ? 1 : 0;
+		int sy = (n == 2) ? 1 : 0;
+		if (rot == 1) {
+			dx[n] = x + h - 1 - sy;
+			dy[n] = y + sx;
+		}
+		else if (rot == 2) {
+			dx[n] = x + w - 1 - sx;
+			dy[n] = y + h - 1 - sy;
+		}
+		else {
+			dx[n] = x + sy;
+			dy[n] = y + w - 1 - sx;
+		}
+	}
+
+	// find the memory access control with which the buffer lines are written in their natural order
+	uint8_t madctl = 0;
+	int c[3], p[3];
+	int m;
+	for (m=0; m<8; m++) {
+		madctl = (disp_madctl & ~(MADCTL_MY | MADCTL_MX | MADCTL_MV)) |
+				 ((m & 4) ? MADCTL_MY : 0) | ((m & 2) ? MADCTL_MX : 0) | ((m & 1) ? MADCTL_MV : 0);
+		for (int n=0; n<3; n++) {
+			// the screen position is mapped with the address window offsets of the current orientation
+			int a, b;
+			_madctl_map(disp_madctl, dx[n] + TFT_COL_OFFSET, dy[n] + TFT_ROW_OFFSET, &a, &b);
+			_madctl_unmap(madctl, a, b, &c[n], &p[n]);
+		}
+		if (((c[1] - c[0]) == 1) && (p[1] == p[0]) && (c[2] == c[0]) && ((p[2] - p[0]) == 1)) break;
+	}
+	if (m == 8) return -1;
+
+	int buf_size = (disp_spi->host->max_transfer_sz < TFT_FB_LINEBUF_SIZE) ? disp_spi->host->max_transfer_sz : TFT_FB_LINEBUF_SIZE;
+	buf_size -= buf_size % 12;	// keep the chunks 4-byte aligned
+	uint8_t *data = (uint8_t *)fb->buf;
+	uint32_t size = w * h * sizeof(color_t);
+	uint8_t direct = ((fb->dma) && (!gray_scale) && (((uint32_t)data & 3) == 0));
+	if (!direct) {
+		if (size < buf_size) buf_size = size;
+		line_buf = heap_caps_malloc(buf_size, MALLOC_CAP_DMA);
+		if (line_buf == NULL) return -2;
+	}
+
+	if (_disp_select() != ESP_OK) {
+		err = -3;
+		goto exit;
+	}
+	// Temporary change the scan direction, the window is in the rotated display memory coordinates, offsets included
+	disp_spi_transfer_cmd_data(TFT_MADCTL, &madctl, 1);
+	_disp_spi_transfer_memwin(c[0], c[0] + w - 1, p[0], p[0] + h - 1);
+	disp_spi_transfer_ramwr();
+	while (size > 0) {
+		uint32_t to_send = (size > buf_size) ? buf_size : size;
+		wait_trans_finish(0);
+		if (direct) _dma_send(data, to_send);
+		else {
+			color_t *src = (color_t *)data;
+			for (int n=0; n<(to_send / sizeof(color_t)); n++) {
+				line_buf[n] = (gray_scale) ? color2gs(src[n]) : src[n];
+			}
+			_dma_send((uint8_t *)line_buf, to_send);
+		}
+		data += to_send;
+		size -= to_send;
+	}
+	wait_trans_finish(1);
+	// restore the scan direction
+	disp_spi_transfer_cmd_data(TFT_MADCTL, &disp_madctl, 1);
+	_disp_deselect();
+
+exit:
+	if (line_buf) free(line_buf);
+	return err;
+}
+
+// Send the vertical scrolling definition (fixed top rows, scrolled rows, fixed bottom rows) and start row
+// Values are in display memory rows; screen rows are in reverse order if MADCTL_MY is set
+//-----------------------------------------------------------------------------------------
+static int _send_scroll(int tfa, int vsa, int bfa, int start)
+{
+	uint8_t data[6] = {tfa >> 8, tfa & 0xFF, vsa >> 8, vsa & 0xFF, bfa >> 8, bfa & 0xFF};
+
+	if (_disp_select() != ESP_OK) return -1;
+	disp_spi_transfer_cmd_data(TFT_VSCRDEF, data, 6);
+	data[0] = start >> 8;
+	data[1] = start & 0xFF;
+	disp_spi_transfer_cmd_data(TFT_VSCRSADD, data, 2);
+	_disp_deselect();
+	return 0;
+}
+
+// Get the first display memory row of the scrolling area 'start' ~ 'start'+'size'-1 (screen rows, columns with MADCTL_MV)
+// The address window offset is added and the display memory rows are in reverse order if MADCTL_MY is set
+//-----------------------------------------------
+static int _scroll_mem_start(int start, int size)
+{
+	int cols, rows;
+	_disp_mem_size(&cols, &rows);
+
+	start += (disp_madctl & MADCTL_MV) ? TFT_COL_OFFSET : TFT_ROW_OFFSET;
+	return (disp_madctl & MADCTL_MY) ? (rows - start - size) : start;
+}
+
+//===============================================================
+int disp_set_scroll_area(int start, int size, uint8_t columns)
+{
+	int cols, rows;
+	_disp_mem_size(&cols, &rows);								// display memory rows
+	int screen_rows = (disp_madctl & MADCTL_MV) ? _width : _height;	// screen rows (columns) over the display memory rows
+
+	if (size <= 0) {
+		// remove the scrolling area
+		if (scroll_size == 0) return 0;
+		scroll_size = 0;
+		return _send_scroll(0, rows, 0, 0);
+	}
+
+	if ((scroll_size != 0) || ((columns != 0) != ((disp_madctl & MADCTL_MV) != 0)) || (start < 0) || ((start + size) > screen_rows)) return -1;
+
+	// fixed top, scrolled and fixed bottom rows cover all display memory rows
+	int tfa = _scroll_mem_start(start, size);
+	if ((tfa < 0) || ((tfa + size) > rows)) return -1;
+	if (_send_scroll(tfa, size, rows - tfa - size, tfa) != 0) return -1;
+	scroll_start = start;
+	scroll_size = size;
+	return 0;
+}
+
+//=====================================
+int disp_set_scroll_offset(int offset)
+{
+	if (scroll_size == 0) return -1;
+
+	offset %= scroll_size;
+	if (offset < 0) offset += scroll_size;
+	// with reversed memory rows the area is scrolled in the opposite direction
+	int tfa = _scroll_mem_start(scroll_start, scroll_size);
+	int start = (disp_madctl & MADCTL_MY) ? ((scroll_size - offset) % scroll_size) : offset;
+
+	if (_disp_select() != ESP_OK) return -1;
+	uint8_t data[2] = {(tfa + start) >> 8, (tfa + start) & 0xFF};
+	disp_spi_transfer_cmd_data(TFT_VSCRSADD, data, 2);
+	_disp_deselect();
+	return 0;
+}
+
 // Reads one pixel/color from the TFT's GRAM at position (x,y)
 //-----------------------------------------------
 color_t IRAM_ATTR readPixel(int16_t x, int16_t y)
@@ -769,6 +1366,9 @@ void _tft_setRotation(uint8_t rot) {
 	uint8_t madctl = 0;
 	uint16_t tmp;
 
+	// scrolling area is defined in display memory rows of the current orientation
+	disp_set_scroll_area(0, 0, 0);
+
     if ((rotation & 1)) {
         // in landscape modes must be width > height
         if (_width < _height) {
@@ -846,15 +1446,29 @@ void _tft_setRotation(uint8_t rot) {
         break;
     }
     #endif
+	disp_madctl = madctl;
 	if (send) {
-		if (disp_select() == ESP_OK) {
+		if (_disp_select() == ESP_OK) {
 			disp_spi_transfer_cmd_data(TFT_MADCTL, &madctl, 1);
-			disp_deselect();
+			_disp_deselect();
 		}
 	}
 
 }
 
+//==================================
+void disp_set_madctl(uint8_t madctl)
+{
+	// scrolling area is defined in display memory rows of the current orientation
+	disp_set_scroll_area(0, 0, 0);
+
+	disp_madctl = madctl;
+	if (_disp_select() == ESP_OK) {
+		disp_spi_transfer_cmd_data(TFT_MADCTL, &madctl, 1);
+		_disp_deselect();
+	}
+}
+
 //=================
 void TFT_PinsInit()
 {
@@ -903,7 +1517,13 @@ void TFT_display_init()
     vTaskDelay(150 / portTICK_RATE_MS);
 #endif
 
-    ret = disp_select();
+    _gs_lut_init();
+
+    // display is used by one task at a time
+    if (disp_mutex == NULL) disp_mutex = xSemaphoreCreateMutex();
+    assert(disp_mutex != NULL);
+
+    ret = _disp_select();
     assert(ret==ESP_OK);
     //Send all the initialization commands
 	if (tft_disp_type == DISP_TYPE_ILI9341) {
@@ -932,7 +1552,7 @@ void TFT_display_init()
 	}
 	else assert(0);
 
-    ret = disp_deselect();
+    ret = _disp_deselect();
 	assert(ret==ESP_OK);
 
 	// Clear screen
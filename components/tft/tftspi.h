@@ -9,6 +9,7 @@
 
 #include "tftspi.h"
 #include "spi_master_lobo.h"
+#include "freertos/task.h"
 #include "sdkconfig.h"
 #include "stmpe610.h"
 
@@ -220,6 +221,78 @@ typedef struct __attribute__((__packed__)) {
 	uint8_t b;
 } color_t ;
 
+// RAM frame buffer which can be used as drawing target instead of display GRAM
+typedef struct {
+	color_t		*buf;		// pixel buffer, 'width' * 'height' colors
+	int			width;		// buffer width in pixels
+	int			height;		// buffer height in pixels
+	int			x;			// display X position of the buffer's upper left pixel
+	int			y;			// display Y position of the buffer's upper left pixel
+	int			org_x;		// drawing X coordinate of the buffer's upper left pixel
+	int			org_y;		// drawing Y coordinate of the buffer's upper left pixel
+	uint8_t		scale;		// each buffer pixel is sent to display as 'scale' x 'scale' pixels block
+	uint8_t		dma;		// 1 if the buffer is in DMA capable memory and can be sent directly
+} tft_fb_t;
+
+// Thread local storage pointer holding the task's own drawing context (see TFT_context_select())
+// The index 0 is used by pthreads; CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS must be greater than
+// TFT_TLS_INDEX for tasks to have their own drawing contexts, else the tasks on each core share the context
+#ifndef TFT_TLS_INDEX
+#define TFT_TLS_INDEX 1
+#endif
+#define TFT_TASK_CONTEXTS	(configNUM_THREAD_LOCAL_STORAGE_POINTERS > TFT_TLS_INDEX)
+
+// ==== Active frame buffer =====================================
+// If not NULL, all drawing and reading is done in the frame buffer
+// instead of in display GRAM; coordinates are frame buffer coordinates
+// offset by the buffer's origin (org_x, org_y)
+// The task's own drawing context starts with the task's frame buffer target;
+// other tasks draw to the frame buffer of their core, normally the same for both cores
+extern tft_fb_t **tft_fb_target[portNUM_PROCESSORS];
+
+//---------------------------------------
+static inline tft_fb_t **_tft_fb_target()
+{
+	#if TFT_TASK_CONTEXTS
+	tft_fb_t **fb = (tft_fb_t **)pvTaskGetThreadLocalStoragePointer(NULL, TFT_TLS_INDEX);
+	if (fb) return fb;
+	#endif
+	return tft_fb_target[xPortGetCoreID()];
+}
+#define tft_fb (*_tft_fb_target())
+
+// Set the frame buffer pixel at drawing coordinates x,y; pixels outside the buffer are not drawn
+//------------------------------------------------------------------------
+static inline void fb_drawPixel(tft_fb_t *fb, int x, int y, color_t color)
+{
+	x -= fb->org_x;
+	y -= fb->org_y;
+	if ((x >= 0) && (y >= 0) && (x < fb->width) && (y < fb->height)) fb->buf[(y * fb->width) + x] = color;
+}
+
+// Fill 'len' frame buffer pixels of the line y starting at x; pixels outside the buffer are not drawn
+//--------------------------------------------------------------------------------
+static inline void fb_drawSpan(tft_fb_t *fb, int x, int y, int len, color_t color)
+{
+	x -= fb->org_x;
+	y -= fb->org_y;
+	if ((y < 0) || (y >= fb->height)) return;
+	if (x < 0) {
+		len += x;
+		x = 0;
+	}
+	if ((x + len) > fb->width) len = fb->width - x;
+	color_t *pixel = fb->buf + (y * fb->width) + x;
+	for (int n=0; n<len; n++) {
+		pixel[n] = color;
+	}
+}
+
+// Maximal size in bytes of the DMA line buffers used for sending frame buffer to display
+#define TFT_FB_LINEBUF_SIZE	SPI_MAX_DMA_LEN
+// Frame buffers larger than this are allocated in PSRAM if available
+#define TFT_FB_INTERNAL_MAX	32768
+
 // ==== Display commands constants ====
 #define TFT_INVOFF     0x20
 #define TFT_INVONN     0x21
@@ -227,6 +300,8 @@ typedef struct __attribute__((__packed__)) {
 #define TFT_DISPON     0x29
 #define TFT_MADCTL	   0x36
 #define TFT_PTLAR 	   0x30
+#define TFT_VSCRDEF	   0x33
+#define TFT_VSCRSADD   0x37
 #define TFT_ENTRYM 	   0xB7
 
 #define TFT_CMD_NOP			0x00
@@ -317,6 +392,11 @@ typedef struct __attribute__((__packed__)) {
 #define MADCTL_ML  0x10
 #define MADCTL_MH  0x04
 
+// Display memory column and row of the screen's upper left pixel, added to the address window
+// The display memory has the same number of unused columns (rows) on both sides of the screen
+#define TFT_COL_OFFSET	2
+#define TFT_ROW_OFFSET	1
+
 #define TFT_CASET		0x2A
 #define TFT_PASET		0x2B
 #define TFT_RAMWR		0x2C
@@ -624,17 +704,64 @@ void disp_spi_transfer_cmd(int8_t cmd);
 void disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t len);
 void drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel);
 void send_data(int x1, int y1, int x2, int y2, uint32_t len, color_t *buf);
+void drawSpan(int16_t x, int16_t y, int16_t len, color_t color);
 void TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t data, uint32_t len);
 int read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, uint8_t set_sp);
 color_t readPixel(int16_t x, int16_t y);
 int touch_get_data(uint8_t type);
 
+// Send frame buffer to display at position x,y
+// Each buffer pixel is replicated to fb->scale x fb->scale display pixels
+// Only the part which fits on the screen is sent
+// If the buffer is not DMA capable (in PSRAM), the lines are copied to two internal
+// DMA buffers, one is filled while the other is sent
+// If 'wait' is 0 and the buffer is sent directly, the function returns while the
+// last part is still being sent and the display stays selected by the calling task;
+// other tasks wait for the display until this task deselects it (next drawing to display,
+// disp_deselect() or fb_send_wait()); the buffer must not be changed before that
+//=============================================================
+void fb_send(tft_fb_t *fb, int x, int y, uint8_t wait);
+
+// Wait for the end of the transfer started by fb_send() without waiting and release the display
+// Inside the task's own disp_select() ~ disp_deselect() it only waits, the display is released by the deselect
+//==================
+void fb_send_wait();
+
+// Send frame buffer to display rotated clockwise by rot * 90 degrees,
+// x,y is the upper left corner of the rotated area on display
+// The display scan direction is temporary changed, so the buffer is sent in its natural order
+// The rotated area must fit on the screen, buffer scale must be 1
+// Returns 0 on success, -1 if the area does not fit, -2 on memory error, -3 on display error
+//==================================================================
+int fb_send_rotated(tft_fb_t *fb, int x, int y, uint8_t rot);
+
+
+// Define the screen rows (or columns if 'columns' is set) start ~ start+size-1 as the scrolling area
+// Display memory rows are scrolled (all supported controllers), they are screen rows in orientations
+// without swapped rows and columns (MADCTL_MV not set), else screen columns scrolled over the full screen height
+// The area is placed in display memory with the address window offset, the fixed areas cover all other memory rows
+// Only one area can be defined; size=0 removes the area and shows display memory unscrolled
+// Returns 0 on success, -1 if the display cannot scroll in that direction or the area is already defined
+//==============================================================
+int disp_set_scroll_area(int start, int size, uint8_t columns);
+
+// Show the rows (columns) of the scrolling area starting with its row 'offset' at the area start,
+// the area rows before 'offset' are shown after the last one
+// Returns 0 on success, -1 if the scrolling area is not defined
+//=================================
+int disp_set_scroll_offset(int offset);
 
-// Deactivate display's CS line
+// Deactivate display's CS line and release the display to other tasks
+// Selects of the same task are nested, only the deselect matching the first select releases the display
+// Does nothing if the display is not selected by the calling task or the task draws to frame buffer
 //========================
 esp_err_t disp_deselect();
 
 // Activate display's CS line and configure SPI interface if necessary
+// The display is used by one task at a time, other tasks wait in disp_select() until it is deselected;
+// selecting the display already selected by the task only waits for the running transfer and
+// increments the select count, so drawing functions used between disp_select() and disp_deselect() keep the display
+// Does nothing if the task draws to frame buffer (tft_fb is set), drawing to memory does not use the spi bus
 //======================
 esp_err_t disp_select();
 
@@ -650,6 +777,11 @@ uint32_t find_rd_speed();
 //=================================
 void _tft_setRotation(uint8_t rot);
 
+// Set the memory access control (MADCTL) register directly, for testing the scan directions
+// '_width' and '_height' are not changed
+//===================================
+void disp_set_madctl(uint8_t madctl);
+
 // Initialize all pins used by display driver
 // ** MUST be executed before SPI interface initialization
 //=================
@@ -53,6 +53,8 @@ static uint8_t run_gs_demo = 0; // Run gray scale demo if set to 1
 static struct tm* tm_info;
 static char tmp_buff[64];
 static time_t time_now, time_last = 0;
+static tft_text_t *time_text = NULL;	// time in the footer, updated in place
+static uint8_t footer_time = 0;			// footer shows the time printed with 'time_text'
 static const char *file_fonts[3] = {"/spiffs/fonts/DotMatrix_M.fon", "/spiffs/fonts/Ubuntu.fon", "/spiffs/fonts/Grotesk24x48.fon"};
 
 #define GDEMO_TIME 1000
@@ -183,8 +185,18 @@ static void _checkTime()
 		_bg = (color_t){ 64, 64, 64 };
 		TFT_setFont(DEFAULT_FONT, NULL);
 
-		TFT_fillRect(1, _height-TFT_getfontheight()-8, _width-3, TFT_getfontheight()+6, _bg);
-		TFT_print(tmp_buff, CENTER, _height-TFT_getfontheight()-5);
+		// only the changed digits are redrawn while the footer shows the time
+		if (time_text == NULL) time_text = TFT_text_create(CENTER, 0);
+		if ((time_text == NULL) || (!footer_time)) {
+			TFT_fillRect(1, _height-TFT_getfontheight()-8, _width-3, TFT_getfontheight()+6, _bg);
+			if (time_text) TFT_text_invalidate(time_text);
+			footer_time = 1;
+		}
+		if (time_text) {
+			time_text->y = _height-TFT_getfontheight()-5;
+			TFT_printUpdate(time_text, tmp_buff);
+		}
+		else TFT_print(tmp_buff, CENTER, _height-TFT_getfontheight()-5);
 
 		cfont = curr_font;
 		_fg = last_fg;
@@ -282,6 +294,7 @@ static void disp_header(char *info)
 {
 	TFT_fillScreen(TFT_BLACK);
 	TFT_resetclipwin();
+	footer_time = 0;
 
 	_fg = TFT_YELLOW;
 	_bg = (color_t){ 64, 64, 64 };
@@ -323,6 +336,7 @@ static void update_header(char *hdr, char *ftr)
 	}
 
 	if (ftr) {
+		footer_time = 0;
 		TFT_fillRect(1, _height-TFT_getfontheight()-8, _width-3, TFT_getfontheight()+6, _bg);
 		if (strlen(ftr) == 0) _dispTime();
 		else TFT_print(ftr, CENTER, _height-TFT_getfontheight()-5);
@@ -340,7 +354,38 @@ static void test_times() {
 
 	if (doprint) {
 	    uint32_t tstart, t1, t2;
+	    int t_fb = -1, t_canvas = -1;
+	    uint8_t fb_dma = 0;
 		disp_header("TIMINGS");
+
+		// ** Measure full screen frame buffer send timing
+		// Large frame buffer is in PSRAM (if enabled) and sent through internal DMA buffers
+		// The frame buffer is sent over the whole screen, header and footer are redrawn after it
+		TFT_saveClipWin();
+		TFT_resetclipwin();
+		if (TFT_fb_begin(1) == 0) {
+			fb_dma = tft_fb->dma;
+			tstart = clock();
+			TFT_fb_flush();
+			t_fb = clock() - tstart;
+			TFT_fb_end(0);
+		}
+		TFT_restoreClipWin();
+
+		// ** Measure the canvas send timing, canvas in internal DMA capable memory is sent directly
+		tft_fb_t *canvas = TFT_canvas_create(100, 100);
+		if (canvas) {
+			tstart = clock();
+			for (int n=0; n<10; n++) {
+				TFT_canvas_blit(canvas, dispWin.x1, dispWin.y1);
+				TFT_canvas_wait();
+			}
+			t_canvas = clock() - tstart;
+			if (!canvas->dma) t_canvas = -1;
+			TFT_canvas_delete(canvas);
+		}
+		disp_header("TIMINGS");
+
 		// ** Show Fill screen and send_line timings
 		tstart = clock();
 		TFT_fillWindow(TFT_BLACK);
@@ -350,19 +395,27 @@ static void test_times() {
 		sprintf(tmp_buff, "Clear screen: %u ms", t1);
 		TFT_print(tmp_buff, 0, 140);
 
+		if (t_fb >= 0) {
+			printf("      FB flush time: %d ms (%s)\r\n", t_fb, (fb_dma) ? "sent directly" : "through DMA bounce buffers");
+			sprintf(tmp_buff, "    FB flush: %d ms (%s)", t_fb, (fb_dma) ? "direct" : "bounce");
+			TFT_print(tmp_buff, 0, 148+(TFT_getfontheight()*2));
+		}
+		if (t_canvas >= 0) {
+			// 10 sends of 10000 pixels, time per 100000 pixels is shown
+			printf("     Canvas blit time: %d ms per 100000 pixels (internal DMA, sent directly)\r\n", t_canvas);
+			sprintf(tmp_buff, " Canvas blit: %d ms/100k px", t_canvas);
+			TFT_print(tmp_buff, 0, 152+(TFT_getfontheight()*3));
+		}
+
 		color_t *color_line = heap_caps_malloc((_width*3), MALLOC_CAP_DMA);
-		color_t *gsline = NULL;
-		if (gray_scale) gsline = malloc(_width*3);
 		if (color_line) {
 			float hue_inc = (float)((10.0 / (float)(_height-1) * 360.0));
 			for (int x=0; x<_width; x++) {
 				color_line[x] = HSBtoRGB(hue_inc, 1.0, (float)x / (float)_width);
-				if (gsline) gsline[x] = color_line[x];
 			}
 			disp_select();
 			tstart = clock();
 			for (int n=0; n<1000; n++) {
-				if (gsline) memcpy(color_line, gsline, _width*3);
 				send_data(0, 40+(n&63), dispWin.x2-dispWin.x1, 40+(n&63), (uint32_t)(dispWin.x2-dispWin.x1+1), color_line);
 				wait_trans_finish(1);
 			}
@@ -751,6 +804,55 @@ static void arc_demo()
 	Wait(-GDEMO_INFO_TIME);
 }
 
+// Render function for band rendering demo, must draw the same on every call
+//-------------------------------------
+static void band_demo_render(void *arg)
+{
+	int x = (dispWin.x2 - dispWin.x1) / 2;
+	int y = (dispWin.y2 - dispWin.y1) / 2;
+	int r = ((x < y) ? x : y) - 4;
+	int n = 0;
+	color_t color;
+
+	while (r > 10) {
+		color.r = (uint8_t)(64 + n*24);
+		color.g = (uint8_t)(252 - n*20);
+		color.b = (uint8_t)(n*32);
+		TFT_drawArc(x, y, r, 6, n*30, n*30 + 220, color, color);
+		r -= 8;
+		n++;
+	}
+	TFT_setFont(DEJAVU18_FONT, NULL);
+	_fg = TFT_YELLOW;
+	TFT_print("ESP32", CENTER, CENTER);
+}
+
+//----------------------
+static void band_demo()
+{
+	uint32_t tstart, t1, t2;
+
+	disp_header("DUAL CORE RENDERING");
+
+	// Render directly to display
+	tstart = clock();
+	band_demo_render(NULL);
+	t1 = clock() - tstart;
+	Wait(1000);
+
+	// Render in bands on both cores
+	TFT_fillWindow(TFT_BLACK);
+	tstart = clock();
+	int res = TFT_render_bands(4, band_demo_render, NULL);
+	if (res == -2) band_demo_render(NULL);	// no per task drawing contexts
+	t2 = clock() - tstart;
+
+	if (doprint) printf("   Band render time: %u ms (direct %u ms) [%d]\r\n", t2, t1, res);
+	sprintf(tmp_buff, "Direct %u ms, Bands %u ms", t1, t2);
+	update_header(NULL, tmp_buff);
+	Wait(-GDEMO_INFO_TIME);
+}
+
 //-----------------------
 static void circle_demo()
 {
@@ -1103,6 +1205,7 @@ void tft_demo() {
 		circle_demo();
 		ellipse_demo();
 		arc_demo();
+		band_demo();
 		triangle_demo();
 		poly_demo();
 		pixel_demo();